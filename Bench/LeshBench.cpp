@@ -0,0 +1,764 @@
+/**************************************************************************************\
+** File: LeshBench.cpp
+** Project: lesh - Lexellence Linux Shell
+** Author: David Leksen - Lexellence Games
+** Date:
+**
+** Micro-benchmarks for lesh. Lesh.cpp is compiled in (without its main) so parsing,
+** history, directory ranking and execution are measured through the shell's own code.
+**
+** lesh_bench [--json] [--quick] [name ...]: runs the benchmarks whose names contain
+** any of the names given, or all of them.
+\**************************************************************************************/
+#include "Lesh.cpp"
+#include <atomic>
+#include <climits>
+#include <new>
+#include <ftw.h>
+#include <libgen.h>
+#include <sys/statvfs.h>
+
+// Every allocation in the process is counted, so a benchmark can report allocations per operation. 
+// GCC can't tell that these deletes free what the new below malloc'd.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+std::atomic<std::uint64_t> allocationCount{ 0 };
+void* operator new(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if(void* memory{ std::malloc(size ? size : 1) })
+		return memory;
+	throw std::bad_alloc{};
+}
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+namespace LeshBench
+{
+	const std::string JSON_OPTION{ "--json" };
+	const std::string QUICK_OPTION{ "--quick" };
+	const Lex::Stats::Nanoseconds MIN_BATCH_TIME{ 1'000'000 };	// Long enough that reading the clock doesn't count
+	const std::uint64_t MIN_BATCHES{ 3 };
+	Lex::Stats::Nanoseconds minRunTime{ 300'000'000 };
+
+	struct Result
+	{
+		std::string name;
+		std::uint64_t operations{ 0 };
+		Lex::Stats::Histogram batchTimes;	// Time per operation, one value per batch
+		std::size_t bytesPerOperation{ 0 };
+		std::uint64_t allocationsPerOperation{ 0 };
+	};
+	std::vector<Result> results;
+	std::vector<std::string> nameFilters;
+	bool printJson{ false };
+	bool quick{ false };	// Shorter runs over less data
+	std::string scratchDirectory;
+
+	//+------------------------\----------------------------------
+	//|		   Harness		   |
+	//\------------------------/----------------------------------
+	bool IsSelected(std::string_view name);
+	bool IsAnySelected(const std::vector<std::string>& names);
+	void Run(std::string_view name, std::size_t bytesPerOperation, const std::function<void()>& operation);
+	void PrintResult(const Result& result);
+	void PrintJson(std::ostream& os);
+	bool ParseAndExecute(std::string_view line);
+	void WriteFile(const std::string& path, std::size_t size);
+	bool FindShell(const std::string& name, std::string& pathOut);
+	void RunShell(const std::string& shellPath, const Lex::WordLists::WordList& arguments);
+	void RemoveScratchDirectory();
+
+	//+------------------------\----------------------------------
+	//|		  Benchmarks	   |
+	//\------------------------/----------------------------------
+	void BenchParse();
+	void BenchHistory();
+	void BenchDirectories();
+	void BenchGlob();
+	void BenchVariables();
+	void BenchInput();
+	void BenchSpawn();
+	void BenchExecution();
+	void BenchRedirection();
+	void BenchScript();
+	void BenchPlacement();
+	void BenchMemo();
+	void BenchWatch();
+
+	//+------------------------\----------------------------------
+	//|		   Harness		   |
+	//\------------------------/----------------------------------
+	bool IsSelected(std::string_view name)
+	{
+		return nameFilters.empty() || std::any_of(nameFilters.begin(), nameFilters.end(),
+			[name](const std::string& filter) { return name.find(filter) != std::string_view::npos; });
+	}
+	bool IsAnySelected(const std::vector<std::string>& names)
+	{
+		return std::any_of(names.begin(), names.end(), [](const std::string& name) { return IsSelected(name); });
+	}
+	void Run(std::string_view name, std::size_t bytesPerOperation, const std::function<void()>& operation)
+	{
+		if(!IsSelected(name))
+			return;
+		Result result;
+		result.name = name;
+		result.bytesPerOperation = bytesPerOperation;
+
+		// The first call warms caches and arenas, the second counts allocations
+		operation();
+		std::uint64_t allocationsBefore{ allocationCount.load() };
+		operation();
+		result.allocationsPerOperation = allocationCount.load() - allocationsBefore;
+
+		// Batches double until one takes MIN_BATCH_TIME, then run at that size for minRunTime
+		std::uint64_t batchSize{ 1 };
+		Lex::Stats::Nanoseconds runStart{ 0 };
+		while(true)
+		{
+			Lex::Stats::Nanoseconds batchStart{ Lex::Stats::Now() };
+			for(std::uint64_t i = 0; i < batchSize; ++i)
+				operation();
+			Lex::Stats::Nanoseconds batchEnd{ Lex::Stats::Now() };
+			if(runStart == 0)
+			{
+				if(batchEnd - batchStart < MIN_BATCH_TIME)
+				{
+					batchSize *= 2;
+					continue;
+				}
+				runStart = batchStart;
+			}
+			result.batchTimes.Add((batchEnd - batchStart) / static_cast<Lex::Stats::Nanoseconds>(batchSize));
+			result.operations += batchSize;
+			if(result.batchTimes.Count() >= MIN_BATCHES && batchEnd - runStart >= minRunTime)
+				break;
+		}
+		if(!printJson)
+			PrintResult(result);
+		results.push_back(std::move(result));
+	}
+	void PrintResult(const Result& result)
+	{
+		// Percentiles are bucket bounds, within an eighth of the true time
+		std::cout << std::left << std::setw(40) << result.name << std::right
+				  << std::setw(10) << Lesh::FormatDuration(result.batchTimes.Percentile(0.5))
+				  << std::setw(10) << Lesh::FormatDuration(result.batchTimes.Percentile(0.9))
+				  << std::setw(10) << Lesh::FormatDuration(result.batchTimes.Min());
+		if(result.bytesPerOperation > 0)
+			std::cout << std::setw(10) << std::fixed << std::setprecision(0)
+					  << 1e3 * static_cast<double>(result.bytesPerOperation) / static_cast<double>(result.batchTimes.Percentile(0.5)) << " MB/s";
+		else
+			std::cout << std::setw(15) << "";
+		std::cout << std::setw(8) << result.allocationsPerOperation << " allocs" << std::endl;
+	}
+	void PrintJson(std::ostream& os)
+	{
+		// Durations in nanoseconds per operation
+		os << '[';
+		for(std::vector<Result>::size_type i = 0; i < results.size(); ++i)
+		{
+			const Result& result{ results[i] };
+			os << (i > 0 ? ",\n" : "\n") << "{\"name\":";
+			Lex::Strings::PrintJsonString(os, result.name);
+			os << ",\"operations\":" << result.operations
+			   << ",\"p50_ns\":" << result.batchTimes.Percentile(0.5) << ",\"p90_ns\":" << result.batchTimes.Percentile(0.9)
+			   << ",\"min_ns\":" << result.batchTimes.Min() << ",\"bytes\":" << result.bytesPerOperation
+			   << ",\"allocations\":" << result.allocationsPerOperation << '}';
+		}
+		os << "\n]" << std::endl;
+	}
+	bool ParseAndExecute(std::string_view line)
+	{
+		// Like one line typed at the prompt
+		Lesh::lineArena.release();
+		Lesh::CommandList commandList{ &Lesh::lineArena };
+		if(!Lesh::ParseLine(line, true, commandList))
+			return false;
+		int exitStatus;
+		Lesh::ExecuteCommandList(commandList, exitStatus);
+		return true;
+	}
+	void WriteFile(const std::string& path, std::size_t size)
+	{
+		int fd{ open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+		std::string block(1 << 20, 'x');
+		for(std::size_t written = 0; fd >= 0 && written < size; written += block.size())
+			Lex::Posix::WriteAll(fd, block.data(), std::min(block.size(), size - written));
+		if(fd >= 0)
+			close(fd);
+	}
+	bool FindShell(const std::string& name, std::string& pathOut)
+	{
+		// lesh is built next to lesh_bench, the others are looked up in PATH
+		if(name != Lesh::SHELL_NAME)
+			return Lex::Posix::FindExecutableInPath(name, Lesh::shellVariables.Get(Lesh::PATH_VARIABLE), pathOut);
+		char benchPath[PATH_MAX];
+		ssize_t length{ readlink("/proc/self/exe", benchPath, sizeof(benchPath) - 1) };
+		if(length <= 0)
+			return false;
+		benchPath[length] = '\0';
+		pathOut = std::string{ dirname(benchPath) } + '/' + Lesh::SHELL_NAME;
+		return access(pathOut.c_str(), X_OK) == 0;
+	}
+	void RunShell(const std::string& shellPath, const Lex::WordLists::WordList& arguments)
+	{
+		pid_t childPid;
+		int status;
+		if(Lex::Posix::SpawnExternalApp(shellPath, arguments, {}, Lesh::shellVariables.GetEnvp(), childPid))
+			Lex::Posix::WaitForChild(childPid, status, shellPath);
+	}
+	void RemoveScratchDirectory()
+	{
+		nftw(scratchDirectory.c_str(), [](const char* path, const struct stat*, int, FTW*) { return remove(path); },
+			 64, FTW_DEPTH | FTW_PHYS);
+	}
+
+	//+------------------------\----------------------------------
+	//|		  Benchmarks	   |
+	//\------------------------/----------------------------------
+	void BenchParse()
+	{
+		const std::string TYPICAL_LINE{ "git log --oneline -n 20 | grep -v 'Merge branch' > log.txt && echo \"done: $?\" ; ls -la ~/src # list" };
+
+		// Split alone, into a reused word vector and buffer
+		auto benchSplit = [](std::string_view name, const std::string& line) {
+			std::vector<char> wordBuffer(2 * line.size() + 1);
+			Lex::WordLists::WordVector words;
+			Run(name, line.size(), [&]() {
+				words.clear();
+				Lex::WordLists::Split(line, wordBuffer.data(), Lesh::SPLIT_RULES, words);
+			});
+		};
+		benchSplit("parse/split/typical-line", TYPICAL_LINE);
+		std::string longLine{ "echo" };
+		for(int i = 0; i < 200'000; ++i)
+			longLine += (i % 4 == 0) ? " 'quoted arg'" : (i % 4 == 1) ? " \"double $x\"" : (i % 4 == 2) ? " esc\\ aped" : " argument";
+		benchSplit("parse/split/2.6MB-line", longLine);
+
+		// SeparateIntoCommands alone, from words split once
+		std::pmr::monotonic_buffer_resource wordArena;
+		char* wordBuffer{ static_cast<char*>(wordArena.allocate(2 * TYPICAL_LINE.size() + 1, 1)) };
+		Lex::WordLists::WordVector words{ &wordArena };
+		Lex::WordLists::Split(TYPICAL_LINE, wordBuffer, Lesh::SPLIT_RULES, words);
+		Run("parse/separate-into-commands", 0, [&words]() {
+			Lesh::lineArena.release();
+			Lesh::CommandList commandList{ &Lesh::lineArena };
+			Lesh::SeparateIntoCommands(words, commandList);
+		});
+
+		// The whole parse stage
+		auto benchParseLine = [](std::string_view name, const std::string& line) {
+			Run(name, line.size(), [&line]() {
+				Lesh::lineArena.release();
+				Lesh::CommandList commandList{ &Lesh::lineArena };
+				Lesh::ParseLine(line, false, commandList);
+			});
+		};
+		benchParseLine("parse/parse-line/typical-line", TYPICAL_LINE);
+		benchParseLine("parse/parse-line/2.6MB-line", longLine);
+		Lesh::lineArena.release();
+	}
+	void BenchHistory()
+	{
+		auto entryText = [](std::size_t i) {
+			switch(i % 4)
+			{
+			case 0: return "kubectl get pods " + std::to_string(i);
+			case 1: return "git commit -m 'change " + std::to_string(i) + "'";
+			case 2: return "make -j8 target_" + std::to_string(i);
+			default: return "ssh host" + std::to_string(i % 1000) + ".example.com uptime";
+			}
+		};
+		const std::size_t SIZES[]{ 1'000, 100'000, 1'000'000 };
+		const std::string SIZE_NAMES[]{ "1k", "100k", "1M" };
+
+		// In-memory ring: each add is new or moves a duplicate to the front
+		for(int s = 0; s < 3; ++s)
+		{
+			std::string name{ "history/ring-add/" + SIZE_NAMES[s] };
+			if(!IsSelected(name))
+				continue;
+			std::vector<std::string> texts;
+			for(std::size_t i = 0; i < 2 * SIZES[s]; ++i)
+				texts.push_back(entryText(i));
+			Lex::Lists::UniqueStringRing ring{ SIZES[s] };
+			for(std::size_t i = 0; i < SIZES[s]; ++i)
+				ring.AddToFront(texts[i]);
+			std::size_t next{ SIZES[s] };
+			Run(name, 0, [&]() {
+				ring.AddToFront(texts[next]);
+				next = (next + 1) % texts.size();
+			});
+		}
+
+		// History files: opening and reading the newest entries, appending, and Ctrl-R search
+		for(int s = 0; s < 3; ++s)
+		{
+			std::string path{ scratchDirectory + "/history_" + SIZE_NAMES[s] };
+			Lex::Posix::AppendOnlyRecordFile file;
+			file.Open(path);
+			std::vector<std::string> batch;
+			for(std::size_t i = 0; i < SIZES[s]; ++i)
+			{
+				batch.push_back(entryText(i));
+				if(batch.size() == 10'000 || i + 1 == SIZES[s])
+				{
+					file.Append(batch);
+					batch.clear();
+				}
+			}
+			file.Close();
+			Lesh::shellVariables.Set(Lesh::HISTORY_FILE_VARIABLE, path);
+			Run("history/open-and-list-1000/" + SIZE_NAMES[s], 0, []() {
+				Lesh::historyFileEntries.clear();
+				Lesh::historyFileEntrySet.clear();
+				Lesh::OpenHistoryFile();
+				std::vector<std::string_view> entries;
+				Lesh::GetHistoryEntries(Lesh::HISTORY_MAX_SIZE, entries);
+			});
+			if(s != 2)
+				continue;
+
+			Lesh::historyFileEntries.clear();
+			Lesh::historyFileEntrySet.clear();
+			Lesh::OpenHistoryFile();
+			Run("history/search-index-build/1M", 0, []() {
+				Lesh::historySearchIndex.Clear();
+				Lesh::historySearchRecordEnds.clear();
+				Lesh::UpdateHistorySearchIndex();
+			});
+			for(std::string_view query : { "kubectl get pods 4242", "12345a", "zzzz" })
+				Run("history/search/1M/" + std::string{ query }, 0, [query]() {
+					std::size_t position;
+					std::string entry;
+					Lesh::SearchHistory(query, Lex::Console::LineEditor::NO_POSITION, position, entry);
+				});
+			std::size_t next{ 0 };
+			Run("history/record", 0, [&]() {
+				Lesh::RecordHistory(entryText(next++));
+			});
+		}
+		Lesh::historyFile.Close();
+		Lesh::historySearchIndex.Clear();
+		Lesh::historySearchRecordEnds.clear();
+		Lesh::historyFileEntries.clear();
+		Lesh::historyFileEntrySet.clear();
+		Lesh::commandHistory.Clear();
+	}
+	void BenchDirectories()
+	{
+		// z over 50k ranked directories
+		if(!IsSelected("z/find"))
+			return;
+		for(int i = 0; i < 50'000; ++i)
+			Lesh::AddDirectoryRank("/home/user/src/Project" + std::to_string(i % 500) + "/module" + std::to_string(i) + "/Source",
+								   Lesh::DirectoryRank{ static_cast<double>(1 + i % 7), 1'700'000'000 + i });
+		for(const std::vector<std::string>& terms : std::vector<std::vector<std::string>>{ { "project42", "module" }, { "source" }, { "nothing" } })
+			Run("z/find/50k/" + terms.back(), 0, [&terms]() {
+				std::vector<const Lesh::DirectoryEntry*> entries;
+				Lesh::FindDirectories(terms, entries);
+			});
+		Lesh::ClearDirectoryRanks();
+	}
+	void BenchGlob()
+	{
+		// **/*.cpp over 200 directories of 100 files, half of them .cpp
+		if(!IsSelected("glob/"))
+			return;
+		std::string root{ scratchDirectory + "/tree" };
+		mkdir(root.c_str(), 0700);
+		for(int d = 0; d < 200; ++d)
+		{
+			std::string directory{ root + "/dir" + std::to_string(d % 20) };
+			mkdir(directory.c_str(), 0700);
+			directory += "/sub" + std::to_string(d);
+			mkdir(directory.c_str(), 0700);
+			for(int f = 0; f < 100; ++f)
+				close(open((directory + "/file" + std::to_string(f) + ((f % 2) ? ".cpp" : ".h")).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600));
+		}
+		std::string pattern{ root + "/**/*.cpp" };
+		Run("glob/recursive/20k-files", 0, [&pattern]() {
+			Lex::Posix::DirectoryCache cache;
+			std::vector<std::string> paths;
+			Lex::Posix::Glob(pattern, cache, paths);
+		});
+		Lex::Posix::DirectoryCache cache;
+		Run("glob/recursive/20k-files-cached", 0, [&pattern, &cache]() {
+			std::vector<std::string> paths;
+			Lex::Posix::Glob(pattern, cache, paths);
+		});
+	}
+	void BenchVariables()
+	{
+		Lesh::shellVariables.Set("BENCH_VARIABLE", "some value");
+		const std::string LINE{ "echo $HOME ${BENCH_VARIABLE}x \"$PATH\" $? plain words" };
+		Run("variables/expand", 0, [&LINE]() {
+			Lesh::lineArena.release();
+			Lesh::CommandList commandList{ &Lesh::lineArena };
+			Lesh::ParseLine(LINE, false, commandList);
+			Lesh::Pipeline expanded;
+			Lesh::ExpandParameters(commandList[0].pipelines[0], expanded);
+		});
+		Lesh::lineArena.release();
+		Run("variables/envp/cached", 0, []() {
+			Lesh::shellVariables.Set("BENCH_VARIABLE", "not exported");
+			Lesh::shellVariables.GetEnvp();
+		});
+		Lesh::shellVariables.Export("BENCH_VARIABLE");
+		Run("variables/envp/after-export-change", 0, []() {
+			Lesh::shellVariables.Set("BENCH_VARIABLE", "exported");
+			Lesh::shellVariables.GetEnvp();
+		});
+		Lesh::shellVariables.Unset("BENCH_VARIABLE");
+	}
+	void BenchInput()
+	{
+		// 100k lines from a file through the batch-input line reader
+		int fd{ Lex::Posix::CreateMemoryFile("lesh_bench_input") };
+		std::string text;
+		for(int i = 0; i < 100'000; ++i)
+			text += "echo line " + std::to_string(i) + " with a few more words\n";
+		Lex::Posix::WriteAll(fd, text.data(), text.size());
+		Run("input/line-reader/100k-lines", text.size(), [fd]() {
+			lseek(fd, 0, SEEK_SET);
+			Lex::Posix::LineReader reader{ fd };
+			std::string_view line;
+			while(reader.ReadLine(line))
+				;
+		});
+		close(fd);
+	}
+	void BenchSpawn()
+	{
+		// posix_spawn against fork and exec while the shell holds 0, 256 MiB and 1 GiB of touched heap. 
+		// fork copies the page tables of all of it, posix_spawn (CLONE_VM) none of it.
+		std::string truePath;
+		if(!Lex::Posix::FindExecutableInPath("true", Lesh::shellVariables.Get(Lesh::PATH_VARIABLE), truePath))
+			return;
+		const std::size_t MEBIBYTE{ 1 << 20 };
+		std::uint64_t availableBytes{ static_cast<std::uint64_t>(sysconf(_SC_AVPHYS_PAGES)) * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE)) };
+		for(std::size_t heapMebibytes : { 0, 256, 1024 })
+		{
+			std::string group{ "spawn/heap-" + std::to_string(heapMebibytes) + "MiB/" };
+			if(2 * heapMebibytes * MEBIBYTE > availableBytes || !IsSelected(group))
+				continue;
+			std::vector<char> heap(heapMebibytes * MEBIBYTE, 1);
+			Run(group + "posix-spawn", 0, [&truePath]() {
+				Lex::WordLists::WordList arguments{ "true" };
+				pid_t childPid;
+				int status;
+				if(Lex::Posix::SpawnExternalApp(truePath, arguments, {}, Lesh::shellVariables.GetEnvp(), childPid))
+					Lex::Posix::WaitForChild(childPid, status, "spawn");
+			});
+			Run(group + "fork-exec", 0, [&truePath]() {
+				pid_t childPid;
+				int status;
+				if(Lex::Posix::ForkAndRun([&truePath]() {
+						char* const argv[]{ const_cast<char*>("true"), nullptr };
+						execve(truePath.c_str(), argv, Lesh::shellVariables.GetEnvp());
+						return Lesh::EXIT_STATUS_NOT_FOUND;
+					}, {}, childPid, "fork"))
+					Lex::Posix::WaitForChild(childPid, status, "fork");
+			});
+		}
+	}
+	void BenchExecution()
+	{
+		// Builtins against the same command spawned
+		Run("execute/builtin-test", 0, []() {
+			ParseAndExecute("test 1 -eq 1");
+		});
+		std::string testPath;
+		if(Lex::Posix::FindExecutableInPath("test", Lesh::shellVariables.Get(Lesh::PATH_VARIABLE), testPath))
+			Run("execute/external-test", 0, [&testPath]() {
+				ParseAndExecute(testPath + " 1 -eq 1");
+			});
+
+		// 1 GiB (64 MiB with --quick) through 2-, 4- and 8-stage pipelines: head, then cats, with and without the splice stages
+		const std::size_t PIPELINE_BYTES{ quick ? std::size_t{ 64 } << 20 : std::size_t{ 1 } << 30 };
+		for(int stages : { 2, 4, 8 })
+		{
+			std::string pipeline{ "head -c " + std::to_string(PIPELINE_BYTES) + " /dev/zero" };
+			for(int stage = 1; stage < stages; ++stage)
+				pipeline += " | cat";
+			pipeline += " > /dev/null";
+			for(bool splice : { false, true })
+				Run("execute/pipeline-" + std::to_string(stages) + "-stages/" + (splice ? "splice" : "apps"), PIPELINE_BYTES, [&pipeline, splice]() {
+					Lesh::spliceMiddleStages = splice;
+					ParseAndExecute(pipeline);
+				});
+		}
+		Lesh::spliceMiddleStages = false;
+
+		// Redirected copy of a 64 MiB file: builtin cat (sendfile) and the cat app
+		if(IsSelected("execute/redirect-cat"))
+		{
+			const std::size_t COPY_BYTES{ 64 << 20 };
+			std::string inPath{ scratchDirectory + "/cat_in" };
+			std::string outPath{ scratchDirectory + "/cat_out" };
+			WriteFile(inPath, COPY_BYTES);
+			std::string catPath;
+			Lex::Posix::FindExecutableInPath("cat", Lesh::shellVariables.Get(Lesh::PATH_VARIABLE), catPath);
+			for(const std::string& cat : { Lesh::CAT_COMMAND, catPath })
+				Run(cat == Lesh::CAT_COMMAND ? "execute/redirect-cat/builtin" : "execute/redirect-cat/app", COPY_BYTES, [&]() {
+					ParseAndExecute(cat + " < " + inPath + " > " + outPath);
+				});
+		}
+
+		// One CPU-bound job per core, sha256sum of a 64 MiB file (16 MiB with --quick), on pools of 1, 2, 4... 
+		// up to the core count, with each pool's speedup over -j 1
+		const long onlineCpus{ std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)) };
+		std::vector<long> poolSizes;
+		std::vector<std::string> poolNames;
+		for(long poolSize = 1; poolSize < onlineCpus; poolSize *= 2)
+			poolSizes.push_back(poolSize);
+		poolSizes.push_back(onlineCpus);
+		for(long poolSize : poolSizes)
+			poolNames.push_back("execute/parallel-hash/j" + std::to_string(poolSize));
+		if(IsAnySelected(poolNames))
+		{
+			const std::size_t HASH_BYTES{ quick ? std::size_t{ 16 } << 20 : std::size_t{ 64 } << 20 };
+			std::string hashPath{ scratchDirectory + "/hash_in" };
+			WriteFile(hashPath, HASH_BYTES);
+			std::string jobs;
+			for(long job = 0; job < onlineCpus; ++job)
+				jobs += (job > 0 ? " " + Lesh::PARALLEL_SEPARATOR : std::string{}) + " sha256sum " + hashPath;
+			Lex::Stats::Nanoseconds serialTime{ 0 };
+			for(std::vector<long>::size_type i = 0; i < poolSizes.size(); ++i)
+			{
+				const long poolSize{ poolSizes[i] };
+				const std::string& name{ poolNames[i] };
+				std::string line{ Lesh::PARALLEL_COMMAND + ' ' + Lesh::PARALLEL_JOBS_OPTION + ' ' + std::to_string(poolSize) + jobs + " > /dev/null" };
+				Run(name, onlineCpus * HASH_BYTES, [&line]() {
+					ParseAndExecute(line);
+				});
+				if(results.empty() || results.back().name != name)
+					continue;
+				Lex::Stats::Nanoseconds time{ results.back().batchTimes.Percentile(0.5) };
+				if(poolSize == 1)
+					serialTime = time;
+				else if(serialTime > 0 && !printJson)
+					std::cout << std::left << std::setw(40) << name + " speedup" << std::right << std::setw(9) << std::fixed 
+							  << std::setprecision(2) << static_cast<double>(serialTime) / static_cast<double>(time) << 'x' << std::endl;
+			}
+		}
+	}
+	void BenchRedirection()
+	{
+		// 4 GiB (64 MiB with --quick) written by head through > and >>, under lesh and under bash -c. 
+		// Every run starts from an empty file, so >> doesn't grow it.
+		const std::size_t WRITE_BYTES{ quick ? std::size_t{ 64 } << 20 : std::size_t{ 4 } << 30 };
+		const std::string SIZE_NAME{ quick ? "64MiB" : "4GiB" };
+		const std::string GROUPS[]{ "redirect/truncate-" + SIZE_NAME + '/', "redirect/append-" + SIZE_NAME + '/' };
+		if(!IsAnySelected({ GROUPS[0] + Lesh::SHELL_NAME, GROUPS[0] + "bash", GROUPS[1] + Lesh::SHELL_NAME, GROUPS[1] + "bash" }))
+			return;
+		struct statvfs fileSystemInfo;
+		if(statvfs(scratchDirectory.c_str(), &fileSystemInfo) != 0 || 
+		   static_cast<std::uint64_t>(fileSystemInfo.f_bavail) * fileSystemInfo.f_frsize < 2 * WRITE_BYTES)
+		{
+			std::cerr << "lesh_bench: redirect/: not enough free space in " << scratchDirectory << std::endl;
+			return;
+		}
+		std::string outPath{ scratchDirectory + "/redirect_out" };
+		std::string bashPath;
+		bool haveBash{ FindShell("bash", bashPath) };
+		for(bool append : { false, true })
+		{
+			std::string line{ "head -c " + std::to_string(WRITE_BYTES) + " /dev/zero " + 
+							  (append ? Lesh::REDIRECT_OUTPUT_APPEND_OPERATOR : Lesh::REDIRECT_OUTPUT_OPERATOR) + ' ' + outPath };
+			const std::string& group{ GROUPS[append] };
+			Run(group + Lesh::SHELL_NAME, WRITE_BYTES, [&]() {
+				truncate(outPath.c_str(), 0);
+				ParseAndExecute(line);
+			});
+			if(haveBash)
+				Run(group + "bash", WRITE_BYTES, [&]() {
+					truncate(outPath.c_str(), 0);
+					RunShell(bashPath, { "-c", line });
+				});
+		}
+		remove(outPath.c_str());
+	}
+	void BenchScript()
+	{
+		// The same 100k-line script, of assignments, tests and builtins, run by lesh, bash and dash
+		const std::string SHELLS[]{ Lesh::SHELL_NAME, "bash", "dash" };
+		if(!IsAnySelected({ "script/100k-lines/" + SHELLS[0], "script/100k-lines/" + SHELLS[1], "script/100k-lines/" + SHELLS[2] }))
+			return;
+		std::string scriptPath{ scratchDirectory + "/script_100k.sh" };
+		std::string text;
+		for(int i = 0; i < 100'000; ++i)
+			switch(i % 4)
+			{
+			case 0: text += "x=value" + std::to_string(i) + '\n'; break;
+			case 1: text += "echo line " + std::to_string(i) + " \"$x\" > /dev/null\n"; break;
+			case 2: text += "[ \"$x\" = value" + std::to_string(i - 2) + " ] && y=" + std::to_string(i) + '\n'; break;
+			default: text += "false || true\n"; break;
+			}
+		int fd{ open(scriptPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+		if(fd < 0)
+			return;
+		Lex::Posix::WriteAll(fd, text.data(), text.size());
+		close(fd);
+		for(const std::string& shell : SHELLS)
+		{
+			std::string shellPath;
+			if(FindShell(shell, shellPath))
+				Run("script/100k-lines/" + shell, 0, [&]() {
+					RunShell(shellPath, { scriptPath });
+				});
+		}
+	}
+	void BenchPlacement()
+	{
+		// One memory-bound child (a STREAM triad over 48 MiB) per CPU, unplaced and with pin --auto. 
+		// Each child allocates its own arrays, so first touch puts them on its node.
+		const std::size_t ELEMENTS{ 2 << 20 };
+		const int PASSES{ 4 };
+		long onlineCpus{ sysconf(_SC_NPROCESSORS_ONLN) };
+		const int children{ static_cast<int>(std::max(2L, onlineCpus)) };
+		auto triad = [&]() {
+			std::vector<double> a(ELEMENTS), b(ELEMENTS, 1.0), c(ELEMENTS, 2.0);
+			for(int pass = 0; pass < PASSES; ++pass)
+				for(std::size_t i = 0; i < ELEMENTS; ++i)
+					a[i] = b[i] + 3.0 * c[i];
+			return a[ELEMENTS / 2] == 7.0 ? EXIT_SUCCESS : EXIT_FAILURE;
+		};
+		for(const std::string& mode : { Lesh::PIN_AUTO_OFF, Lesh::PIN_AUTO_CORES, Lesh::PIN_AUTO_NODES })
+		{
+			if(!Lesh::SetAutoPlacement(mode))
+				continue;
+			Run("placement/triad/" + mode, children * PASSES * 3 * ELEMENTS * sizeof(double), [&]() {
+				std::vector<pid_t> childPids;
+				for(int i = 0; i < children; ++i)
+				{
+					std::optional<Lex::Posix::ScopedPlacement> scopedPlacement;
+					if(const Lex::Posix::Placement* placementPtr{ Lesh::NextAutoPlacement() })
+						scopedPlacement.emplace(*placementPtr);
+					pid_t childPid;
+					if(Lex::Posix::ForkAndRun(triad, {}, childPid, "triad"))
+						childPids.push_back(childPid);
+				}
+				int status;
+				for(pid_t childPid : childPids)
+					Lex::Posix::WaitForChild(childPid, status, "triad");
+			});
+		}
+		Lesh::SetAutoPlacement(Lesh::PIN_AUTO_OFF);
+	}
+	void BenchMemo()
+	{
+		// A command that prints 6.7 MB, run and replayed from the cache
+		const std::string COMMAND{ "seq 1000000 < /dev/null > /dev/null" };
+		Lesh::shellVariables.Set(Lesh::MEMO_DIRECTORY_VARIABLE, scratchDirectory + "/memo");
+		Run("memo/seq-1M/run", 0, [&COMMAND]() {
+			ParseAndExecute(COMMAND);
+		});
+		Run("memo/seq-1M/hit", 0, [&COMMAND]() {
+			ParseAndExecute("memo " + COMMAND);
+		});
+	}
+	void BenchWatch()
+	{
+		// Save to run: a file is written under a watch-run in a child, until the touch it runs is seen. 
+		// Includes the 50ms debounce.
+		if(!IsSelected("watch/save-to-run"))
+			return;
+		std::string watchedDirectory{ scratchDirectory + "/watched" };
+		std::string markerName{ "marker" };
+		mkdir(watchedDirectory.c_str(), 0700);
+		int inotifyFd{ inotify_init1(IN_CLOEXEC) };
+		if(inotifyFd < 0 || inotify_add_watch(inotifyFd, scratchDirectory.c_str(), IN_ATTRIB) < 0)
+			return;
+		auto waitForMarker = [inotifyFd, &markerName]() {
+			alignas(inotify_event) char events[4096];
+			bool seen{ false };
+			while(!seen)
+			{
+				ssize_t numRead{ read(inotifyFd, events, sizeof(events)) };
+				if(numRead <= 0)
+					return;
+				for(char* eventPtr = events; eventPtr < events + numRead; )
+				{
+					const inotify_event* event{ reinterpret_cast<const inotify_event*>(eventPtr) };
+					eventPtr += sizeof(inotify_event) + event->len;
+					seen = seen || (event->len > 0 && markerName == event->name);
+				}
+			}
+		};
+		pid_t watcherPid;
+		std::string line{ "watch-run " + watchedDirectory + " -- touch " + scratchDirectory + '/' + markerName };
+		Lex::Posix::SpawnFileActionList fileActions;
+		fileActions.push_back(Lex::Posix::SpawnFileAction::Open(STDERR_FILENO, "/dev/null", O_WRONLY, 0));
+		if(!Lex::Posix::ForkAndRun([&line]() { return ParseAndExecute(line) ? EXIT_SUCCESS : EXIT_FAILURE; }, fileActions, watcherPid, "watch-run"))
+			return;
+
+		// The first run comes once the watches are in place
+		waitForMarker();
+		Run("watch/save-to-run", 0, [&]() {
+			WriteFile(watchedDirectory + "/source", 16);
+			waitForMarker();
+		});
+		kill(watcherPid, SIGINT);
+		int status;
+		Lex::Posix::WaitForChild(watcherPid, status, "watch-run");
+		close(inotifyFd);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	for(int i = 1; i < argc; ++i)
+	{
+		if(argv[i] == LeshBench::JSON_OPTION)
+			LeshBench::printJson = true;
+		else if(argv[i] == LeshBench::QUICK_OPTION)
+		{
+			LeshBench::quick = true;
+			LeshBench::minRunTime = 20'000'000;
+		}
+		else
+			LeshBench::nameFilters.push_back(argv[i]);
+	}
+
+	// Nothing is recorded to the user's history or directory files
+	Lesh::interactive = false;
+	Lesh::shellVariables.Set(Lesh::HISTORY_FILE_VARIABLE, "");
+	Lesh::shellVariables.Set(Lesh::DIRECTORY_FILE_VARIABLE, "");
+	char scratchTemplate[]{ "/tmp/lesh_bench.XXXXXX" };
+	if(!mkdtemp(scratchTemplate))
+	{
+		perror("lesh_bench: mkdtemp");
+		return EXIT_FAILURE;
+	}
+	LeshBench::scratchDirectory = scratchTemplate;
+
+	if(!LeshBench::printJson)
+		std::cout << std::left << std::setw(40) << "benchmark" << std::right << std::setw(10) << "p50"
+				  << std::setw(10) << "p90" << std::setw(10) << "min" << std::endl;
+	LeshBench::BenchParse();
+	LeshBench::BenchHistory();
+	LeshBench::BenchDirectories();
+	LeshBench::BenchGlob();
+	LeshBench::BenchVariables();
+	LeshBench::BenchInput();
+	LeshBench::BenchSpawn();
+	LeshBench::BenchExecution();
+	LeshBench::BenchRedirection();
+	LeshBench::BenchScript();
+	LeshBench::BenchPlacement();
+	LeshBench::BenchMemo();
+	LeshBench::BenchWatch();
+	if(LeshBench::printJson)
+		LeshBench::PrintJson(std::cout);
+
+	LeshBench::RemoveScratchDirectory();
+	return EXIT_SUCCESS;
+}
@@ -11,20 +11,62 @@
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <string_view>
+#include <sstream>
+#include <memory_resource>
+#include <charconv>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
 #include "LexUtility.h"
 #include "LexConsole.h"
 
 namespace Lesh
 {
 	// Operators/Separators
-	const std::vector<char> WHITESPACE_CHARS{ ' ', '\t' };
-	const std::string COMMAND_SEPARATOR_1{ "&&" };
-	const std::string COMMAND_SEPARATOR_2{ ";" };
+	const std::string WHITESPACE_CHARS{ " \t" };
+	const std::string COMMAND_SEPARATOR{ ";" };
+	const std::string AND_OPERATOR{ "&&" };
+	const std::string OR_OPERATOR{ "||" };
 	const std::string REDIRECT_OUTPUT_OPERATOR{ ">" };
 	const std::string REDIRECT_OUTPUT_APPEND_OPERATOR{ ">>" };
 	const std::string REDIRECT_INPUT_OPERATOR{ "<" };
-	const std::string PIPING_OPERATOR{ "<" };
+	const std::string PIPING_OPERATOR{ "|" };
+	const std::string BACKGROUND_OPERATOR{ "&" };
+
+	// Command-line options
+	const std::string COMMAND_STRING_OPTION{ "-c" };
+	const std::string PROFILE_OPTION{ "--profile" };
+	const std::string PROFILE_JSON_OPTION{ "--profile=json" };
+	const char COMMENT_CHAR{ '#' };
+	const char EXPANSION_CHAR{ '$' };
+
+	// Tokenizer character table
+	const Lex::WordLists::SplitRules SPLIT_RULES{ WHITESPACE_CHARS, 
+		{ COMMAND_SEPARATOR, AND_OPERATOR, OR_OPERATOR, REDIRECT_OUTPUT_OPERATOR, REDIRECT_OUTPUT_APPEND_OPERATOR, 
+		  REDIRECT_INPUT_OPERATOR, PIPING_OPERATOR, BACKGROUND_OPERATOR }, COMMENT_CHAR, EXPANSION_CHAR };
 
 	// Commands
 	const std::string SHELL_NAME{ "lesh" };
@@ -34,6 +76,71 @@ namespace Lesh
 	const std::string CHANGE_TO_LAST_DIRECTORY_COMMAND{ "cdl" };
 	const std::string DISPLAY_HISTORY_COMMAND{ "history" };
 	const std::string EXECUTE_HISTORY_COMMAND{ "!" };
+	const std::string HASH_COMMAND{ "hash" };
+	const std::string HASH_RESET_OPTION{ "-r" };
+	const std::string JOBS_COMMAND{ "jobs" };
+	const std::string WAIT_COMMAND{ "wait" };
+	const std::string FOREGROUND_COMMAND{ "fg" };
+	const std::string JOB_ID_PREFIX{ "%" };
+	const std::string PARALLEL_COMMAND{ "parallel" };
+	const std::string PARALLEL_JOBS_OPTION{ "-j" };
+	const std::string PARALLEL_SEPARATOR{ ":::" };
+	const std::string CAT_COMMAND{ "cat" };
+	const std::string TEE_COMMAND{ "tee" };
+	const std::string CAT_STDIN_ARGUMENT{ "-" };
+	const std::string ECHO_COMMAND{ "echo" };
+	const std::string PRINTF_COMMAND{ "printf" };
+	const std::string TEST_COMMAND{ "test" };
+	const std::string TEST_BRACKET_COMMAND{ "[" };
+	const std::string TEST_BRACKET_END{ "]" };
+	const std::string TRUE_COMMAND{ "true" };
+	const std::string FALSE_COMMAND{ "false" };
+	const std::string PWD_COMMAND{ "pwd" };
+	const std::string EXPORT_COMMAND{ "export" };
+	const std::string UNSET_COMMAND{ "unset" };
+	const std::string TIME_COMMAND{ "time" };
+	const std::string PUSH_DIRECTORY_COMMAND{ "pushd" };
+	const std::string POP_DIRECTORY_COMMAND{ "popd" };
+	const std::string DIRECTORIES_COMMAND{ "dirs" };
+	const std::string DIRECTORIES_CLEAR_OPTION{ "-c" };
+	const std::string JUMP_COMMAND{ "z" };
+	const std::string JUMP_LIST_OPTION{ "-l" };
+	const std::string PIN_COMMAND{ "pin" };
+	const std::string PIN_NODE_OPTION{ "--node" };
+	const std::string PIN_AUTO_OPTION{ "--auto" };
+	const std::string PIN_AUTO_CORES{ "cores" };
+	const std::string PIN_AUTO_NODES{ "nodes" };
+	const std::string PIN_AUTO_OFF{ "off" };
+	const std::string MEMO_COMMAND{ "memo" };
+	const std::string MEMO_INPUT_OPTION{ "-i" };
+	const std::string MEMO_VARIABLE_OPTION{ "-e" };
+	const std::string MEMO_CLEAR_OPTION{ "-c" };
+	const std::string WATCH_RUN_COMMAND{ "watch-run" };
+	const std::string WATCH_RUN_SEPARATOR{ "--" };
+	const std::string WATCH_RUN_EXCLUDE_OPTION{ "-x" };
+
+	// Environment
+	const std::string SPLICE_PIPES_VARIABLE{ "LESH_SPLICE_PIPES" };
+	const std::string HISTORY_FILE_VARIABLE{ "LESH_HISTORY_FILE" };
+	const std::string HISTORY_FILE_DEFAULT_NAME{ ".lesh_history" };
+	const std::string DIRECTORY_FILE_VARIABLE{ "LESH_DIRECTORY_FILE" };
+	const std::string DIRECTORY_FILE_DEFAULT_NAME{ ".lesh_directories" };
+	const std::string MEMO_DIRECTORY_VARIABLE{ "LESH_MEMO_DIRECTORY" };
+	const std::string MEMO_DIRECTORY_DEFAULT_NAME{ ".cache/lesh/memo" };
+	const std::string MEMO_LIMIT_VARIABLE{ "LESH_MEMO_LIMIT" };
+	const int MEMO_LIMIT_DEFAULT_MEBIBYTES{ 256 };
+	const std::string PROMPT_FORMAT_VARIABLE{ "LESH_PS1" };
+	const std::string PATH_VARIABLE{ "PATH" };
+
+	// Expansions: $NAME or ${NAME}, these parameters, and $(command)
+	const char LAST_EXIT_STATUS_PARAMETER{ '?' };
+	const char SHELL_PID_PARAMETER{ '$' };
+	const char ASSIGNMENT_CHAR{ '=' };
+
+	// Exit statuses
+	const int EXIT_STATUS_SYNTAX_ERROR{ 2 };
+	const int EXIT_STATUS_NOT_FOUND{ 127 };
+	const int EXIT_STATUS_MAX_FAILED_JOBS{ 101 };
 
 	// Prompt styles
 	const std::string& SHELL_STYLE{ Lex::ConsoleFormatting::BLUE_ON_DEFAULT_BOLD };
@@ -41,13 +148,34 @@ namespace Lesh
 	const std::string& DIRECTORY_STYLE{ Lex::ConsoleFormatting::BLUE_ON_DEFAULT_BOLD };
 	const std::string& PUNCUATION_STYLE{ Lex::ConsoleFormatting::DEFAULT };
 
+	// Prompt format escapes: \u user, \h host, \w working directory, \W its last part, \s shell name, 
+	// \$ # for root and $ otherwise, \e escape character (for colors), \n newline, \\ backslash. 
+	// Anything else is printed as-is.
+	const char PROMPT_ESCAPE_CHAR{ '\\' };
+	const std::string DEFAULT_PROMPT_FORMAT{ SHELL_STYLE + "\\s" + PUNCUATION_STYLE + '(' + USER_STYLE + "\\u" + 
+											 PUNCUATION_STYLE + "):" + DIRECTORY_STYLE + "\\w" + 
+											 PUNCUATION_STYLE + "$ " + Lex::ConsoleFormatting::DEFAULT };
+
+	// Per-line arena: the line's words, syntax tree and argv. Released before the next line is read, 
+	// so dispatching a command line needs no heap allocations once the arena's buffer is big enough.
+	std::byte lineArenaBuffer[64 * 1024];
+	std::pmr::monotonic_buffer_resource lineArena{ lineArenaBuffer, sizeof(lineArenaBuffer) };
+
+	// Where parsing puts words and syntax trees: the line arena, except while a script is parsed 
+	// up front into an arena that lasts as long as the script
+	std::pmr::memory_resource* syntaxArena{ &lineArena };
+
+	// Directory listings shared by all the glob patterns of one line, then dropped
+	Lex::Posix::DirectoryCache globDirectoryCache;
+
+	// Words view '\0'-terminated strings in the syntax arena
 	struct Command
 	{
-		std::string name;
-		std::vector<std::string> arguments;
-		//std::string inputFilename;
-		//std::string outputFilename;
-		//bool outputAppend;
+		std::string_view name;
+		Lex::WordLists::WordList arguments{ syntaxArena };
+		std::string_view inputFilename;
+		std::string_view outputFilename;
+		bool outputAppend{ false };
 
 		bool operator==(const Command& other) const
 		{
@@ -55,41 +183,461 @@ namespace Lesh
 				return false;
 			if(arguments != other.arguments)
 				return false;
+			if(inputFilename != other.inputFilename)
+				return false;
+			if(outputFilename != other.outputFilename || outputAppend != other.outputAppend)
+				return false;
 			return true;
 		}
+		bool HasRedirections() const
+		{
+			return !inputFilename.empty() || !outputFilename.empty();
+		}
+		void Print(std::ostream& os) const
+		{
+			Lex::WordLists::PrintWord(os, name, SPLIT_RULES);
+			if(!arguments.empty())
+			{
+				os << ' ';
+				Lex::WordLists::Print(os, arguments, SPLIT_RULES);
+			}
+			if(!inputFilename.empty())
+			{
+				os << ' ' << REDIRECT_INPUT_OPERATOR << ' ';
+				Lex::WordLists::PrintWord(os, inputFilename, SPLIT_RULES);
+			}
+			if(!outputFilename.empty())
+			{
+				os << ' ' << (outputAppend ? REDIRECT_OUTPUT_APPEND_OPERATOR : REDIRECT_OUTPUT_OPERATOR) << ' ';
+				Lex::WordLists::PrintWord(os, outputFilename, SPLIT_RULES);
+			}
+		}
+	};
+
+	// Commands connected stdout to stdin by the piping operator
+	struct Pipeline
+	{
+		std::pmr::vector<Command> commands{ syntaxArena };
+
+		bool operator==(const Pipeline& other) const
+		{
+			return commands == other.commands;
+		}
+		void Print(std::ostream& os) const
+		{
+			for(std::pmr::vector<Command>::size_type i = 0; i < commands.size(); ++i)
+			{
+				if(i > 0)
+					os << ' ' << PIPING_OPERATOR << ' ';
+				commands[i].Print(os);
+			}
+		}
+	};
+
+	// Pipelines joined by && and ||. Each connector decides from the previous exit status whether the next pipeline runs.
+	struct AndOrList
+	{
+		enum class Connector { And, Or };
+		std::pmr::vector<Pipeline> pipelines{ syntaxArena };
+		std::pmr::vector<Connector> connectors{ syntaxArena };	// connectors[i] joins pipelines[i] and pipelines[i + 1]
+		bool background{ false };
+
+		bool operator==(const AndOrList& other) const
+		{
+			return pipelines == other.pipelines && connectors == other.connectors && background == other.background;
+		}
+		bool IsSingleCommand(std::string_view name) const
+		{
+			return pipelines.size() == 1 && pipelines[0].commands.size() == 1 && pipelines[0].commands[0].name == name;
+		}
 		void Print(std::ostream& os) const
 		{
-			os << name << ' ';
-			Lex::WordLists::Print(os, arguments);
+			for(std::pmr::vector<Pipeline>::size_type i = 0; i < pipelines.size(); ++i)
+			{
+				if(i > 0)
+					os << ' ' << (connectors[i - 1] == Connector::And ? AND_OPERATOR : OR_OPERATOR) << ' ';
+				pipelines[i].Print(os);
+			}
+			if(background)
+				os << ' ' << BACKGROUND_OPERATOR;
 		}
 	};
 
+	// Syntax tree of one command-line: and-or lists separated by ; or &
+	using CommandList = std::pmr::vector<AndOrList>;
+
 	// Supports cdl command
 	std::string lastWorkingDirectory;
 
+	// pushd/popd/dirs, top of the stack at the back
+	std::vector<std::string> directoryStack;
+
+	// Visited directories ranked for z. Every visit appends a record (rank, time, path) to a file shared by 
+	// all sessions, and directoryEntries sums them, catching up from directoryFileScanOffset. When the file 
+	// holds many more records than directories, it is rewritten with one record per directory.
+	// z searches all the paths at once in foldedDirectoryPaths, then checks only the entries with hits.
+	struct DirectoryRank
+	{
+		double rank{ 0 };
+		std::int64_t lastVisit{ 0 };	// Seconds since the epoch
+	};
+	struct DirectoryEntry
+	{
+		std::string path;
+		DirectoryRank rank;
+		std::string::size_type foldedStart{ 0 };	// In foldedDirectoryPaths
+	};
+	const double DIRECTORY_RANK_MAX_TOTAL{ 10000 };	// Older ranks are scaled down past this
+	const std::size_t DIRECTORY_FILE_MIN_COMPACT_RECORDS{ 1024 };
+	std::vector<DirectoryEntry> directoryEntries;	// In foldedStart order
+	std::unordered_map<std::string, std::vector<DirectoryEntry>::size_type> directoryEntryIndex;	// By path
+	std::string foldedDirectoryPaths;				// Each entry's path in lowercase, then '\0'
+	double directoryRankTotal{ 0 };
+	Lex::Posix::AppendOnlyRecordFile directoryFile;
+	std::string directoryFilePath;
+	bool directoryFileOpened{ false };	// Opened or tried
+	Lex::Posix::AppendOnlyRecordFile::Offset directoryFileScanOffset{ 0 };
+	std::size_t directoryFileRecordCount{ 0 };
+
+	// Prompt format compiled into segments, and the prompt they render to. Only re-rendered after 
+	// the working directory or the environment changes.
+	struct PromptSegment
+	{
+		enum class Type { Text, User, Host, WorkingDirectory, WorkingDirectoryName };
+		Type type{ Type::Text };
+		std::string text;
+	};
+	std::vector<PromptSegment> promptSegments;
+	std::string promptFormat;
+	std::string promptText;
+	bool promptValid{ false };
+
 	// History
-	using CommandListIndex = std::list<Command>::size_type;
+	using CommandListIndex = Lex::Lists::UniqueStringRing::size_type;
 	CommandListIndex HISTORY_MAX_SIZE{ 1000 };
 	CommandListIndex HISTORY_DEFAULT_DISPLAY_SIZE{ 10 };
-	std::list<Command> commandHistory;
-	std::list<Command> executedCommands;
+	Lex::Lists::UniqueStringRing commandHistory{ HISTORY_MAX_SIZE };
+	std::vector<std::string> executedCommands;
+
+	// History file shared by all sessions. Its unique entries, newest first, are found lazily 
+	// by walking records back from the end of the mapping, down to historyFileScanOffset so far.
+	Lex::Posix::AppendOnlyRecordFile historyFile;
+	std::vector<std::string_view> historyFileEntries;
+	std::unordered_set<std::string_view> historyFileEntrySet;
+	Lex::Posix::AppendOnlyRecordFile::Offset historyFileScanOffset{ 0 };
+
+	// Ctrl-R searches every record of the history file through a trigram index. Record ids count up from 
+	// the oldest; the index catches up with records appended since the last search when a search starts.
+	Lex::Lists::TrigramIndex historySearchIndex;
+	std::vector<Lex::Posix::AppendOnlyRecordFile::Offset> historySearchRecordEnds;	// By id
+
+	// $?
+	int lastExitStatus{ 0 };
+
+	// Set by exit or quit, which end the and-or list and the shell with it
+	bool exitRequested{ false };
+
+	// Shell variables, starting with the environment. Children get the exported ones.
+	Lex::Posix::Environment shellVariables{ environ };
+
+	// $(command) output, reused so its capacity carries over from one substitution to the next
+	std::string substitutionOutput;
+
+	// Prompt and history are only used when reading commands from the terminal
+	bool interactive{ true };
+
+	// True in children the shell forks ($(...) subshells, builtin pipeline stages), which must leave 
+	// the user's files and the shell's threads to the shell itself
+	bool inForkedChild{ false };
+	const bool forkHandlerRegistered{ pthread_atfork(nullptr, nullptr, []() { inForkedChild = true; }) == 0 };
+
+	// Background jobs, each reaped when its pidfds become readable
+	struct Job
+	{
+		int id{ 0 };
+		std::string text;
+		std::vector<pid_t> childPids;
+		std::vector<int> childPidFds;	// -1 once reaped, or if pidfd_open is unsupported
+		std::vector<bool> childReaped;
+		int lastStatus{ 0 };
+
+		bool IsDone() const
+		{
+			return std::find(childReaped.begin(), childReaped.end(), false) == childReaped.end();
+		}
+	};
+	std::list<Job> jobTable;
+
+	// Foreground child started by the shell, and when its spawn began and returned (for --profile)
+	struct ChildProcess
+	{
+		pid_t pid{ -1 };
+		std::string_view name;
+		Lex::Stats::Nanoseconds spawnStart{ 0 };
+		Lex::Stats::Nanoseconds spawnEnd{ 0 };
+	};
+
+	// Usage of every foreground child waited for so far, for the time builtin
+	struct ChildUsage
+	{
+		Lex::Stats::Nanoseconds user{ 0 };
+		Lex::Stats::Nanoseconds system{ 0 };
+		long maxResidentKilobytes{ 0 };		// Largest child since the time builtin last reset it
+	};
+	ChildUsage childUsage;
+
+	// --profile: where each command line's time went, reported when lesh exits. 
+	// Dispatch is the shell's own time: a line's execution minus the time spent in its commands.
+	enum class ProfileFormat { None, Text, Json };
+	ProfileFormat profileFormat{ ProfileFormat::None };
+	struct CommandProfile
+	{
+		Lex::Stats::Histogram wall;
+		Lex::Stats::Histogram spawn;			// Start of spawn to exec (external commands only)
+		Lex::Stats::Nanoseconds user{ 0 };
+		Lex::Stats::Nanoseconds system{ 0 };
+		long maxResidentKilobytes{ 0 };
+	};
+	std::map<std::string, CommandProfile, std::less<>> commandProfiles;
+	Lex::Stats::Histogram parseTimes;
+	Lex::Stats::Histogram dispatchTimes;
+	Lex::Stats::Histogram spawnTimes;
+	Lex::Stats::Histogram runTimes;				// Exec to reaped
+	Lex::Stats::Nanoseconds commandTime{ 0 };	// Spent in commands so far, builtin or waited for
+
+	// Tab completion. Command names in $PATH are kept in a trie by a background thread that watches the 
+	// directories with inotify, so a completion is a trie lookup under a lock that is only ever held briefly.
+	const std::size_t COMPLETION_MAX_COUNT{ 256 };
+	std::mutex pathCommandsMutex;
+	Lex::Lists::PrefixTrie pathCommands;		// Guarded by pathCommandsMutex
+	std::string pathCommandsSearchPath;			// Guarded: $PATH to watch
+	bool pathCommandsStop{ false };				// Guarded
+	int pathCommandsWakeFd{ -1 };				// eventfd: $PATH changed, or stop
+	std::thread pathCommandsThread;
+	Lex::Lists::PrefixTrie historyLines;		// Main thread only
+
+	// pin --auto: background and parallel jobs take these placements in turn, one per core or per NUMA node
+	enum class AutoPlacement { Off, Cores, Nodes };
+	AutoPlacement autoPlacement{ AutoPlacement::Off };
+	std::vector<Lex::Posix::Placement> autoPlacements;
+	std::vector<Lex::Posix::Placement>::size_type nextAutoPlacement{ 0 };
+
+	// memo: results of commands kept on disk. An entry, named by the fingerprint of a command and its inputs, holds 
+	// the exit status and the names of two objects, each named by the fingerprint of its contents: stdout and stderr.
+	const std::string MEMO_KEY_VERSION{ "lesh-memo-1" };
+	const std::string MEMO_ENTRIES_DIRECTORY{ "entries" };
+	const std::string MEMO_OBJECTS_DIRECTORY{ "objects" };
+	const std::string MEMO_EMPTY_OBJECT{ "-" };
+	const std::string MEMO_SIZE_FILE{ "size" };	// Bytes of all objects, so a store needn't scan the cache
+	struct MemoEntry
+	{
+		int exitStatus{ 0 };
+		Lex::Stats::Nanoseconds runTime{ 0 };	// When it ran, so a hit knows the time it saved
+		std::string stdoutObject;
+		std::string stderrObject;
+	};
+	struct MemoCacheEntry
+	{
+		std::string name;
+		MemoEntry entry;
+		timespec lastUsed{};	// Modification time, set again on every hit
+	};
+	struct MemoCacheObject
+	{
+		std::uint64_t size{ 0 };
+		unsigned long references{ 0 };
+	};
+	struct MemoStats	// This session's
+	{
+		unsigned long hits{ 0 };
+		unsigned long misses{ 0 };
+		unsigned long uncached{ 0 };	// Builtins, stdin from a pipe, or no cache directory
+		Lex::Stats::Nanoseconds saved{ 0 };
+	};
+	MemoStats memoStats;
+
+	// watch-run: directories watched with inotify, each for every name in it or only some (a watched file's directory)
+	const std::uint32_t WATCH_RUN_EVENTS{ IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | 
+										  IN_DELETE_SELF | IN_ONLYDIR };
+	const std::size_t WATCH_RUN_MAX_WATCHES{ 8192 };
+	const int WATCH_RUN_DEBOUNCE_MILLISECONDS{ 50 };	// Changes quiet this long start a run
+	const int WATCH_RUN_STOP_MILLISECONDS{ 1000 };		// A stopped run is killed if still going after this
+	const int WATCH_RUN_REAP_POLL_MILLISECONDS{ 100 };	// Without pidfd_open
+	struct WatchedDirectory
+	{
+		std::string path;
+		std::unordered_set<std::string> names;	// Only these, unless recursive
+		bool recursive{ false };
+	};
+	struct WatchRunState
+	{
+		int inotifyFd{ -1 };
+		std::unordered_map<int, WatchedDirectory> directories;
+		std::vector<std::string_view> excludes;
+		bool capReported{ false };
+	};
+	volatile sig_atomic_t watchRunInterrupted{ 0 };
+
+	// Opt-in: cat/tee stages in the middle of a pipeline move data with splice/tee instead of running the apps
+	bool spliceMiddleStages{ false };
+
+	// Command hash table: command name -> absolute path, valid for commandHashTableSearchPath
+	struct HashedCommand
+	{
+		std::string path;
+		unsigned long hits{ 0 };
+	};
+	std::unordered_map<std::string, HashedCommand> commandHashTable;
+	std::string commandHashTableSearchPath;
+	unsigned long commandHashTableHits{ 0 };
+	unsigned long commandHashTableMisses{ 0 };
+
+	// Recursive-descent parser for test and [ expressions: or := and {-o and}, and := not {-a not}, 
+	// not := ! not | primary, primary := ( or ) | binary | unary | string
+	struct TestExpression
+	{
+		const Lex::WordLists::WordList& words;
+		Lex::WordLists::WordList::size_type end;
+		Lex::WordLists::WordList::size_type position{ 0 };
+		std::string error;
+
+		TestExpression(const Lex::WordLists::WordList& wordsIn, Lex::WordLists::WordList::size_type endIn)
+			: words{ wordsIn }, end{ endIn }
+		{}
+		bool ParseOr();
+		bool ParseAnd();
+		bool ParseNot();
+		bool ParsePrimary();
+		bool ToTestNumber(std::string_view word, long long& numberOut);
+	};
+
+	//+------------------------\----------------------------------
+	//|			 Main		   |
+	//\------------------------/----------------------------------
+	int RunLesh();
+	int RunScript(const std::string& scriptText, const std::string& scriptName);
+	bool ParseLine(std::string_view inputLine, bool expandGlobs, CommandList& commandListOut, bool* unexpandedGlobsOut = nullptr);
+	bool ExecuteCommandList(const CommandList& commandList, int& exitStatusOut);
 
 	//+------------------------\----------------------------------
 	//|		   Execute		   |
 	//\------------------------/----------------------------------
-	void ExecuteCommand(const Command& command);
+	int ExecuteAndOrList(const AndOrList& andOrList);
+	int EvaluateAndOrList(const AndOrList& andOrList);
+	int ExecutePipeline(const Pipeline& pipeline);
+	int ExecuteCommand(const Command& command);
+	int ExecuteExternalCommand(const Command& command);
+	bool SpawnExternalCommand(const Command& command, const Lex::Posix::SpawnFileActionList& fileActions, ChildProcess& childOut);
+	bool IsBuiltinCommand(const Command& command);
+	std::string ErrorPrefix(std::string_view name);
+	void ReportSignal(int waitStatus);
+
+	//+------------------------\----------------------------------
+	//|		   Pipeline		   |
+	//\------------------------/----------------------------------
+	int ExecutePipelineStages(const Pipeline& pipeline);
+	bool SpawnPipelineStages(const Pipeline& pipeline, std::pmr::vector<ChildProcess>& childrenOut);
+	bool SpawnPipelineStage(const Command& command, bool isMiddleStage, const Lex::Posix::SpawnFileActionList& fileActions, ChildProcess& childOut);
+	bool ForkPipelineStage(const Command& command, bool isMiddleStage, const Lex::Posix::SpawnFileActionList& fileActions, pid_t& childPidOut, const std::string& perrorMessage);
+	bool IsSpliceableStage(const Command& command);
+
+	//+------------------------\----------------------------------
+	//|			 Jobs		   |
+	//\------------------------/----------------------------------
+	void StartBackgroundJob(const AndOrList& andOrList);
+	void ReapJobs(int timeoutMilliseconds);
+	void WaitForJob(const Job& job);
+	Job* FindJob(const Lex::WordLists::WordList& arguments, std::string_view commandName);
+	void ReportFinishedJobs();
+	void PrintJobs();
+	void RemoveJob(const Job& job);
+
+	//+------------------------\----------------------------------
+	//|		   Parallel		   |
+	//\------------------------/----------------------------------
+	int ExecuteParallel(const Command& command);
+
+	//+------------------------\----------------------------------
+	//|		   Builtins		   |
+	//\------------------------/----------------------------------
+	int ExecuteHistory(const Command& command);
+	int ExecuteRecallHistory(const Command& command);
+	int ExecuteChangeDirectory(const Command& command);
+	int ExecuteChangeToLastDirectory(const Command& command);
+	int ExecuteHash(const Command& command);
+	int ExecuteJobs(const Command& command);
+	int ExecuteWait(const Command& command);
+	int ExecuteForeground(const Command& command);
+	int ExecuteEcho(const Command& command);
+	int ExecutePrintf(const Command& command);
+	bool AppendEscapedText(std::string_view text, bool octalNeedsZero, std::string& output);
+	int ExecuteTest(const Command& command);
+	int ExecuteQuit(const Command& command);
+	int ExecuteTrue(const Command& command);
+	int ExecuteFalse(const Command& command);
+	int ExecutePwd(const Command& command);
+	int ExecuteCat(const Command& command);
+	int ExecuteExport(const Command& command);
+	int ExecuteUnset(const Command& command);
+	int ExecuteTime(const Command& command);
+	int ExecutePushDirectory(const Command& command);
+	int ExecutePopDirectory(const Command& command);
+	int ExecuteDirectories(const Command& command);
+	int ExecuteJump(const Command& command);
+
+	//+------------------------\----------------------------------
+	//|		  Redirection	   |
+	//\------------------------/----------------------------------
+	bool OpenRedirections(const Command& command, Lex::Posix::SpawnFileActionList& fileActionsOut, std::pmr::vector<int>& openedFdsOut);
+	int ExecuteBuiltinWithRedirections(const Command& command);
+	void CloseFds(std::pmr::vector<int>& fds);
+
+	//+------------------------\----------------------------------
+	//|	  Command Hash Table   |
+	//\------------------------/----------------------------------
+	HashedCommand* FindHashedCommand(std::string_view name, bool& wasHitOut);
+	void ForgetHashedCommand(std::string_view name);
+	void ValidateCommandHashTable();
+	void PrintCommandHashTable();
 
 	//+------------------------\----------------------------------
 	//|		    Parse		   |
 	//\------------------------/----------------------------------
-	void SeparateIntoCommands(const std::vector<std::string>& wordList, std::vector<Command>& commandListOut);
-	bool StringToCommandListIndex(const std::string& str, CommandListIndex& out);
+	void ExpandGlobs(Lex::WordLists::WordVector& wordList);
+	bool IsGlobWord(const Lex::WordLists::WordVector& wordList, Lex::WordLists::WordVector::size_type index);
+	bool SeparateIntoCommands(const Lex::WordLists::WordVector& wordList, CommandList& commandListOut);
+	bool StringToCommandListIndex(std::string_view str, CommandListIndex& out);
+
+	//+------------------------\----------------------------------
+	//|		   Variables	   |
+	//\------------------------/----------------------------------
+	bool ExpandParameters(const Pipeline& pipeline, Pipeline& expandedOut);
+	bool HasExpansions(std::string_view word);
+	void ExpandWord(std::string_view word, bool splitFields, Lex::WordLists::WordList& fieldsOut);
+	std::string_view::size_type ExpandParameter(std::string_view word, std::string_view::size_type start, std::string& valueOut);
+	bool SubstituteCommand(const std::string& commandText, std::string& outputOut);
+	bool IsAssignment(std::string_view word);
+	int ExecuteAssignments(const Command& command);
+	void OnVariableChanged(std::string_view name);
 
 	//+------------------------\----------------------------------
 	//|		   Directory	   |
 	//\------------------------/----------------------------------
-	void ChangeDirectory(const std::string& path);
+	bool ChangeDirectory(const std::string& path);
 	void ExpandDirectory(std::string& path);
+	void PrintDirectoryStack();
+	void OpenDirectoryFile();
+	void RecordDirectoryVisit();
+	void UpdateDirectoryRanks();
+	void AddDirectoryRank(std::string_view path, const DirectoryRank& rank);
+	void ClearDirectoryRanks();
+	void FindDirectories(const std::vector<std::string>& foldedTerms, std::vector<const DirectoryEntry*>& entriesOut);
+	void CompactDirectoryFile();
+	std::string EncodeDirectoryRecord(std::string_view path, const DirectoryRank& rank);
+	bool DecodeDirectoryRecord(std::string_view record, std::string_view& pathOut, DirectoryRank& rankOut);
+	double GetFrecency(const DirectoryRank& rank, std::int64_t now);
+	bool MatchesDirectory(std::string_view foldedPath, const std::vector<std::string>& foldedTerms);
+	std::string FoldCase(std::string_view text);
 
 	//+------------------------\----------------------------------
 	//|		    Print		   |
@@ -97,6 +645,128 @@ namespace Lesh
 	void PrintPrompt();
 	void PrintHistory(CommandListIndex numCommands);
 
+	//+------------------------\----------------------------------
+	//|		    Prompt		   |
+	//\------------------------/----------------------------------
+	void InvalidatePrompt();
+	void CompilePromptFormat(const std::string& format);
+	void RenderPrompt();
+
+	//+------------------------\----------------------------------
+	//|		    History		   |
+	//\------------------------/----------------------------------
+	void OpenHistoryFile();
+	void RecordHistory(const std::string& text);
+	void GetHistoryEntries(CommandListIndex count, std::vector<std::string_view>& entriesOut);
+	void RefreshHistoryFile();
+	void UpdateHistorySearchIndex();
+	bool SearchHistory(std::string_view query, std::size_t before, std::size_t& positionOut, std::string& entryOut);
+
+	//+------------------------\----------------------------------
+	//|		  Completion	   |
+	//\------------------------/----------------------------------
+	void StartPathCommandsThread();
+	void StopPathCommandsThread();
+	void NotifyPathChanged();
+	void WatchPathCommands();
+	void ProcessPathEvents(int inotifyFd, std::unordered_map<int, std::pair<std::string, std::unordered_set<std::string>>>& directories);
+	void ScanPathDirectory(const std::string& directory, std::unordered_set<std::string>& namesOut);
+	bool IsExecutableFile(const std::string& path);
+	void CompleteWord(std::string_view line, std::size_t cursor, std::size_t& wordStartOut, std::vector<std::string>& completionsOut);
+	void CompletePath(std::string_view word, bool executablesOnly, std::vector<std::string>& completionsOut);
+	bool GetHistoryEntry(std::size_t index, std::string& entryOut);
+
+	//+------------------------\----------------------------------
+	//|		   Placement	   |
+	//\------------------------/----------------------------------
+	int ExecutePin(const Command& command);
+	bool IsPinPrefix(const Command& command);
+	bool SplitPinPrefix(const Command& pinCommand, Lex::Posix::Placement& placementOut, Command& commandOut);
+	int ExecutePinnedPipeline(const Pipeline& pipeline);
+	bool SetAutoPlacement(std::string_view mode);
+	const Lex::Posix::Placement* NextAutoPlacement();
+
+	//+------------------------\----------------------------------
+	//|		     Memo		   |
+	//\------------------------/----------------------------------
+	int ExecuteMemo(const Command& command);
+	bool SplitMemoPrefix(const Command& memoCommand, std::vector<std::string_view>& inputFilesOut, 
+						 std::vector<std::string_view>& variablesOut, Command& commandOut);
+	bool GetMemoDirectory(std::string& directoryOut);
+	bool GetMemoKey(const Command& command, const std::vector<std::string_view>& inputFiles, 
+					const std::vector<std::string_view>& variables, std::string& keyOut);
+	bool ReadMemoEntry(const std::string& path, MemoEntry& entryOut);
+	bool ReplayMemoEntry(const std::string& directory, const MemoEntry& entry);
+	int RunAndMemoize(const Command& command, const std::string& directory, const std::string& entryPath);
+	bool StoreMemoObject(const std::string& directory, int fd, std::string& objectOut, std::uint64_t& storedBytesOut);
+	std::uint64_t AddMemoSize(const std::string& directory, std::uint64_t bytes);
+	void SetMemoSize(const std::string& directory, std::uint64_t totalSize);
+	int OpenMemoSizeFile(const std::string& directory, bool& createdOut);
+	void WriteMemoSize(int fd, std::uint64_t totalSize);
+	bool WriteMemoFile(const std::string& path, std::string_view contents);
+	std::uint64_t GetMemoLimit();
+	std::uint64_t ScanMemoCache(const std::string& directory, std::vector<MemoCacheEntry>& entriesOut, 
+								std::unordered_map<std::string, MemoCacheObject>& objectsOut);
+	void EvictMemoEntries(const std::string& directory, std::uint64_t limit);
+	void PrintMemoStats(const std::string& directory);
+
+	//+------------------------\----------------------------------
+	//|		    Watch		   |
+	//\------------------------/----------------------------------
+	int ExecuteWatchRun(const Command& command);
+	void OnWatchRunInterrupt(int);
+	bool AddWatches(WatchRunState& state, const std::string& path);
+	bool IsWatchCapReached(WatchRunState& state);
+	bool WatchDirectoryTree(WatchRunState& state, const std::string& directory);
+	bool IsWatchRunExcluded(const WatchRunState& state, std::string_view name);
+	bool ReadWatchEvents(WatchRunState& state, std::string& changedPathOut);
+	bool StartWatchRun(const Command& command, pid_t& runPidOut, int& runFdOut);
+	int StopWatchRun(pid_t runPid, int runFd, int signalNumber);
+
+	//+------------------------\----------------------------------
+	//|		    Profile		   |
+	//\------------------------/----------------------------------
+	bool WaitForForegroundChild(const ChildProcess& child, int& statusOut, const std::string& perrorMessage);
+	int ExecuteTimedPipeline(const Pipeline& pipeline);
+	void RecordBuiltinProfile(std::string_view name, Lex::Stats::Nanoseconds start, Lex::Stats::Nanoseconds commandTimeBefore, const rusage& selfUsageBefore);
+	void PrintProfile(std::ostream& os);
+	void PrintProfileJson(std::ostream& os);
+	std::string FormatDuration(Lex::Stats::Nanoseconds duration);
+
+	// Builtin commands run inside the shell without forking: name -> handler
+	using BuiltinHandler = int (*)(const Command& command);
+	const std::unordered_map<std::string_view, BuiltinHandler> BUILTIN_COMMANDS{
+		{ DISPLAY_HISTORY_COMMAND, ExecuteHistory },
+		{ EXECUTE_HISTORY_COMMAND, ExecuteRecallHistory },
+		{ CHANGE_DIRECTORY_COMMAND, ExecuteChangeDirectory },
+		{ CHANGE_TO_LAST_DIRECTORY_COMMAND, ExecuteChangeToLastDirectory },
+		{ HASH_COMMAND, ExecuteHash },
+		{ JOBS_COMMAND, ExecuteJobs },
+		{ WAIT_COMMAND, ExecuteWait },
+		{ FOREGROUND_COMMAND, ExecuteForeground },
+		{ PARALLEL_COMMAND, ExecuteParallel },
+		{ ECHO_COMMAND, ExecuteEcho },
+		{ PRINTF_COMMAND, ExecutePrintf },
+		{ TEST_COMMAND, ExecuteTest },
+		{ TEST_BRACKET_COMMAND, ExecuteTest },
+		{ QUIT_COMMAND_1, ExecuteQuit },
+		{ QUIT_COMMAND_2, ExecuteQuit },
+		{ TRUE_COMMAND, ExecuteTrue },
+		{ FALSE_COMMAND, ExecuteFalse },
+		{ PWD_COMMAND, ExecutePwd },
+		{ CAT_COMMAND, ExecuteCat },
+		{ EXPORT_COMMAND, ExecuteExport },
+		{ UNSET_COMMAND, ExecuteUnset },
+		{ TIME_COMMAND, ExecuteTime },
+		{ PUSH_DIRECTORY_COMMAND, ExecutePushDirectory },
+		{ POP_DIRECTORY_COMMAND, ExecutePopDirectory },
+		{ DIRECTORIES_COMMAND, ExecuteDirectories },
+		{ JUMP_COMMAND, ExecuteJump },
+		{ PIN_COMMAND, ExecutePin },
+		{ MEMO_COMMAND, ExecuteMemo },
+		{ WATCH_RUN_COMMAND, ExecuteWatchRun }
+	};
+
 	//+------------------------\----------------------------------
 	//|			 Main		   |
 	//\------------------------/----------------------------------
@@ -104,39 +774,77 @@ namespace Lesh
 	{
 		try
 		{
+			OpenHistoryFile();
+
+			// Lines typed on a terminal are edited in raw mode, with completion
+			std::optional<Lex::Console::LineEditor> lineEditor;
+			if(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+			{
+				lineEditor.emplace(STDIN_FILENO, STDOUT_FILENO, CompleteWord, GetHistoryEntry, SearchHistory);
+				std::vector<std::string_view> entries;
+				GetHistoryEntries(HISTORY_MAX_SIZE, entries);
+				for(std::string_view entry : entries)
+					historyLines.Insert(entry);
+				StartPathCommandsThread();
+			}
+
+			// Other input is read in large blocks. Input that isn't a terminal is a batch of commands: 
+			// no prompts and no history.
+			std::optional<Lex::Posix::LineReader> lineReader;
+			if(!lineEditor)
+			{
+				lineReader.emplace(STDIN_FILENO);
+				interactive = isatty(STDIN_FILENO);
+			}
+
+			std::string editedLine;	// Keeps its capacity from line to line
 			while(true)
 			{
-				PrintPrompt();
+				ReapJobs(0);
+				ReportFinishedJobs();
 
-				// Get list of commands from command-line
-				std::vector<Command> commands;
+				// Get syntax tree from command-line. Everything from the last line is gone by now.
+				lineArena.release();
+				CommandList commandList{ &lineArena };
+				std::string_view inputLine;
+				if(!lineEditor)
 				{
-					std::vector<std::string> wordList;
+					if(interactive)
+						PrintPrompt();
+					if(!lineReader->ReadLine(inputLine))
 					{
-						std::string inputLine;
-						getline(std::cin, inputLine);
-						Lex::WordLists::Separate(inputLine, WHITESPACE_CHARS, wordList);
+						if(errno != 0)
+							perror(ErrorPrefix("stdin").c_str());
+						return lastExitStatus;
 					}
-					SeparateIntoCommands(wordList, commands);
 				}
-
-				// Execute list of commands
-				for(Command cmd : commands)
+				else
 				{
-					if(cmd.name == QUIT_COMMAND_1 || cmd.name == QUIT_COMMAND_2)
-						return 0;
-
-					ExecuteCommand(cmd);
+					if(!promptValid)
+						RenderPrompt();
+					std::cout.flush();
+					if(!lineEditor->ReadLine(promptText, editedLine))
+						return lastExitStatus;
+					inputLine = editedLine;
+				}
+				Lex::Stats::Nanoseconds parseStart{ profileFormat != ProfileFormat::None ? Lex::Stats::Now() : 0 };
+				if(!ParseLine(inputLine, true, commandList))
+				{
+					lastExitStatus = EXIT_STATUS_SYNTAX_ERROR;
+					continue;
 				}
+				if(profileFormat != ProfileFormat::None)
+					parseTimes.Add(Lex::Stats::Now() - parseStart);
+
+				// Execute and-or lists in order
+				int exitStatus;
+				if(!ExecuteCommandList(commandList, exitStatus))
+					return exitStatus;
 
 				// Record executed commands in history, oldest to most recent
-				for(auto sourceIter{ executedCommands.rbegin() }; sourceIter != executedCommands.rend(); ++sourceIter)
-					Lex::Lists::AddUniqueElementToFront(*sourceIter, commandHistory);
+				for(const std::string& executedCommand : executedCommands)
+					RecordHistory(executedCommand);
 				executedCommands.clear();
-
-				// Trim history
-				while(commandHistory.size() > HISTORY_MAX_SIZE)
-					commandHistory.pop_back();
 			}
 		}
 		catch(const std::exception & e)
@@ -146,246 +854,4022 @@ namespace Lesh
 		}
 		return EXIT_SUCCESS;
 	}
-
-	//+------------------------\----------------------------------
-	//|		   Execute		   |
-	//\------------------------/----------------------------------
-	void ExecuteCommand(const Command& command)
+	int RunScript(const std::string& scriptText, const std::string& scriptName)
 	{
-		if(command.name.empty())
-			return;
-
-		if(command.name == DISPLAY_HISTORY_COMMAND)
+		interactive = false;
+		try
 		{
-			CommandListIndex numCommands{ HISTORY_DEFAULT_DISPLAY_SIZE };
-			if(command.arguments.size() > 1)
+			// Parse the whole script once, into an arena of its own, before executing any of it. Lines with 
+			// unquoted globs are parsed again just before they execute, so they see files made by the lines 
+			// before them.
+			std::pmr::monotonic_buffer_resource scriptArena;
+			std::vector<CommandList> script;
+			std::vector<std::string> globLines;	// By script line, empty if it has no globs
 			{
-				std::cerr << SHELL_NAME << ": " << DISPLAY_HISTORY_COMMAND << ": too many parameters" << std::endl;
-				return;
+				struct SyntaxArenaScope
+				{
+					std::pmr::memory_resource* savedArena{ syntaxArena };
+					~SyntaxArenaScope()
+					{
+						syntaxArena = savedArena;
+					}
+				} syntaxArenaScope;
+				syntaxArena = &scriptArena;
+
+				std::string::size_type lineNumber{ 0 };
+				std::string inputLine;
+				for(std::string::size_type lineStart = 0; lineStart < scriptText.size(); ++lineNumber)
+				{
+					std::string::size_type lineEnd{ scriptText.find('\n', lineStart) };
+					if(lineEnd == std::string::npos)
+						lineEnd = scriptText.size();
+					inputLine.assign(scriptText, lineStart, lineEnd - lineStart);
+					lineStart = lineEnd + 1;
+
+					// Skip comment lines, including #! on the first line
+					std::string::size_type firstChar{ inputLine.find_first_not_of(WHITESPACE_CHARS) };
+					if(firstChar == std::string::npos || inputLine[firstChar] == COMMENT_CHAR)
+						continue;
+
+					script.emplace_back(&scriptArena);
+					bool hasGlobs;
+					Lex::Stats::Nanoseconds parseStart{ profileFormat != ProfileFormat::None ? Lex::Stats::Now() : 0 };
+					if(!ParseLine(inputLine, false, script.back(), &hasGlobs))
+					{
+						std::cerr << SHELL_NAME << ": " << scriptName << ": line " << lineNumber + 1 << ": nothing executed" << std::endl;
+						return EXIT_STATUS_SYNTAX_ERROR;
+					}
+					globLines.emplace_back(hasGlobs ? inputLine : std::string{});
+					if(profileFormat != ProfileFormat::None)
+						parseTimes.Add(Lex::Stats::Now() - parseStart);
+				}
 			}
-			else if(command.arguments.size() == 1)
+
+			// Execute parsed lines in order. What a line uses while it runs is in the line arena, released after it.
+			for(std::vector<CommandList>::size_type lineIndex = 0; lineIndex < script.size(); ++lineIndex)
 			{
-				if(!StringToCommandListIndex(command.arguments[0], numCommands))
+				lineArena.release();
+				CommandList globbedCommandList{ &lineArena };
+				const CommandList* commandListPtr{ &script[lineIndex] };
+				if(!globLines[lineIndex].empty())
 				{
-					std::cerr << SHELL_NAME << ": " << DISPLAY_HISTORY_COMMAND << ": invalid parameter" << std::endl;
-					return;
+					Lex::Stats::Nanoseconds parseStart{ profileFormat != ProfileFormat::None ? Lex::Stats::Now() : 0 };
+					ParseLine(globLines[lineIndex], true, globbedCommandList);
+					commandListPtr = &globbedCommandList;
+					if(profileFormat != ProfileFormat::None)
+						parseTimes.Add(Lex::Stats::Now() - parseStart);
 				}
+				int exitStatus;
+				if(!ExecuteCommandList(*commandListPtr, exitStatus))
+					return exitStatus;
+				ReapJobs(0);
+			}
+		}
+		catch(const std::exception & e)
+		{
+			std::cerr << SHELL_NAME << ": Fatal Exception: " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return lastExitStatus;
+	}
+	bool ParseLine(std::string_view inputLine, bool expandGlobs, CommandList& commandListOut, bool* unexpandedGlobsOut)
+	{
+		// Words are copied without quotes and escapes into the syntax arena
+		char* wordBuffer{ static_cast<char*>(syntaxArena->allocate(2 * inputLine.size() + 1, 1)) };
+		Lex::WordLists::WordVector wordList{ syntaxArena };
+		if(!Lex::WordLists::Split(inputLine, wordBuffer, SPLIT_RULES, wordList))
+		{
+			std::cerr << SHELL_NAME << ": syntax error: unterminated quote" << std::endl;
+			return false;
+		}
+		if(expandGlobs)
+			ExpandGlobs(wordList);
+		else if(unexpandedGlobsOut)
+		{
+			*unexpandedGlobsOut = false;
+			for(Lex::WordLists::WordVector::size_type i = 0; i < wordList.size() && !*unexpandedGlobsOut; ++i)
+				*unexpandedGlobsOut = IsGlobWord(wordList, i);
+		}
+		return SeparateIntoCommands(wordList, commandListOut);
+	}
+	bool ExecuteCommandList(const CommandList& commandList, int& exitStatusOut)
+	{
+		// Dispatch time is whatever the commands did not use
+		struct DispatchTimer
+		{
+			Lex::Stats::Nanoseconds start{ Lex::Stats::Now() };
+			Lex::Stats::Nanoseconds commandTimeBefore{ commandTime };
+			~DispatchTimer()
+			{
+				dispatchTimes.Add(Lex::Stats::Now() - start - (commandTime - commandTimeBefore));
+			}
+		};
+		std::optional<DispatchTimer> dispatchTimer;
+		if(profileFormat != ProfileFormat::None)
+			dispatchTimer.emplace();
+
+		for(const AndOrList& andOrList : commandList)
+		{
+			lastExitStatus = ExecuteAndOrList(andOrList);
+			if(exitRequested)
+			{
+				exitStatusOut = lastExitStatus;
+				return false;
 			}
-			PrintHistory(numCommands);
-			return;
 		}
+		exitStatusOut = lastExitStatus;
+		return true;
+	}
+
+	//+------------------------\----------------------------------
+	//|		   Execute		   |
+	//\------------------------/----------------------------------
+	int ExecuteAndOrList(const AndOrList& andOrList)
+	{
+		if(andOrList.pipelines.empty())
+			return EXIT_SUCCESS;
 
-		// Point commandToExecutePtr to either input or entry in history
-		const Command* commandToExecutePtr{ &command };
-		if(commandToExecutePtr->name == EXECUTE_HISTORY_COMMAND)
+		// And-or list from history is parsed and executed in place of a lone ! command
+		const AndOrList* listToExecutePtr{ &andOrList };
+		CommandList recalledCommandList{ &lineArena };
+		std::string recalledText;
+		if(andOrList.IsSingleCommand(EXECUTE_HISTORY_COMMAND))
 		{
-			if(commandToExecutePtr->arguments.size() > 1)
+			const Command& historyCommand{ andOrList.pipelines[0].commands[0] };
+			if(historyCommand.arguments.size() > 1)
 			{
 				std::cerr << SHELL_NAME << ": " << EXECUTE_HISTORY_COMMAND << ": too many parameters" << std::endl;
-				return;
+				return EXIT_FAILURE;
 			}
-			else if(commandToExecutePtr->arguments.empty())
+			else if(historyCommand.arguments.empty())
 			{
 				std::cerr << SHELL_NAME << ": " << EXECUTE_HISTORY_COMMAND << ": missing parameter" << std::endl;
-				return;
+				return EXIT_FAILURE;
 			}
 			else
 			{
 				// Convert parameter string to CommandListIndex
 				CommandListIndex input{ 0 };
-				bool succeeded = (StringToCommandListIndex(commandToExecutePtr->arguments[0], input) && input > 0);
+				bool succeeded = (StringToCommandListIndex(historyCommand.arguments[0], input) && input > 0);
 
-				// Get list element
+				// Get history entry
+				std::vector<std::string_view> entries;
 				if(succeeded)
 				{
-					commandToExecutePtr = Lex::Lists::GetElementPtr(commandHistory, input - 1);
-					if(!commandToExecutePtr)
+					GetHistoryEntries(input, entries);
+					if(entries.size() < input)
 						succeeded = false;
 				}
 				if(!succeeded)
 				{
+					GetHistoryEntries(HISTORY_MAX_SIZE, entries);
 					std::cerr << SHELL_NAME << ": " << EXECUTE_HISTORY_COMMAND 
-							  << ": invalid parameter (min=" << (commandHistory.empty() ? '0' : '1') 
-							  << " max=" << commandHistory.size() << ')' << std::endl;
-					return;
+							  << ": invalid parameter (min=" << (entries.empty() ? '0' : '1') 
+							  << " max=" << entries.size() << ')' << std::endl;
+					return EXIT_FAILURE;
 				}
+				recalledText = entries[input - 1];
+				if(!ParseLine(recalledText, true, recalledCommandList) || recalledCommandList.size() != 1)
+					return EXIT_STATUS_SYNTAX_ERROR;
+				listToExecutePtr = &recalledCommandList[0];
 			}
 		}
 
-		// Record command
-		Lex::Lists::AddUniqueElementToFront(*commandToExecutePtr, executedCommands);
-
-		// Execute command
-		if(commandToExecutePtr->name == CHANGE_DIRECTORY_COMMAND)
+		// Record and-or list, except for displaying history by itself
+		if(interactive && !listToExecutePtr->IsSingleCommand(DISPLAY_HISTORY_COMMAND))
 		{
-
-			if(commandToExecutePtr->arguments.size() > 1)
-				std::cerr << SHELL_NAME << ": " << CHANGE_DIRECTORY_COMMAND << ": too many parameters" << std::endl;
+			if(!recalledText.empty())
+				executedCommands.push_back(recalledText);
 			else
 			{
-				std::string newPath;
-				if(!commandToExecutePtr->arguments.empty())
-					newPath = commandToExecutePtr->arguments[0];
-				ExpandDirectory(newPath);
-				ChangeDirectory(newPath);
+				std::ostringstream textStream;
+				listToExecutePtr->Print(textStream);
+				executedCommands.push_back(textStream.str());
 			}
 		}
-		else if(commandToExecutePtr->name == CHANGE_TO_LAST_DIRECTORY_COMMAND)
+
+		// Execute and-or list
+		if(listToExecutePtr->background)
 		{
-			if(!commandToExecutePtr->arguments.empty())
-				std::cerr << SHELL_NAME << ": " << CHANGE_TO_LAST_DIRECTORY_COMMAND << ": too many parameters" << std::endl;
-			else
-				ChangeDirectory(lastWorkingDirectory);
+			StartBackgroundJob(*listToExecutePtr);
+			return EXIT_SUCCESS;
 		}
-		else
-			Lex::Posix::ExecuteExternalAppAndWait(commandToExecutePtr->name, commandToExecutePtr->arguments,
-										   SHELL_NAME + ": " + commandToExecutePtr->name);
+		return EvaluateAndOrList(*listToExecutePtr);
 	}
-
-	//+------------------------\----------------------------------
-	//|		    Parse		   |
-	//\------------------------/----------------------------------
-	void SeparateIntoCommands(const std::vector<std::string>& wordList, std::vector<Command>& commandsOut)
+	int EvaluateAndOrList(const AndOrList& andOrList)
 	{
-		// Go word by word, finding the start and end of each command, and making a list
-		commandsOut.clear();
-		for(std::vector<std::string>::size_type currentWord = 0, currentCommandStart = 0; currentWord < wordList.size(); ++currentWord)
+		// && runs the next pipeline only after success, || only after failure
+		int exitStatus{ ExecutePipeline(andOrList.pipelines[0]) };
+		for(std::vector<AndOrList::Connector>::size_type i = 0; i < andOrList.connectors.size() && !exitRequested; ++i)
 		{
-			// If current word is command separator
-			if(wordList[currentWord] == COMMAND_SEPARATOR_1 || wordList[currentWord] == COMMAND_SEPARATOR_2)
-			{
-				// If current command has any words, record the command
-				if(currentWord > currentCommandStart)
-				{
-					// Record command name
-					Command command;
-					command.name = wordList[currentCommandStart];
-
-					// Record arguments, if any
-					for(std::vector<std::string>::size_type i = currentCommandStart + 1; i < currentWord; ++i)
-						command.arguments.push_back(wordList[i]);
-
-					// Record command
-					commandsOut.push_back(command);
-				}
+			lastExitStatus = exitStatus;
+			bool succeeded{ exitStatus == EXIT_SUCCESS };
+			if(succeeded == (andOrList.connectors[i] == AndOrList::Connector::And))
+				exitStatus = ExecutePipeline(andOrList.pipelines[i + 1]);
+		}
+		return exitStatus;
+	}
+	int ExecutePipeline(const Pipeline& pipeline)
+	{
+		if(pipeline.commands.empty())
+			return EXIT_SUCCESS;
 
-				// Next command needs to start on next word
-				currentCommandStart = currentWord + 1;
-			}
+		// Expand into a copy only when there is something to expand
+		Pipeline expandedPipeline;
+		const Pipeline& pipelineToExecute{ ExpandParameters(pipeline, expandedPipeline) ? expandedPipeline : pipeline };
 
-			// If we are at the last word
-			if(currentWord + 1 == wordList.size())
-			{
-				// If current command has any words, record the command
-				if(currentWord + 1 > currentCommandStart)
-				{
-					// Record command name
-					Command command;
-					command.name = wordList[currentCommandStart];
+		// time before a pipeline times all of it
+		if(pipelineToExecute.commands[0].name == TIME_COMMAND && pipelineToExecute.commands.size() > 1)
+			return ExecuteTimedPipeline(pipelineToExecute);
 
-					// Record arguments, if any
-					for(std::vector<std::string>::size_type i = currentCommandStart + 1; i <= currentWord; ++i)
-						command.arguments.push_back(wordList[i]);
+		// pin before a pipeline places all of it
+		if(IsPinPrefix(pipelineToExecute.commands[0]))
+			return ExecutePinnedPipeline(pipelineToExecute);
 
-					// Record command
-					commandsOut.push_back(command);
-				}
-			}
+		if(pipelineToExecute.commands.size() == 1)
+		{
+			const Command& command{ pipelineToExecute.commands[0] };
+			if(command.HasRedirections() && IsBuiltinCommand(command))
+				return ExecuteBuiltinWithRedirections(command);
+			else
+				return ExecuteCommand(command);
 		}
+		else
+			return ExecutePipelineStages(pipelineToExecute);
 	}
-	bool StringToCommandListIndex(const std::string& str, CommandListIndex& out)
+	int ExecuteCommand(const Command& command)
 	{
-		static_assert(sizeof(CommandListIndex) >= sizeof(int));
-		int numCommandsInt;
+		if(command.name.empty())
+			return EXIT_SUCCESS;
+		if(IsAssignment(command.name))
+			return ExecuteAssignments(command);
 
-		if(Lex::Strings::ToInt(str, numCommandsInt) && numCommandsInt >= 0)
+		// Builtin output is flushed before anything else can write to the same file
+		if(IsBuiltinCommand(command))
 		{
-			out = static_cast<CommandListIndex>(numCommandsInt);
-			return true;
+			Lex::Stats::Nanoseconds start{ 0 };
+			Lex::Stats::Nanoseconds commandTimeBefore{ commandTime };
+			rusage selfUsageBefore;
+			if(profileFormat != ProfileFormat::None)
+			{
+				start = Lex::Stats::Now();
+				getrusage(RUSAGE_SELF, &selfUsageBefore);
+			}
+			int exitStatus{ BUILTIN_COMMANDS.find(command.name)->second(command) };
+			std::cout.flush();
+			if(profileFormat != ProfileFormat::None)
+				RecordBuiltinProfile(command.name, start, commandTimeBefore, selfUsageBefore);
+			return exitStatus;
 		}
-		else
-			return false;
+		return ExecuteExternalCommand(command);
 	}
+	int ExecuteExternalCommand(const Command& command)
+	{
+		// Child reads and writes redirected files directly
+		Lex::Posix::SpawnFileActionList fileActions{ &lineArena };
+		std::pmr::vector<int> redirectionFds{ &lineArena };
+		if(!OpenRedirections(command, fileActions, redirectionFds))
+			return EXIT_FAILURE;
 
+		ChildProcess child;
+		bool spawned{ SpawnExternalCommand(command, fileActions, child) };
+		CloseFds(redirectionFds);
+		if(!spawned)
+			return EXIT_STATUS_NOT_FOUND;
 
-	//+------------------------\----------------------------------
-	//|		   Directory	   |
+		int status;
+		if(!WaitForForegroundChild(child, status, ErrorPrefix(command.name)))
+			return EXIT_FAILURE;
+		ReportSignal(status);
+		return Lex::Posix::WaitStatusToExitStatus(status);
+	}
+	bool SpawnExternalCommand(const Command& command, const Lex::Posix::SpawnFileActionList& fileActions, ChildProcess& childOut)
+	{
+		childOut.name = command.name;
+		childOut.spawnStart = (profileFormat != ProfileFormat::None) ? Lex::Stats::Now() : 0;
+
+		// Names containing a slash are run as-is, everything else goes through the hash table
+		HashedCommand* hashedCommandPtr{ nullptr };
+		bool wasHit{ false };
+		if(command.name.find('/') == std::string_view::npos)
+		{
+			hashedCommandPtr = FindHashedCommand(command.name, wasHit);
+			if(!hashedCommandPtr)
+			{
+				std::cerr << SHELL_NAME << ": " << command.name << ": command not found" << std::endl;
+				return false;
+			}
+		}
+
+		std::string_view pathToApp{ hashedCommandPtr ? std::string_view{ hashedCommandPtr->path } : command.name };
+		bool spawned{ Lex::Posix::SpawnExternalApp(pathToApp, command.arguments, fileActions, shellVariables.GetEnvp(), childOut.pid) };
+
+		// Cached path went stale (app moved or deleted): search $PATH again once
+		if(!spawned && errno == ENOENT && wasHit)
+		{
+			ForgetHashedCommand(command.name);
+			hashedCommandPtr = FindHashedCommand(command.name, wasHit);
+			if(!hashedCommandPtr)
+			{
+				std::cerr << SHELL_NAME << ": " << command.name << ": command not found" << std::endl;
+				return false;
+			}
+			spawned = Lex::Posix::SpawnExternalApp(hashedCommandPtr->path, command.arguments, fileActions, shellVariables.GetEnvp(), childOut.pid);
+		}
+		if(!spawned)
+		{
+			perror(ErrorPrefix(command.name).c_str());
+			return false;
+		}
+
+		// posix_spawn returns once the child has exec'd
+		if(profileFormat != ProfileFormat::None)
+			childOut.spawnEnd = Lex::Stats::Now();
+		return true;
+	}
+	bool IsBuiltinCommand(const Command& command)
+	{
+		if(BUILTIN_COMMANDS.find(command.name) == BUILTIN_COMMANDS.end())
+			return false;
+
+		// cat options are left to the real cat
+		if(command.name == CAT_COMMAND)
+			return std::none_of(command.arguments.begin(), command.arguments.end(), [](std::string_view argument) {
+				return argument.size() > 1 && argument[0] == '-';
+			});
+		return true;
+	}
+	std::string ErrorPrefix(std::string_view name)
+	{
+		// For perror: "lesh: name"
+		std::string prefix{ SHELL_NAME };
+		prefix += ": ";
+		prefix += name;
+		return prefix;
+	}
+	void ReportSignal(int waitStatus)
+	{
+		// Interrupted and broken-pipe children are expected, anything else killed by a signal is worth a message
+		if(!WIFSIGNALED(waitStatus) || WTERMSIG(waitStatus) == SIGINT || WTERMSIG(waitStatus) == SIGPIPE)
+			return;
+		std::cerr << strsignal(WTERMSIG(waitStatus));
+		if(WCOREDUMP(waitStatus))
+			std::cerr << " (core dumped)";
+		std::cerr << std::endl;
+	}
+
+	//+------------------------\----------------------------------
+	//|		   Pipeline		   |
+	//\------------------------/----------------------------------
+	int ExecutePipelineStages(const Pipeline& pipeline)
+	{
+		// Start every stage before waiting for any of them
+		std::pmr::vector<ChildProcess> children{ &lineArena };
+		bool lastStageSpawned{ SpawnPipelineStages(pipeline, children) };
+
+		// Reap all stages. Exit status of a pipeline is the exit status of its last stage.
+		int status{ 0 };
+		for(const ChildProcess& child : children)
+			if(!WaitForForegroundChild(child, status, SHELL_NAME))
+				status = EXIT_FAILURE << 8;
+		if(!lastStageSpawned)
+			return EXIT_STATUS_NOT_FOUND;
+		ReportSignal(status);
+		return Lex::Posix::WaitStatusToExitStatus(status);
+	}
+	bool SpawnPipelineStages(const Pipeline& pipeline, std::pmr::vector<ChildProcess>& childrenOut)
+	{
+		// Connect each stage to the next with a pipe
+		childrenOut.clear();
+		childrenOut.reserve(pipeline.commands.size());
+		int previousReadFd{ -1 };
+		bool lastStageSpawned{ false };
+		for(std::pmr::vector<Command>::size_type i = 0; i < pipeline.commands.size(); ++i)
+		{
+			int readFd{ -1 };
+			int writeFd{ -1 };
+			if(i + 1 < pipeline.commands.size() && !Lex::Posix::CreatePipe(readFd, writeFd))
+			{
+				perror((SHELL_NAME + ": " + PIPING_OPERATOR).c_str());
+				lastStageSpawned = false;
+				break;
+			}
+
+			// Connect stdin to the previous stage and stdout to the next stage
+			Lex::Posix::SpawnFileActionList fileActions{ &lineArena };
+			if(previousReadFd >= 0)
+				fileActions.push_back(Lex::Posix::SpawnFileAction::Duplicate(previousReadFd, STDIN_FILENO));
+			if(writeFd >= 0)
+				fileActions.push_back(Lex::Posix::SpawnFileAction::Duplicate(writeFd, STDOUT_FILENO));
+
+			// Redirections take precedence over pipes
+			std::pmr::vector<int> redirectionFds{ &lineArena };
+			bool redirected{ OpenRedirections(pipeline.commands[i], fileActions, redirectionFds) };
+
+			// Stages that fork without exec would otherwise keep the pipe ends open and never see end of input
+			for(int fd : { previousReadFd, readFd, writeFd })
+				if(fd >= 0)
+					fileActions.push_back(Lex::Posix::SpawnFileAction::Close(fd));
+			for(int fd : redirectionFds)
+				fileActions.push_back(Lex::Posix::SpawnFileAction::Close(fd));
+
+			ChildProcess child;
+			lastStageSpawned = redirected && SpawnPipelineStage(pipeline.commands[i], previousReadFd >= 0 && writeFd >= 0, fileActions, child);
+			if(lastStageSpawned)
+				childrenOut.push_back(child);
+			CloseFds(redirectionFds);
+
+			// The stage owns its ends now
+			if(previousReadFd >= 0)
+				close(previousReadFd);
+			if(writeFd >= 0)
+				close(writeFd);
+			previousReadFd = readFd;
+		}
+		if(previousReadFd >= 0)
+			close(previousReadFd);
+		return lastStageSpawned;
+	}
+	bool SpawnPipelineStage(const Command& command, bool isMiddleStage, const Lex::Posix::SpawnFileActionList& fileActions, ChildProcess& childOut)
+	{
+		const std::string perrorMessage{ ErrorPrefix(command.name) };
+		if(!IsBuiltinCommand(command) && !(spliceMiddleStages && isMiddleStage && IsSpliceableStage(command)))
+			return SpawnExternalCommand(command, fileActions, childOut);
+
+		// Forked stages are timed from fork to return
+		childOut.name = command.name;
+		childOut.spawnStart = (profileFormat != ProfileFormat::None) ? Lex::Stats::Now() : 0;
+		bool forked{ ForkPipelineStage(command, isMiddleStage, fileActions, childOut.pid, perrorMessage) };
+		childOut.spawnEnd = childOut.spawnStart ? Lex::Stats::Now() : 0;
+		return forked;
+	}
+	bool ForkPipelineStage(const Command& command, bool isMiddleStage, const Lex::Posix::SpawnFileActionList& fileActions, pid_t& childPidOut, const std::string& perrorMessage)
+	{
+		// Pass-through stage: move the data inside the kernel
+		if(spliceMiddleStages && isMiddleStage && IsSpliceableStage(command))
+		{
+			if(command.name == CAT_COMMAND)
+				return Lex::Posix::ForkAndRun([]() {
+					return Lex::Posix::SpliceAll(STDIN_FILENO, STDOUT_FILENO) ? EXIT_SUCCESS : EXIT_FAILURE;
+				}, fileActions, childPidOut, perrorMessage);
+			else
+				return Lex::Posix::ForkAndRun([&command, &perrorMessage]() {
+					int copyFd{ open(command.arguments[0].data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666) };
+					if(copyFd < 0 || !Lex::Posix::TeeAll(STDIN_FILENO, STDOUT_FILENO, copyFd))
+					{
+						perror(perrorMessage.c_str());
+						return EXIT_FAILURE;
+					}
+					return EXIT_SUCCESS;
+				}, fileActions, childPidOut, perrorMessage);
+		}
+
+		// Builtins run in a child of their own so they can read and write the pipes concurrently
+		return Lex::Posix::ForkAndRun([&command]() {
+			int exitStatus{ ExecuteCommand(command) };
+			std::cout.flush();
+			return exitStatus;
+		}, fileActions, childPidOut, perrorMessage);
+	}
+	bool IsSpliceableStage(const Command& command)
+	{
+		if(command.HasRedirections())
+			return false;
+		return (command.name == CAT_COMMAND && command.arguments.empty()) ||
+			   (command.name == TEE_COMMAND && command.arguments.size() == 1);
+	}
+
+	//+------------------------\----------------------------------
+	//|			 Jobs		   |
+	//\------------------------/----------------------------------
+	void StartBackgroundJob(const AndOrList& andOrList)
+	{
+		// A single pipeline is spawned directly, a longer and-or list is evaluated by a child shell
+		// It is placed by a pin prefix, or else by pin --auto
+		Job job;
+		if(andOrList.pipelines.size() == 1)
+		{
+			Pipeline expandedPipeline;
+			const Pipeline* pipelinePtr{ ExpandParameters(andOrList.pipelines[0], expandedPipeline) ? &expandedPipeline : &andOrList.pipelines[0] };
+			Lex::Posix::Placement placement;
+			const Lex::Posix::Placement* placementPtr{ nullptr };
+			Pipeline pinnedPipeline;
+			if(IsPinPrefix(pipelinePtr->commands[0]))
+			{
+				pinnedPipeline = *pipelinePtr;
+				if(!SplitPinPrefix(pipelinePtr->commands[0], placement, pinnedPipeline.commands[0]))
+					return;
+				pipelinePtr = &pinnedPipeline;
+				placementPtr = &placement;
+			}
+			else
+				placementPtr = NextAutoPlacement();
+			std::optional<Lex::Posix::ScopedPlacement> scopedPlacement;
+			if(placementPtr)
+				scopedPlacement.emplace(*placementPtr);
+			if(placementPtr == &placement && !scopedPlacement->IsApplied())
+			{
+				perror(ErrorPrefix(PIN_COMMAND).c_str());
+				return;
+			}
+			std::pmr::vector<ChildProcess> children{ &lineArena };
+			SpawnPipelineStages(*pipelinePtr, children);
+			for(const ChildProcess& child : children)
+				job.childPids.push_back(child.pid);
+		}
+		else
+		{
+			std::optional<Lex::Posix::ScopedPlacement> scopedPlacement;
+			if(const Lex::Posix::Placement* placementPtr{ NextAutoPlacement() })
+				scopedPlacement.emplace(*placementPtr);
+			pid_t childPid;
+			if(Lex::Posix::ForkAndRun([&andOrList]() { return EvaluateAndOrList(andOrList); }, {}, childPid, SHELL_NAME))
+				job.childPids.push_back(childPid);
+		}
+		if(job.childPids.empty())
+			return;
+
+		// Next id after the highest in use
+		for(const Job& existingJob : jobTable)
+			job.id = std::max(job.id, existingJob.id);
+		++job.id;
+		{
+			std::ostringstream textStream;
+			andOrList.Print(textStream);
+			job.text = textStream.str();
+		}
+		for(pid_t childPid : job.childPids)
+		{
+			job.childPidFds.push_back(Lex::Posix::OpenProcessFd(childPid));
+			job.childReaped.push_back(false);
+		}
+		std::cout << '[' << job.id << "] " << job.childPids.back() << std::endl;
+		jobTable.push_back(std::move(job));
+	}
+	void ReapJobs(int timeoutMilliseconds)
+	{
+		// Poll every live pidfd at once. Children without one (old kernels) are checked each time poll returns.
+		std::vector<int> pidFds;
+		for(const Job& job : jobTable)
+			for(std::vector<pid_t>::size_type i = 0; i < job.childPids.size(); ++i)
+				if(!job.childReaped[i])
+					pidFds.push_back(job.childPidFds[i]);
+		if(pidFds.empty())
+			return;
+		if(!Lex::Posix::WaitForProcessFds(pidFds, timeoutMilliseconds))
+		{
+			perror((SHELL_NAME + ": " + JOBS_COMMAND).c_str());
+			return;
+		}
+
+		// Readable pidfd means exited, so the non-blocking reap succeeds
+		for(Job& job : jobTable)
+			for(std::vector<pid_t>::size_type i = 0; i < job.childPids.size(); ++i)
+			{
+				if(job.childReaped[i])
+					continue;
+				int status{ 0 };
+				if(Lex::Posix::TryReapChild(job.childPids[i], status))
+				{
+					job.childReaped[i] = true;
+					if(job.childPidFds[i] >= 0)
+					{
+						close(job.childPidFds[i]);
+						job.childPidFds[i] = -1;
+					}
+					if(i + 1 == job.childPids.size())
+						job.lastStatus = status;
+				}
+			}
+	}
+	void WaitForJob(const Job& job)
+	{
+		while(!job.IsDone())
+			ReapJobs(-1);
+	}
+	Job* FindJob(const Lex::WordLists::WordList& arguments, std::string_view commandName)
+	{
+		if(arguments.size() > 1)
+		{
+			std::cerr << SHELL_NAME << ": " << commandName << ": too many parameters" << std::endl;
+			return nullptr;
+		}
+		if(jobTable.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << commandName << ": no jobs" << std::endl;
+			return nullptr;
+		}
+
+		// No parameter means most recent job
+		if(arguments.empty())
+			return &jobTable.back();
+
+		// Job id, with or without %
+		std::string_view idString{ arguments[0] };
+		if(idString.compare(0, JOB_ID_PREFIX.size(), JOB_ID_PREFIX) == 0)
+			idString.remove_prefix(JOB_ID_PREFIX.size());
+		int id;
+		if(Lex::Strings::ToInt(idString, id))
+			for(Job& job : jobTable)
+				if(job.id == id)
+					return &job;
+		std::cerr << SHELL_NAME << ": " << commandName << ": " << arguments[0] << ": no such job" << std::endl;
+		return nullptr;
+	}
+	void ReportFinishedJobs()
+	{
+		for(auto jobIter{ jobTable.begin() }; jobIter != jobTable.end();)
+		{
+			if(jobIter->IsDone())
+			{
+				std::cout << '[' << jobIter->id << "]  Done\t" << jobIter->text << std::endl;
+				jobIter = jobTable.erase(jobIter);
+			}
+			else
+				++jobIter;
+		}
+	}
+	void PrintJobs()
+	{
+		ReapJobs(0);
+		for(const Job& job : jobTable)
+			std::cout << '[' << job.id << "]  " << (job.IsDone() ? "Done" : "Running") << '\t' << job.text << std::endl;
+		jobTable.remove_if([](const Job& job) { return job.IsDone(); });
+	}
+	void RemoveJob(const Job& job)
+	{
+		jobTable.remove_if([&job](const Job& existingJob) { return &existingJob == &job; });
+	}
+
+	//+------------------------\----------------------------------
+	//|		   Parallel		   |
+	//\------------------------/----------------------------------
+	int ExecuteParallel(const Command& command)
+	{
+		// Pool size defaults to one job per core
+		long maxRunning{ sysconf(_SC_NPROCESSORS_ONLN) };
+		std::vector<std::string>::size_type firstJobWord{ 0 };
+		if(!command.arguments.empty() && command.arguments[0] == PARALLEL_JOBS_OPTION)
+		{
+			int maxRunningInt;
+			if(command.arguments.size() < 2 || !Lex::Strings::ToInt(command.arguments[1], maxRunningInt) || maxRunningInt < 1)
+			{
+				std::cerr << SHELL_NAME << ": " << PARALLEL_COMMAND << ": invalid parameter" << std::endl;
+				return EXIT_FAILURE;
+			}
+			maxRunning = maxRunningInt;
+			firstJobWord = 2;
+		}
+		if(maxRunning < 1)
+			maxRunning = 1;
+
+		// Remaining words are commands separated by PARALLEL_SEPARATOR
+		std::pmr::vector<Command> jobCommands(1, &lineArena);
+		for(auto i{ firstJobWord }; i < command.arguments.size(); ++i)
+		{
+			if(command.arguments[i] == PARALLEL_SEPARATOR)
+			{
+				if(!jobCommands.back().name.empty())
+					jobCommands.emplace_back();
+			}
+			else if(jobCommands.back().name.empty())
+				jobCommands.back().name = command.arguments[i];
+			else
+				jobCommands.back().arguments.push_back(command.arguments[i]);
+		}
+		if(jobCommands.back().name.empty())
+			jobCommands.pop_back();
+		if(jobCommands.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << PARALLEL_COMMAND << ": missing commands" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		// Each job writes into its own in-memory files, which are printed in command order once the job is done
+		struct ParallelJob
+		{
+			pid_t childPid{ -1 };
+			int pidFd{ -1 };
+			int outputFd{ -1 };
+			int errorFd{ -1 };
+			bool running{ false };
+			bool done{ false };
+			bool failed{ true };
+		};
+		std::vector<ParallelJob> jobs(jobCommands.size());
+		std::vector<ParallelJob>::size_type nextToStart{ 0 };
+		std::vector<ParallelJob>::size_type nextToPrint{ 0 };
+		long numRunning{ 0 };
+		std::vector<int> pidFds;
+		while(nextToPrint < jobs.size())
+		{
+			// Fill the pool
+			for(; numRunning < maxRunning && nextToStart < jobs.size(); ++nextToStart)
+			{
+				ParallelJob& job{ jobs[nextToStart] };
+				job.done = true;
+				job.outputFd = Lex::Posix::CreateMemoryFile(PARALLEL_COMMAND);
+				job.errorFd = Lex::Posix::CreateMemoryFile(PARALLEL_COMMAND);
+				if(job.outputFd < 0 || job.errorFd < 0)
+				{
+					perror((SHELL_NAME + ": " + PARALLEL_COMMAND).c_str());
+					for(int* fdPtr : { &job.outputFd, &job.errorFd })
+						if(*fdPtr >= 0)
+						{
+							close(*fdPtr);
+							*fdPtr = -1;
+						}
+					continue;
+				}
+				Lex::Posix::SpawnFileActionList fileActions{ Lex::Posix::SpawnFileAction::Duplicate(job.outputFd, STDOUT_FILENO),
+															 Lex::Posix::SpawnFileAction::Duplicate(job.errorFd, STDERR_FILENO) };
+				ChildProcess child;
+				std::optional<Lex::Posix::ScopedPlacement> scopedPlacement;
+				if(const Lex::Posix::Placement* placementPtr{ NextAutoPlacement() })
+					scopedPlacement.emplace(*placementPtr);
+				if(SpawnPipelineStage(jobCommands[nextToStart], false, fileActions, child))
+				{
+					job.childPid = child.pid;
+					job.pidFd = Lex::Posix::OpenProcessFd(job.childPid);
+					job.running = true;
+					job.done = false;
+					++numRunning;
+				}
+			}
+
+			// Print finished jobs in order
+			while(nextToPrint < jobs.size() && jobs[nextToPrint].done)
+			{
+				ParallelJob& job{ jobs[nextToPrint] };
+				std::cout.flush();
+				if(job.outputFd >= 0)
+				{
+					Lex::Posix::SendFileAll(job.outputFd, STDOUT_FILENO);
+					close(job.outputFd);
+				}
+				if(job.errorFd >= 0)
+				{
+					Lex::Posix::SendFileAll(job.errorFd, STDERR_FILENO);
+					close(job.errorFd);
+				}
+				++nextToPrint;
+			}
+			if(numRunning == 0)
+				continue;
+
+			// Wait for any running job to exit
+			pidFds.clear();
+			for(const ParallelJob& job : jobs)
+				if(job.running)
+					pidFds.push_back(job.pidFd);
+			if(!Lex::Posix::WaitForProcessFds(pidFds, -1))
+				perror((SHELL_NAME + ": " + PARALLEL_COMMAND).c_str());
+			for(ParallelJob& job : jobs)
+			{
+				int status;
+				if(job.running && Lex::Posix::TryReapChild(job.childPid, status))
+				{
+					job.running = false;
+					job.done = true;
+					job.failed = (Lex::Posix::WaitStatusToExitStatus(status) != EXIT_SUCCESS);
+					if(job.pidFd >= 0)
+						close(job.pidFd);
+					--numRunning;
+				}
+			}
+		}
+
+		// Like GNU parallel, exit status is the number of failed jobs
+		long numFailed{ std::count_if(jobs.begin(), jobs.end(), [](const ParallelJob& job) { return job.failed; }) };
+		return static_cast<int>(std::min<long>(numFailed, EXIT_STATUS_MAX_FAILED_JOBS));
+	}
+
+	//+------------------------\----------------------------------
+	//|		   Builtins		   |
+	//\------------------------/----------------------------------
+	int ExecuteHistory(const Command& command)
+	{
+		CommandListIndex numCommands{ HISTORY_DEFAULT_DISPLAY_SIZE };
+		if(command.arguments.size() > 1)
+		{
+			std::cerr << SHELL_NAME << ": " << DISPLAY_HISTORY_COMMAND << ": too many parameters" << std::endl;
+			return EXIT_FAILURE;
+		}
+		else if(command.arguments.size() == 1)
+		{
+			if(!StringToCommandListIndex(command.arguments[0], numCommands))
+			{
+				std::cerr << SHELL_NAME << ": " << DISPLAY_HISTORY_COMMAND << ": invalid parameter" << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		PrintHistory(numCommands);
+		return EXIT_SUCCESS;
+	}
+	int ExecuteRecallHistory(const Command&)
+	{
+		// A lone ! is handled by ExecuteAndOrList
+		std::cerr << SHELL_NAME << ": " << EXECUTE_HISTORY_COMMAND << ": must be used by itself" << std::endl;
+		return EXIT_FAILURE;
+	}
+	int ExecuteChangeDirectory(const Command& command)
+	{
+		if(command.arguments.size() > 1)
+		{
+			std::cerr << SHELL_NAME << ": " << CHANGE_DIRECTORY_COMMAND << ": too many parameters" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::string newPath;
+		if(!command.arguments.empty())
+			newPath = command.arguments[0];
+		ExpandDirectory(newPath);
+		return ChangeDirectory(newPath) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	int ExecuteChangeToLastDirectory(const Command& command)
+	{
+		if(!command.arguments.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << CHANGE_TO_LAST_DIRECTORY_COMMAND << ": too many parameters" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return ChangeDirectory(lastWorkingDirectory) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	int ExecuteHash(const Command& command)
+	{
+		if(command.arguments.empty())
+			PrintCommandHashTable();
+		else if(command.arguments.size() == 1 && command.arguments[0] == HASH_RESET_OPTION)
+		{
+			commandHashTable.clear();
+			commandHashTableHits = commandHashTableMisses = 0;
+		}
+		else
+		{
+			int exitStatus{ EXIT_SUCCESS };
+			for(auto const& name : command.arguments)
+			{
+				bool wasHit;
+				if(!FindHashedCommand(name, wasHit))
+				{
+					std::cerr << SHELL_NAME << ": " << HASH_COMMAND << ": " << name << ": not found" << std::endl;
+					exitStatus = EXIT_FAILURE;
+				}
+			}
+			return exitStatus;
+		}
+		return EXIT_SUCCESS;
+	}
+	int ExecuteJobs(const Command& command)
+	{
+		if(!command.arguments.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << JOBS_COMMAND << ": too many parameters" << std::endl;
+			return EXIT_FAILURE;
+		}
+		PrintJobs();
+		return EXIT_SUCCESS;
+	}
+	int ExecuteWait(const Command& command)
+	{
+		// No parameters waits for every job
+		if(command.arguments.empty())
+		{
+			while(!jobTable.empty())
+			{
+				WaitForJob(jobTable.front());
+				jobTable.pop_front();
+			}
+			return EXIT_SUCCESS;
+		}
+		else if(Job* jobPtr{ FindJob(command.arguments, WAIT_COMMAND) })
+		{
+			WaitForJob(*jobPtr);
+			int exitStatus{ Lex::Posix::WaitStatusToExitStatus(jobPtr->lastStatus) };
+			RemoveJob(*jobPtr);
+			return exitStatus;
+		}
+		return EXIT_FAILURE;
+	}
+	int ExecuteForeground(const Command& command)
+	{
+		if(Job* jobPtr{ FindJob(command.arguments, FOREGROUND_COMMAND) })
+		{
+			std::cout << jobPtr->text << std::endl;
+			WaitForJob(*jobPtr);
+			ReportSignal(jobPtr->lastStatus);
+			int exitStatus{ Lex::Posix::WaitStatusToExitStatus(jobPtr->lastStatus) };
+			RemoveJob(*jobPtr);
+			return exitStatus;
+		}
+		return EXIT_FAILURE;
+	}
+	int ExecuteEcho(const Command& command)
+	{
+		// Leading -n, -e and -E options, also combined (ex: -ne)
+		bool newline{ true };
+		bool escapes{ false };
+		Lex::WordLists::WordList::size_type firstWord{ 0 };
+		for(; firstWord < command.arguments.size(); ++firstWord)
+		{
+			std::string_view word{ command.arguments[firstWord] };
+			if(word.size() < 2 || word[0] != '-' || word.find_first_not_of("neE", 1) != std::string_view::npos)
+				break;
+			for(char option : word.substr(1))
+			{
+				if(option == 'n')
+					newline = false;
+				else
+					escapes = (option == 'e');
+			}
+		}
+
+		std::string output;
+		for(auto i{ firstWord }; i < command.arguments.size(); ++i)
+		{
+			if(i > firstWord)
+				output += ' ';
+			if(escapes)
+			{
+				// \c stops all output
+				if(!AppendEscapedText(command.arguments[i], true, output))
+				{
+					std::cout << output;
+					return EXIT_SUCCESS;
+				}
+			}
+			else
+				output += command.arguments[i];
+		}
+		if(newline)
+			output += '\n';
+		std::cout << output;
+		return EXIT_SUCCESS;
+	}
+	int ExecutePrintf(const Command& command)
+	{
+		if(command.arguments.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << PRINTF_COMMAND << ": missing format" << std::endl;
+			return EXIT_STATUS_SYNTAX_ERROR;
+		}
+
+		// Conversions are done by snprintf, one at a time
+		std::string output;
+		auto appendFormatted = [&output](const std::string& spec, auto value) {
+			int length{ std::snprintf(nullptr, 0, spec.c_str(), value) };
+			if(length < 0)
+				return;
+			std::string::size_type oldSize{ output.size() };
+			output.resize(oldSize + static_cast<std::string::size_type>(length) + 1);
+			std::snprintf(&output[oldSize], static_cast<std::size_t>(length) + 1, spec.c_str(), value);
+			output.resize(oldSize + static_cast<std::string::size_type>(length));
+		};
+
+		// Numbers may also be given as 'c or "c for the character's code
+		int exitStatus{ EXIT_SUCCESS };
+		auto toNumber = [&exitStatus](std::string_view word, auto& numberOut) {
+			numberOut = 0;
+			if(word.empty())
+				return;
+			if(word.size() > 1 && (word[0] == '\'' || word[0] == '"'))
+			{
+				numberOut = static_cast<unsigned char>(word[1]);
+				return;
+			}
+			auto [endPtr, error] = std::from_chars(word.data(), word.data() + word.size(), numberOut);
+			if(error != std::errc{} || endPtr != word.data() + word.size())
+			{
+				std::cerr << SHELL_NAME << ": " << PRINTF_COMMAND << ": " << word << ": invalid number" << std::endl;
+				exitStatus = EXIT_FAILURE;
+			}
+		};
+
+		// The format is reused until every argument is consumed
+		std::string_view format{ command.arguments[0] };
+		Lex::WordLists::WordList::size_type nextArgument{ 1 };
+		bool stop{ false };
+		do
+		{
+			for(std::string_view::size_type i = 0; i < format.size() && !stop; ++i)
+			{
+				if(format[i] == '\\')
+				{
+					std::string_view::size_type escapeEnd{ i + 1 };
+					while(escapeEnd < format.size() && escapeEnd < i + 4 && 
+						  (escapeEnd == i + 1 || (format[i + 1] >= '0' && format[i + 1] <= '7' && format[escapeEnd] >= '0' && format[escapeEnd] <= '7')))
+						++escapeEnd;
+					stop = !AppendEscapedText(format.substr(i, escapeEnd - i), false, output);
+					i = escapeEnd - 1;
+					continue;
+				}
+				if(format[i] != '%')
+				{
+					output += format[i];
+					continue;
+				}
+				if(i + 1 < format.size() && format[i + 1] == '%')
+				{
+					output += '%';
+					++i;
+					continue;
+				}
+
+				// %[flags][width][.precision]conversion
+				std::string_view::size_type specEnd{ format.find_first_not_of("-+ #0123456789.", i + 1) };
+				if(specEnd == std::string_view::npos)
+				{
+					std::cerr << SHELL_NAME << ": " << PRINTF_COMMAND << ": missing conversion" << std::endl;
+					return EXIT_FAILURE;
+				}
+				std::string spec{ format.substr(i, specEnd - i) };
+				char conversion{ format[specEnd] };
+				std::string_view argument;
+				if(nextArgument < command.arguments.size())
+					argument = command.arguments[nextArgument++];
+				switch(conversion)
+				{
+				case 's':
+					appendFormatted(spec + 's', std::string{ argument }.c_str());
+					break;
+				case 'b':
+				{
+					std::string expanded;
+					stop = !AppendEscapedText(argument, true, expanded);
+					appendFormatted(spec + 's', expanded.c_str());
+					break;
+				}
+				case 'c':
+					appendFormatted(spec + 'c', argument.empty() ? 0 : static_cast<int>(argument[0]));
+					break;
+				case 'd':
+				case 'i':
+				{
+					long long number;
+					toNumber(argument, number);
+					appendFormatted(spec + "lld", number);
+					break;
+				}
+				case 'u':
+				case 'o':
+				case 'x':
+				case 'X':
+				{
+					unsigned long long number;
+					toNumber(argument, number);
+					appendFormatted(spec + "ll" + conversion, number);
+					break;
+				}
+				case 'e':
+				case 'E':
+				case 'f':
+				case 'F':
+				case 'g':
+				case 'G':
+				{
+					double number{ std::strtod(std::string{ argument }.c_str(), nullptr) };
+					appendFormatted(spec + conversion, number);
+					break;
+				}
+				default:
+					std::cerr << SHELL_NAME << ": " << PRINTF_COMMAND << ": %" << conversion << ": invalid conversion" << std::endl;
+					return EXIT_FAILURE;
+				}
+				i = specEnd;
+			}
+		} while(!stop && nextArgument > 1 && nextArgument < command.arguments.size());
+		std::cout << output;
+		return exitStatus;
+	}
+	bool AppendEscapedText(std::string_view text, bool octalNeedsZero, std::string& output)
+	{
+		// Backslash escapes of echo -e and printf. Octal is \0nnn for echo -e and %b, \nnn in printf formats.
+		// Returns false at \c, which ends all output.
+		for(std::string_view::size_type i = 0; i < text.size(); ++i)
+		{
+			if(text[i] != '\\' || i + 1 == text.size())
+			{
+				output += text[i];
+				continue;
+			}
+			char escape{ text[++i] };
+			switch(escape)
+			{
+			case 'a': output += '\a'; break;
+			case 'b': output += '\b'; break;
+			case 'e': output += '\033'; break;
+			case 'f': output += '\f'; break;
+			case 'n': output += '\n'; break;
+			case 'r': output += '\r'; break;
+			case 't': output += '\t'; break;
+			case 'v': output += '\v'; break;
+			case '\\': output += '\\'; break;
+			case 'c': return false;
+			default:
+				if(escape >= '0' && escape <= '7' && (!octalNeedsZero || escape == '0'))
+				{
+					// Up to three octal digits, after the 0 if it is required
+					std::string_view::size_type digitsStart{ octalNeedsZero ? i + 1 : i };
+					int value{ 0 };
+					std::string_view::size_type j{ digitsStart };
+					for(; j < text.size() && j < digitsStart + 3 && text[j] >= '0' && text[j] <= '7'; ++j)
+						value = value * 8 + (text[j] - '0');
+					output += static_cast<char>(value);
+					i = j - 1;
+				}
+				else
+				{
+					output += '\\';
+					output += escape;
+				}
+				break;
+			}
+		}
+		return true;
+	}
+	int ExecuteTest(const Command& command)
+	{
+		// [ needs ] as its last word
+		Lex::WordLists::WordList::size_type end{ command.arguments.size() };
+		if(command.name == TEST_BRACKET_COMMAND)
+		{
+			if(command.arguments.empty() || command.arguments.back() != TEST_BRACKET_END)
+			{
+				std::cerr << SHELL_NAME << ": " << TEST_BRACKET_COMMAND << ": missing \'" << TEST_BRACKET_END << '\'' << std::endl;
+				return EXIT_STATUS_SYNTAX_ERROR;
+			}
+			--end;
+		}
+		if(end == 0)
+			return EXIT_FAILURE;
+
+		TestExpression expression{ command.arguments, end };
+		bool result{ expression.ParseOr() };
+		if(expression.error.empty() && expression.position != end)
+			expression.error = "unexpected \'" + std::string{ command.arguments[expression.position] } + '\'';
+		if(!expression.error.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << command.name << ": " << expression.error << std::endl;
+			return EXIT_STATUS_SYNTAX_ERROR;
+		}
+		return result ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	bool TestExpression::ParseOr()
+	{
+		bool result{ ParseAnd() };
+		while(error.empty() && position < end && words[position] == "-o")
+		{
+			++position;
+			bool right{ ParseAnd() };
+			result = result || right;
+		}
+		return result;
+	}
+	bool TestExpression::ParseAnd()
+	{
+		bool result{ ParseNot() };
+		while(error.empty() && position < end && words[position] == "-a")
+		{
+			++position;
+			bool right{ ParseNot() };
+			result = result && right;
+		}
+		return result;
+	}
+	bool TestExpression::ParseNot()
+	{
+		// ! alone is a string
+		if(position + 1 < end && words[position] == "!")
+		{
+			++position;
+			return !ParseNot();
+		}
+		return ParsePrimary();
+	}
+	bool TestExpression::ParsePrimary()
+	{
+		if(position >= end)
+		{
+			error = "argument expected";
+			return false;
+		}
+
+		// ( expression )
+		if(words[position] == "(" && position + 1 < end)
+		{
+			++position;
+			bool result{ ParseOr() };
+			if(error.empty() && (position >= end || words[position] != ")"))
+				error = "missing \')\'";
+			++position;
+			return result;
+		}
+
+		// Binary operators take precedence, so "x = y" compares even if x looks like an operator
+		if(position + 2 < end)
+		{
+			std::string_view left{ words[position] };
+			std::string_view op{ words[position + 1] };
+			std::string_view right{ words[position + 2] };
+			if(op == "=" || op == "==" || op == "!=" || op == "<" || op == ">")
+			{
+				position += 3;
+				int comparison{ left.compare(right) };
+				if(op == "!=")
+					return comparison != 0;
+				if(op == "<")
+					return comparison < 0;
+				if(op == ">")
+					return comparison > 0;
+				return comparison == 0;
+			}
+			if(op.size() == 3 && op[0] == '-')
+			{
+				const std::string_view NUMERIC_OPERATORS[]{ "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+				if(std::find(std::begin(NUMERIC_OPERATORS), std::end(NUMERIC_OPERATORS), op) != std::end(NUMERIC_OPERATORS))
+				{
+					position += 3;
+					long long leftNumber;
+					long long rightNumber;
+					if(!ToTestNumber(left, leftNumber) || !ToTestNumber(right, rightNumber))
+						return false;
+					if(op == "-eq") return leftNumber == rightNumber;
+					if(op == "-ne") return leftNumber != rightNumber;
+					if(op == "-lt") return leftNumber < rightNumber;
+					if(op == "-le") return leftNumber <= rightNumber;
+					if(op == "-gt") return leftNumber > rightNumber;
+					return leftNumber >= rightNumber;
+				}
+			}
+		}
+
+		// Unary operators
+		std::string_view word{ words[position] };
+		if(word.size() == 2 && word[0] == '-' && position + 1 < end && std::string_view{ "efdrwxsznLhpSbct" }.find(word[1]) != std::string_view::npos)
+		{
+			std::string_view operand{ words[position + 1] };
+			position += 2;
+			switch(word[1])
+			{
+			case 'z': return operand.empty();
+			case 'n': return !operand.empty();
+			case 't':
+			{
+				int fd;
+				return Lex::Strings::ToInt(operand, fd) && isatty(fd);
+			}
+			case 'r': return access(operand.data(), R_OK) == 0;
+			case 'w': return access(operand.data(), W_OK) == 0;
+			case 'x': return access(operand.data(), X_OK) == 0;
+			}
+			struct stat fileStatus;
+			bool isLink{ word[1] == 'L' || word[1] == 'h' };
+			if((isLink ? lstat(operand.data(), &fileStatus) : stat(operand.data(), &fileStatus)) != 0)
+				return false;
+			switch(word[1])
+			{
+			case 'f': return S_ISREG(fileStatus.st_mode);
+			case 'd': return S_ISDIR(fileStatus.st_mode);
+			case 's': return fileStatus.st_size > 0;
+			case 'L':
+			case 'h': return S_ISLNK(fileStatus.st_mode);
+			case 'p': return S_ISFIFO(fileStatus.st_mode);
+			case 'S': return S_ISSOCK(fileStatus.st_mode);
+			case 'b': return S_ISBLK(fileStatus.st_mode);
+			case 'c': return S_ISCHR(fileStatus.st_mode);
+			default: return true;
+			}
+		}
+
+		// A lone string is true if it is not empty
+		++position;
+		return !word.empty();
+	}
+	bool TestExpression::ToTestNumber(std::string_view word, long long& numberOut)
+	{
+		auto [endPtr, parseError] = std::from_chars(word.data(), word.data() + word.size(), numberOut);
+		if(parseError != std::errc{} || endPtr != word.data() + word.size() || word.empty())
+		{
+			if(error.empty())
+				error = std::string{ word } + ": integer expression expected";
+			return false;
+		}
+		return true;
+	}
+	int ExecuteQuit(const Command& command)
+	{
+		// Quit with optional exit status, otherwise the last one. In a child of the shell, only the child ends.
+		int exitStatus{ lastExitStatus };
+		if(!command.arguments.empty() && !Lex::Strings::ToInt(command.arguments[0], exitStatus))
+			std::cerr << SHELL_NAME << ": " << command.name << ": invalid parameter" << std::endl;
+		exitRequested = true;
+		return exitStatus;
+	}
+	int ExecuteTrue(const Command&)
+	{
+		return EXIT_SUCCESS;
+	}
+	int ExecuteFalse(const Command&)
+	{
+		return EXIT_FAILURE;
+	}
+	int ExecutePwd(const Command&)
+	{
+		std::string workingDirectory;
+		if(!Lex::Posix::GetWorkingDirectory(workingDirectory))
+		{
+			perror(ErrorPrefix(PWD_COMMAND).c_str());
+			return EXIT_FAILURE;
+		}
+		std::cout << workingDirectory << '\n';
+		return EXIT_SUCCESS;
+	}
+	int ExecuteCat(const Command& command)
+	{
+		// Files are sent to stdout inside the kernel. No files or - means stdin.
+		std::cout.flush();
+		if(command.arguments.empty())
+			return Lex::Posix::SpliceAll(STDIN_FILENO, STDOUT_FILENO) ? EXIT_SUCCESS : EXIT_FAILURE;
+		int exitStatus{ EXIT_SUCCESS };
+		for(std::string_view argument : command.arguments)
+		{
+			bool succeeded;
+			if(argument == CAT_STDIN_ARGUMENT)
+				succeeded = Lex::Posix::SpliceAll(STDIN_FILENO, STDOUT_FILENO);
+			else
+			{
+				int fd{ open(argument.data(), O_RDONLY | O_CLOEXEC) };
+				if(fd < 0)
+				{
+					perror((ErrorPrefix(CAT_COMMAND) + ": " + std::string{ argument }).c_str());
+					exitStatus = EXIT_FAILURE;
+					continue;
+				}
+
+				// Appending a file to itself would never reach its end
+				struct stat inInfo;
+				struct stat outInfo;
+				if(fstat(fd, &inInfo) == 0 && fstat(STDOUT_FILENO, &outInfo) == 0 && S_ISREG(outInfo.st_mode) &&
+				   inInfo.st_dev == outInfo.st_dev && inInfo.st_ino == outInfo.st_ino)
+				{
+					std::cerr << ErrorPrefix(CAT_COMMAND) << ": " << argument << ": input file is output file" << std::endl;
+					close(fd);
+					exitStatus = EXIT_FAILURE;
+					continue;
+				}
+				succeeded = Lex::Posix::SendFileAll(fd, STDOUT_FILENO);
+				close(fd);
+			}
+			if(!succeeded)
+			{
+				perror((ErrorPrefix(CAT_COMMAND) + ": " + std::string{ argument }).c_str());
+				exitStatus = EXIT_FAILURE;
+			}
+		}
+		return exitStatus;
+	}
+	int ExecuteExport(const Command& command)
+	{
+		// No parameters lists the exported variables
+		if(command.arguments.empty())
+		{
+			for(char* const* variable = shellVariables.GetEnvp(); *variable; ++variable)
+			{
+				std::string_view entry{ *variable };
+				std::string_view::size_type equalsPos{ entry.find(ASSIGNMENT_CHAR) };
+				std::cout << EXPORT_COMMAND << ' ' << entry.substr(0, equalsPos) << ASSIGNMENT_CHAR;
+				Lex::WordLists::PrintWord(std::cout, entry.substr(equalsPos + 1), SPLIT_RULES);
+				std::cout << '\n';
+			}
+			return EXIT_SUCCESS;
+		}
+
+		// NAME=value sets and exports a variable, NAME exports it
+		int exitStatus{ EXIT_SUCCESS };
+		for(std::string_view argument : command.arguments)
+		{
+			std::string_view name{ argument.substr(0, argument.find(ASSIGNMENT_CHAR)) };
+			if(!Lex::Posix::Environment::IsValidName(name))
+			{
+				std::cerr << SHELL_NAME << ": " << EXPORT_COMMAND << ": \'" << argument << "\': not a valid name" << std::endl;
+				exitStatus = EXIT_FAILURE;
+				continue;
+			}
+			if(name.size() < argument.size())
+				shellVariables.Set(name, argument.substr(name.size() + 1));
+			shellVariables.Export(name);
+			OnVariableChanged(name);
+		}
+		return exitStatus;
+	}
+	int ExecuteUnset(const Command& command)
+	{
+		int exitStatus{ EXIT_SUCCESS };
+		for(std::string_view name : command.arguments)
+		{
+			if(!Lex::Posix::Environment::IsValidName(name))
+			{
+				std::cerr << SHELL_NAME << ": " << UNSET_COMMAND << ": \'" << name << "\': not a valid name" << std::endl;
+				exitStatus = EXIT_FAILURE;
+				continue;
+			}
+			shellVariables.Unset(name);
+			OnVariableChanged(name);
+		}
+		return exitStatus;
+	}
+	int ExecuteTime(const Command& command)
+	{
+		// time as a pipeline stage, or run by parallel
+		Pipeline pipeline;
+		pipeline.commands.push_back(command);
+		return ExecuteTimedPipeline(pipeline);
+	}
+	int ExecutePushDirectory(const Command& command)
+	{
+		// pushd dir: push the working directory, then cd dir. pushd: swap the working directory with the top.
+		if(command.arguments.size() > 1)
+		{
+			std::cerr << SHELL_NAME << ": " << PUSH_DIRECTORY_COMMAND << ": too many parameters" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::string workingDirectory;
+		if(!Lex::Posix::GetWorkingDirectory(workingDirectory))
+		{
+			perror(ErrorPrefix(PUSH_DIRECTORY_COMMAND).c_str());
+			return EXIT_FAILURE;
+		}
+		std::string newPath;
+		if(command.arguments.empty())
+		{
+			if(directoryStack.empty())
+			{
+				std::cerr << SHELL_NAME << ": " << PUSH_DIRECTORY_COMMAND << ": no other directory" << std::endl;
+				return EXIT_FAILURE;
+			}
+			newPath = directoryStack.back();
+		}
+		else
+		{
+			newPath = command.arguments[0];
+			ExpandDirectory(newPath);
+		}
+		if(!ChangeDirectory(newPath))
+			return EXIT_FAILURE;
+
+		if(command.arguments.empty())
+			directoryStack.back() = std::move(workingDirectory);
+		else
+			directoryStack.push_back(std::move(workingDirectory));
+		PrintDirectoryStack();
+		return EXIT_SUCCESS;
+	}
+	int ExecutePopDirectory(const Command& command)
+	{
+		if(!command.arguments.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << POP_DIRECTORY_COMMAND << ": too many parameters" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if(directoryStack.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << POP_DIRECTORY_COMMAND << ": directory stack empty" << std::endl;
+			return EXIT_FAILURE;
+		}
+		if(!ChangeDirectory(directoryStack.back()))
+			return EXIT_FAILURE;
+		directoryStack.pop_back();
+		PrintDirectoryStack();
+		return EXIT_SUCCESS;
+	}
+	int ExecuteDirectories(const Command& command)
+	{
+		if(command.arguments.size() == 1 && command.arguments[0] == DIRECTORIES_CLEAR_OPTION)
+		{
+			directoryStack.clear();
+			return EXIT_SUCCESS;
+		}
+		if(!command.arguments.empty())
+		{
+			std::cerr << SHELL_NAME << ": " << DIRECTORIES_COMMAND << ": usage: " << DIRECTORIES_COMMAND << " [" << DIRECTORIES_CLEAR_OPTION << ']' << std::endl;
+			return EXIT_FAILURE;
+		}
+		PrintDirectoryStack();
+		return EXIT_SUCCESS;
+	}
+	int ExecuteJump(const Command& command)
+	{
+		// z terms: cd to the highest ranked directory matching the terms. z -l [terms]: list matches, best last.
+		bool listOnly{ command.arguments.empty() || command.arguments[0] == JUMP_LIST_OPTION };
+		std::vector<std::string> terms;
+		for(auto argumentIt{ command.arguments.begin() + ((command.arguments.empty() || !listOnly) ? 0 : 1) }; 
+			argumentIt != command.arguments.end(); ++argumentIt)
+			if(!argumentIt->empty())
+				terms.push_back(FoldCase(*argumentIt));
+		OpenDirectoryFile();
+		UpdateDirectoryRanks();
+		std::int64_t now{ static_cast<std::int64_t>(std::time(nullptr)) };
+
+		std::vector<const DirectoryEntry*> entries;
+		FindDirectories(terms, entries);
+		if(listOnly)
+		{
+			std::vector<std::pair<double, std::string_view>> matches;
+			for(const DirectoryEntry* entry : entries)
+				matches.emplace_back(GetFrecency(entry->rank, now), entry->path);
+			std::sort(matches.begin(), matches.end());
+			for(const auto& [frecency, path] : matches)
+				std::cout << std::fixed << std::setprecision(1) << std::setw(10) << frecency << "  " << path << '\n';
+			std::cout << std::defaultfloat;
+			return EXIT_SUCCESS;
+		}
+
+		// Best match first; directories that are gone are skipped
+		std::vector<std::pair<double, const std::string*>> matches;
+		for(const DirectoryEntry* entry : entries)
+			matches.emplace_back(GetFrecency(entry->rank, now), &entry->path);
+		std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		for(const auto& match : matches)
+		{
+			struct stat status;
+			if(stat(match.second->c_str(), &status) == 0 && S_ISDIR(status.st_mode))
+				return ChangeDirectory(*match.second) ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+		std::cerr << SHELL_NAME << ": " << JUMP_COMMAND << ": no match for";
+		for(std::string_view argument : command.arguments)
+			std::cerr << ' ' << argument;
+		std::cerr << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	//+------------------------\----------------------------------
+	//|		  Redirection	   |
+	//\------------------------/----------------------------------
+	bool OpenRedirections(const Command& command, Lex::Posix::SpawnFileActionList& fileActionsOut, std::pmr::vector<int>& openedFdsOut)
+	{
+		// Files are opened by the shell so errors name the file, then dup2'd onto stdin/stdout in the child. 
+		// Nothing passes through the shell after that.
+		struct Redirection
+		{
+			std::string_view filename;
+			int flags;
+			int targetFd;
+		};
+		const int outputFlags{ O_WRONLY | O_CREAT | O_CLOEXEC | (command.outputAppend ? O_APPEND : O_TRUNC) };
+		for(const Redirection& redirection : { Redirection{ command.inputFilename, O_RDONLY | O_CLOEXEC, STDIN_FILENO },
+											   Redirection{ command.outputFilename, outputFlags, STDOUT_FILENO } })
+		{
+			if(redirection.filename.empty())
+				continue;
+
+			int fd{ open(redirection.filename.data(), redirection.flags, 0666) };
+			if(fd < 0)
+			{
+				perror(ErrorPrefix(redirection.filename).c_str());
+				CloseFds(openedFdsOut);
+				return false;
+			}
+			openedFdsOut.push_back(fd);
+			fileActionsOut.push_back(Lex::Posix::SpawnFileAction::Duplicate(fd, redirection.targetFd));
+		}
+		return true;
+	}
+	int ExecuteBuiltinWithRedirections(const Command& command)
+	{
+		Lex::Posix::SpawnFileActionList fileActions{ &lineArena };
+		std::pmr::vector<int> redirectionFds{ &lineArena };
+		if(!OpenRedirections(command, fileActions, redirectionFds))
+			return EXIT_FAILURE;
+
+		// Point the shell's own stdin/stdout at the files for the duration of the builtin
+		std::cout.flush();
+		std::vector<std::pair<int, int>> savedFds;
+		for(auto const& action : fileActions)
+		{
+			int savedFd{ fcntl(action.fd, F_DUPFD_CLOEXEC, 10) };
+			if(savedFd < 0 || dup2(action.sourceFd, action.fd) < 0)
+			{
+				perror((ErrorPrefix(command.name)).c_str());
+				if(savedFd >= 0)
+					close(savedFd);
+				break;
+			}
+			savedFds.emplace_back(savedFd, action.fd);
+		}
+		int exitStatus{ EXIT_FAILURE };
+		if(savedFds.size() == fileActions.size())
+			exitStatus = ExecuteCommand(command);
+
+		// Restore
+		std::cout.flush();
+		for(auto const& [savedFd, targetFd] : savedFds)
+		{
+			dup2(savedFd, targetFd);
+			close(savedFd);
+		}
+		CloseFds(redirectionFds);
+		return exitStatus;
+	}
+	void CloseFds(std::pmr::vector<int>& fds)
+	{
+		for(int fd : fds)
+			close(fd);
+		fds.clear();
+	}
+
+	//+------------------------\----------------------------------
+	//|	  Command Hash Table   |
+	//\------------------------/----------------------------------
+	HashedCommand* FindHashedCommand(std::string_view name, bool& wasHitOut)
+	{
+		ValidateCommandHashTable();
+
+		// Lookup key is reused so that a hit allocates nothing
+		static std::string key;
+		key.assign(name.data(), name.size());
+		auto foundIter{ commandHashTable.find(key) };
+		if(foundIter != commandHashTable.end())
+		{
+			wasHitOut = true;
+			++commandHashTableHits;
+			++foundIter->second.hits;
+			return &foundIter->second;
+		}
+
+		// Miss: search $PATH and remember the result
+		wasHitOut = false;
+		++commandHashTableMisses;
+		std::string path;
+		if(!Lex::Posix::FindExecutableInPath(key, commandHashTableSearchPath, path))
+			return nullptr;
+		HashedCommand& hashedCommand{ commandHashTable[key] };
+		hashedCommand.path = std::move(path);
+		hashedCommand.hits = 1;
+		return &hashedCommand;
+	}
+	void ForgetHashedCommand(std::string_view name)
+	{
+		commandHashTable.erase(std::string{ name });
+	}
+	void ValidateCommandHashTable()
+	{
+		// Every entry depends on $PATH, so a changed $PATH empties the table
+		const char* searchPath{ shellVariables.Get(PATH_VARIABLE) };
+		if(!searchPath)
+			searchPath = "";
+		if(commandHashTableSearchPath != searchPath)
+		{
+			commandHashTable.clear();
+			commandHashTableSearchPath = searchPath;
+		}
+	}
+	void PrintCommandHashTable()
+	{
+		ValidateCommandHashTable();
+		if(commandHashTable.empty())
+			std::cout << SHELL_NAME << ": " << HASH_COMMAND << ": hash table empty" << std::endl;
+		else
+		{
+			std::cout << "hits\tcommand" << std::endl;
+			for(auto const& [name, hashedCommand] : commandHashTable)
+				std::cout << hashedCommand.hits << "\t" << hashedCommand.path << std::endl;
+		}
+		std::cout << SHELL_NAME << ": " << HASH_COMMAND << ": " << commandHashTableHits << " hits, " 
+				  << commandHashTableMisses << " misses" << std::endl;
+	}
+
+	//+------------------------\----------------------------------
+	//|		    Parse		   |
+	//\------------------------/----------------------------------
+	void ExpandGlobs(Lex::WordLists::WordVector& wordList)
+	{
+		// Unquoted words with glob characters are replaced by the paths they match, or kept as they are if 
+		// nothing matches. Filenames after redirection operators are never expanded.
+		Lex::WordLists::WordVector::size_type firstGlob{ 0 };
+		while(firstGlob < wordList.size() && !IsGlobWord(wordList, firstGlob))
+			++firstGlob;
+		if(firstGlob == wordList.size())
+			return;
+
+		Lex::WordLists::WordVector expandedList{ wordList.begin(), wordList.begin() + firstGlob, syntaxArena };
+		std::vector<std::string> paths;
+		for(Lex::WordLists::WordVector::size_type i = firstGlob; i < wordList.size(); ++i)
+		{
+			if(!IsGlobWord(wordList, i) || !Lex::Posix::Glob(wordList[i].text, globDirectoryCache, paths))
+			{
+				expandedList.push_back(wordList[i]);
+				continue;
+			}
+			for(const std::string& path : paths)
+			{
+				char* text{ static_cast<char*>(syntaxArena->allocate(path.size() + 1, 1)) };
+				std::memcpy(text, path.c_str(), path.size() + 1);
+				expandedList.push_back(Lex::WordLists::Word{ std::string_view{ text, path.size() }, false, true });
+			}
+		}
+		globDirectoryCache.Clear();
+		wordList = std::move(expandedList);
+	}
+	bool IsGlobWord(const Lex::WordLists::WordVector& wordList, Lex::WordLists::WordVector::size_type index)
+	{
+		// Unquoted, not an operator nor the filename after a redirection operator, and has glob characters
+		auto isRedirection{ [](const Lex::WordLists::Word& word) {
+			return word.isOperator && (word.text == REDIRECT_INPUT_OPERATOR || 
+				   word.text == REDIRECT_OUTPUT_OPERATOR || word.text == REDIRECT_OUTPUT_APPEND_OPERATOR);
+		} };
+		const Lex::WordLists::Word& word{ wordList[index] };
+		return !word.isOperator && !word.quoted && (index == 0 || !isRedirection(wordList[index - 1])) && 
+			   Lex::Strings::HasGlobChars(word.text);
+	}
+	bool SeparateIntoCommands(const Lex::WordLists::WordVector& wordList, CommandList& commandListOut)
+	{
+		// Go word by word, adding words to the current command, commands to the current pipeline,
+		// pipelines to the current and-or list, and and-or lists to the command list
+		commandListOut.clear();
+		AndOrList andOrList;
+		Pipeline pipeline;
+		Command command;
+		std::string_view redirectionOperator;
+		auto printSyntaxError = [](std::string_view nearWord) {
+			std::cerr << SHELL_NAME << ": syntax error near \'" << nearWord << '\'' << std::endl;
+		};
+		for(Lex::WordLists::WordVector::size_type currentWord = 0; currentWord <= wordList.size(); ++currentWord)
+		{
+			// End of input finishes the last and-or list like a command separator. Quoted operators are plain words.
+			bool isEnd{ currentWord == wordList.size() };
+			std::string_view word{ isEnd ? std::string_view{ COMMAND_SEPARATOR } : wordList[currentWord].text };
+			bool isOperator{ isEnd || wordList[currentWord].isOperator };
+			bool isListSeparator{ isOperator && (word == COMMAND_SEPARATOR || word == BACKGROUND_OPERATOR) };
+			bool isConnector{ isOperator && (word == AND_OPERATOR || word == OR_OPERATOR) };
+			bool isRedirection{ isOperator && (word == REDIRECT_INPUT_OPERATOR || 
+								word == REDIRECT_OUTPUT_OPERATOR || word == REDIRECT_OUTPUT_APPEND_OPERATOR) };
+
+			// Word after a redirection operator is its filename
+			if(!redirectionOperator.empty())
+			{
+				if(isOperator)
+				{
+					printSyntaxError(isEnd ? redirectionOperator : word);
+					return false;
+				}
+				if(redirectionOperator == REDIRECT_INPUT_OPERATOR)
+					command.inputFilename = word;
+				else
+				{
+					command.outputFilename = word;
+					command.outputAppend = (redirectionOperator == REDIRECT_OUTPUT_APPEND_OPERATOR);
+				}
+				redirectionOperator = {};
+			}
+			else if(isListSeparator || isConnector)
+			{
+				// Finish command. Empty commands are skipped, but a piping operator must be followed by a command.
+				if(!command.name.empty())
+					pipeline.commands.push_back(std::move(command));
+				else if(!pipeline.commands.empty())
+				{
+					printSyntaxError(isEnd ? PIPING_OPERATOR : word);
+					return false;
+				}
+				command = Command{};
+
+				// Finish pipeline. A connector needs a pipeline on both sides.
+				if(isConnector)
+				{
+					if(pipeline.commands.empty())
+					{
+						printSyntaxError(word);
+						return false;
+					}
+					andOrList.pipelines.push_back(std::move(pipeline));
+					andOrList.connectors.push_back(word == AND_OPERATOR ? AndOrList::Connector::And : AndOrList::Connector::Or);
+				}
+				else
+				{
+					if(pipeline.commands.empty() && (!andOrList.connectors.empty() || word == BACKGROUND_OPERATOR))
+					{
+						printSyntaxError(isEnd ? (andOrList.connectors.back() == AndOrList::Connector::And ? AND_OPERATOR : OR_OPERATOR) : word);
+						return false;
+					}
+					if(!pipeline.commands.empty())
+						andOrList.pipelines.push_back(std::move(pipeline));
+
+					// Finish and-or list. Background operator applies to the whole list.
+					if(!andOrList.pipelines.empty())
+					{
+						andOrList.background = (word == BACKGROUND_OPERATOR);
+						commandListOut.push_back(std::move(andOrList));
+					}
+					andOrList = AndOrList{};
+				}
+				pipeline = Pipeline{};
+			}
+			else if(isOperator && word == PIPING_OPERATOR)
+			{
+				// A piping operator must be preceded by a command
+				if(command.name.empty())
+				{
+					printSyntaxError(PIPING_OPERATOR);
+					return false;
+				}
+				pipeline.commands.push_back(std::move(command));
+				command = Command{};
+			}
+			else if(isRedirection)
+				redirectionOperator = word;
+			else if(command.name.empty())
+				command.name = word;
+			else
+				command.arguments.emplace_back(word);
+		}
+		return true;
+	}
+	bool StringToCommandListIndex(std::string_view str, CommandListIndex& out)
+	{
+		static_assert(sizeof(CommandListIndex) >= sizeof(int));
+		int numCommandsInt;
+
+		if(Lex::Strings::ToInt(str, numCommandsInt) && numCommandsInt >= 0)
+		{
+			out = static_cast<CommandListIndex>(numCommandsInt);
+			return true;
+		}
+		else
+			return false;
+	}
+
+
+	//+------------------------\----------------------------------
+	//|		   Variables	   |
+	//\------------------------/----------------------------------
+	bool ExpandParameters(const Pipeline& pipeline, Pipeline& expandedOut)
+	{
+		bool found{ false };
+		for(const Command& command : pipeline.commands)
+			found = found || HasExpansions(command.name) || HasExpansions(command.inputFilename) || 
+					HasExpansions(command.outputFilename) || std::any_of(command.arguments.begin(), command.arguments.end(), HasExpansions);
+		if(!found)
+			return false;
+
+		// Expanded words go into the line arena, '\0'-terminated like the others. 
+		// Leading NAME=value words and filenames are not split into fields.
+		expandedOut = pipeline;
+		Lex::WordLists::WordList fields{ &lineArena };
+		for(Command& command : expandedOut.commands)
+		{
+			bool inAssignments{ IsAssignment(command.name) };
+			fields.clear();
+			ExpandWord(command.name, !inAssignments, fields);
+			for(std::string_view argument : command.arguments)
+			{
+				inAssignments = inAssignments && IsAssignment(argument);
+				ExpandWord(argument, !inAssignments, fields);
+			}
+
+			// A name that expands to nothing leaves the first argument as the name
+			command.name = fields.empty() ? std::string_view{} : fields[0];
+			command.arguments.assign(fields.begin() + (fields.empty() ? 0 : 1), fields.end());
+			for(std::string_view* filename : { &command.inputFilename, &command.outputFilename })
+			{
+				if(!HasExpansions(*filename))
+					continue;
+				fields.clear();
+				ExpandWord(*filename, false, fields);
+				*filename = fields.empty() ? std::string_view{} : fields[0];
+			}
+		}
+		return true;
+	}
+	bool HasExpansions(std::string_view word)
+	{
+		const char marks[]{ Lex::WordLists::EXPANSION_MARK, Lex::WordLists::QUOTED_EXPANSION_MARK, '\0' };
+		return word.find_first_of(marks) != std::string_view::npos;
+	}
+	void ExpandWord(std::string_view word, bool splitFields, Lex::WordLists::WordList& fieldsOut)
+	{
+		// Unquoted expansions are split into fields at whitespace, joined to the text on either side. 
+		// A word of only unquoted expansions that expand to nothing is dropped.
+		std::string field;
+		bool keepField{ false };
+		auto finishField{ [&field, &keepField, &fieldsOut]() {
+			if(keepField)
+			{
+				char* text{ static_cast<char*>(lineArena.allocate(field.size() + 1, 1)) };
+				std::memcpy(text, field.c_str(), field.size() + 1);
+				fieldsOut.emplace_back(text, field.size());
+			}
+			field.clear();
+			keepField = false;
+		} };
+		std::string value;
+		for(std::string_view::size_type i = 0; i < word.size(); )
+		{
+			char mark{ word[i] };
+			if(mark != Lex::WordLists::EXPANSION_MARK && mark != Lex::WordLists::QUOTED_EXPANSION_MARK)
+			{
+				field += word[i++];
+				keepField = true;
+				continue;
+			}
+			i = ExpandParameter(word, i + 1, value);
+			if(!splitFields || mark == Lex::WordLists::QUOTED_EXPANSION_MARK)
+			{
+				field += value;
+				keepField = true;
+				continue;
+			}
+			for(char c : value)
+			{
+				if(WHITESPACE_CHARS.find(c) != std::string::npos || c == '\n')
+					finishField();
+				else
+				{
+					field += c;
+					keepField = true;
+				}
+			}
+		}
+		finishField();
+	}
+	std::string_view::size_type ExpandParameter(std::string_view word, std::string_view::size_type start, std::string& valueOut)
+	{
+		// Expands the parameter at word[start], just after a mark. Returns the index after it.
+		valueOut.clear();
+		if(word[start] == '(')
+		{
+			std::string_view::size_type end{ word.find(Lex::WordLists::SUBSTITUTION_END_MARK, start) };
+			SubstituteCommand(std::string{ word.substr(start + 1, end - start - 1) }, valueOut);
+			return end + 1;
+		}
+		if(word[start] == LAST_EXIT_STATUS_PARAMETER)
+		{
+			valueOut = std::to_string(lastExitStatus);
+			return start + 1;
+		}
+		if(word[start] == SHELL_PID_PARAMETER)
+		{
+			valueOut = std::to_string(getpid());
+			return start + 1;
+		}
+
+		// ${NAME} or $NAME. A ${ without a valid name and } is kept as it is.
+		std::string_view name;
+		std::string_view::size_type end;
+		if(word[start] == '{')
+		{
+			end = word.find('}', start);
+			name = word.substr(start + 1, (end == std::string_view::npos) ? 0 : end - start - 1);
+			if(!Lex::Posix::Environment::IsValidName(name))
+			{
+				valueOut = EXPANSION_CHAR;
+				return start;
+			}
+			++end;
+		}
+		else
+		{
+			end = start;
+			while(end < word.size() && (std::isalnum(static_cast<unsigned char>(word[end])) || word[end] == '_'))
+				++end;
+			name = word.substr(start, end - start);
+		}
+		if(const char* value{ shellVariables.Get(name) })
+			valueOut = value;
+		return end;
+	}
+	bool SubstituteCommand(const std::string& commandText, std::string& outputOut)
+	{
+		// A child shell runs the command with its output going to a pipe. The output is read straight into 
+		// outputOut's own buffer, which only grows when full, then trailing newlines are dropped.
+		outputOut.clear();
+		int readFd;
+		int writeFd;
+		if(!Lex::Posix::CreatePipe(readFd, writeFd))
+		{
+			perror(ErrorPrefix(EXPANSION_CHAR + std::string{ "(" }).c_str());
+			return false;
+		}
+		std::cout.flush();
+		pid_t childPid;
+		bool forked{ Lex::Posix::ForkAndRun([&commandText]() {
+			interactive = false;
+			CommandList commandList{ &lineArena };
+			int exitStatus{ EXIT_STATUS_SYNTAX_ERROR };
+			if(ParseLine(commandText, true, commandList))
+				ExecuteCommandList(commandList, exitStatus);
+			std::cout.flush();
+			return exitStatus;
+		}, { Lex::Posix::SpawnFileAction::Duplicate(writeFd, STDOUT_FILENO) }, childPid, SHELL_NAME) };
+		close(writeFd);
+		if(!forked)
+		{
+			close(readFd);
+			return false;
+		}
+
+		const std::string::size_type MIN_BUFFER_SIZE{ 4096 };
+		std::string::size_type used{ 0 };
+		outputOut.resize(std::max(outputOut.capacity(), MIN_BUFFER_SIZE));
+		while(true)
+		{
+			if(used == outputOut.size())
+				outputOut.resize(2 * outputOut.size());
+			ssize_t bytesRead{ read(readFd, outputOut.data() + used, outputOut.size() - used) };
+			if(bytesRead > 0)
+				used += static_cast<std::string::size_type>(bytesRead);
+			else if(bytesRead == 0 || errno != EINTR)
+				break;
+		}
+		close(readFd);
+		while(used > 0 && outputOut[used - 1] == '\n')
+			--used;
+		outputOut.resize(used);
+
+		int status;
+		if(Lex::Posix::WaitForChild(childPid, status, SHELL_NAME))
+			lastExitStatus = Lex::Posix::WaitStatusToExitStatus(status);
+		return true;
+	}
+	bool IsAssignment(std::string_view word)
+	{
+		std::string_view::size_type equalsPos{ word.find(ASSIGNMENT_CHAR) };
+		return equalsPos != std::string_view::npos && Lex::Posix::Environment::IsValidName(word.substr(0, equalsPos));
+	}
+	int ExecuteAssignments(const Command& command)
+	{
+		// NAME=value [NAME=value ...] sets shell variables, exported only if they already were
+		if(!std::all_of(command.arguments.begin(), command.arguments.end(), IsAssignment))
+		{
+			std::cerr << SHELL_NAME << ": " << command.name << ": variables can't be set for one command" << std::endl;
+			return EXIT_FAILURE;
+		}
+		auto assign{ [](std::string_view assignment) {
+			std::string_view::size_type equalsPos{ assignment.find(ASSIGNMENT_CHAR) };
+			shellVariables.Set(assignment.substr(0, equalsPos), assignment.substr(equalsPos + 1));
+			OnVariableChanged(assignment.substr(0, equalsPos));
+		} };
+		assign(command.name);
+		std::for_each(command.arguments.begin(), command.arguments.end(), assign);
+		return EXIT_SUCCESS;
+	}
+	void OnVariableChanged(std::string_view name)
+	{
+		if(name == PATH_VARIABLE)
+			NotifyPathChanged();
+		InvalidatePrompt();
+	}
+
+	//+------------------------\----------------------------------
+	//|		   Directory	   |
+	//\------------------------/----------------------------------
+	bool ChangeDirectory(const std::string& path)
+	{
+		// Save current
+		if(!Lex::Posix::GetWorkingDirectory(lastWorkingDirectory))
+			std::cerr << SHELL_NAME << ": Failed to save current working directory" << std::endl;
+
+		// Change to new
+		if(!Lex::Posix::ChangeWorkingDirectory(path))
+		{
+			std::cerr << SHELL_NAME << ": Failed to change current working directory to \'" << path << '\'' << std::endl;
+			return false;
+		}
+		InvalidatePrompt();
+
+		// Only directories the user goes to count: not those of scripts, -c or subshells
+		if(interactive && !inForkedChild)
+			RecordDirectoryVisit();
+		return true;
+	}
+	void ExpandDirectory(std::string& path)
+	{
+		// If no directory specified, change to root directory
+		if(path.empty())
+			path = "/";
+
+		// Expand ~ to home directory
+		if(path[0] == '~')
+		{
+			std::string home;
+			if(!Lex::Posix::GetHomeDirectory(shellVariables, home))
+			{
+				std::cerr << SHELL_NAME << ": ~: Failed to find home directory" << std::endl;
+				return;
+			}
+			path.replace(0, 1, home);
+		}
+	}
+	void PrintDirectoryStack()
+	{
+		// Working directory, then the stack from the top
+		std::string workingDirectory;
+		if(!Lex::Posix::GetWorkingDirectory(workingDirectory))
+			workingDirectory = ".";
+		std::cout << workingDirectory;
+		for(auto directoryIt{ directoryStack.rbegin() }; directoryIt != directoryStack.rend(); ++directoryIt)
+			std::cout << ' ' << *directoryIt;
+		std::cout << '\n';
+	}
+	void OpenDirectoryFile()
+	{
+		// $LESH_DIRECTORY_FILE, or ~/.lesh_directories if unset. Set but empty means ranks are kept for this session only.
+		if(directoryFileOpened)
+			return;
+		directoryFileOpened = true;
+		const char* pathVariable{ shellVariables.Get(DIRECTORY_FILE_VARIABLE) };
+		if(pathVariable)
+			directoryFilePath = pathVariable;
+		else if(Lex::Posix::GetHomeDirectory(shellVariables, directoryFilePath))
+			directoryFilePath += '/' + DIRECTORY_FILE_DEFAULT_NAME;
+		if(directoryFilePath.empty())
+			return;
+
+		if(!directoryFile.Open(directoryFilePath))
+			perror((SHELL_NAME + ": " + directoryFilePath).c_str());
+	}
+	void RecordDirectoryVisit()
+	{
+		std::string workingDirectory;
+		if(!Lex::Posix::GetWorkingDirectory(workingDirectory))
+			return;
+		DirectoryRank visit{ 1, static_cast<std::int64_t>(std::time(nullptr)) };
+
+		// With a file the visit is counted when it is read back, along with other sessions' visits
+		OpenDirectoryFile();
+		if(!directoryFile.IsOpen())
+		{
+			AddDirectoryRank(workingDirectory, visit);
+			return;
+		}
+
+		// Ranks are read back once, after the append. Only a file another session replaced is reopened first.
+		if(!directoryFile.IsFileAt(directoryFilePath))
+			UpdateDirectoryRanks();
+		if(!directoryFile.Append(EncodeDirectoryRecord(workingDirectory, visit)))
+		{
+			perror((SHELL_NAME + ": " + directoryFilePath).c_str());
+			directoryFile.Close();
+			AddDirectoryRank(workingDirectory, visit);
+			return;
+		}
+		UpdateDirectoryRanks();
+		if(directoryFileRecordCount >= DIRECTORY_FILE_MIN_COMPACT_RECORDS && 
+		   (directoryFileRecordCount > 2 * directoryEntries.size() || directoryRankTotal > DIRECTORY_RANK_MAX_TOTAL))
+			CompactDirectoryFile();
+	}
+	void UpdateDirectoryRanks()
+	{
+		if(!directoryFile.IsOpen())
+			return;
+
+		// Another session compacted the file: start over from the new one
+		if(!directoryFile.IsFileAt(directoryFilePath))
+		{
+			if(!directoryFile.Open(directoryFilePath))
+				return;
+			ClearDirectoryRanks();
+			directoryFileScanOffset = 0;
+			directoryFileRecordCount = 0;
+		}
+
+		// Records are appended only, so only those past the scan offset are new
+		directoryFile.Refresh();
+		std::string_view record;
+		Lex::Posix::AppendOnlyRecordFile::Offset recordStart;
+		for(auto end{ directoryFile.End() }; end > directoryFileScanOffset && directoryFile.GetRecordBefore(end, record, recordStart); end = recordStart)
+		{
+			std::string_view path;
+			DirectoryRank rank;
+			if(DecodeDirectoryRecord(record, path, rank))
+				AddDirectoryRank(path, rank);
+			++directoryFileRecordCount;
+		}
+		directoryFileScanOffset = directoryFile.End();
+	}
+	void AddDirectoryRank(std::string_view path, const DirectoryRank& rank)
+	{
+		auto [indexIt, isNew]{ directoryEntryIndex.try_emplace(std::string{ path }, directoryEntries.size()) };
+		if(isNew)
+		{
+			directoryEntries.push_back(DirectoryEntry{ std::string{ path }, DirectoryRank{}, foldedDirectoryPaths.size() });
+			foldedDirectoryPaths += FoldCase(path);
+			foldedDirectoryPaths += '\0';
+		}
+		DirectoryRank& entryRank{ directoryEntries[indexIt->second].rank };
+		entryRank.rank += rank.rank;
+		entryRank.lastVisit = std::max(entryRank.lastVisit, rank.lastVisit);
+		directoryRankTotal += rank.rank;
+	}
+	void ClearDirectoryRanks()
+	{
+		directoryEntries.clear();
+		directoryEntryIndex.clear();
+		foldedDirectoryPaths.clear();
+		directoryRankTotal = 0;
+	}
+	void FindDirectories(const std::vector<std::string>& foldedTerms, std::vector<const DirectoryEntry*>& entriesOut)
+	{
+		entriesOut.clear();
+		if(foldedTerms.empty())
+		{
+			for(const DirectoryEntry& entry : directoryEntries)
+				entriesOut.push_back(&entry);
+			return;
+		}
+
+		// Every match holds the last term, so search all paths for it at once and check each entry hit
+		const std::string& lastTerm{ foldedTerms.back() };
+		std::boyer_moore_horspool_searcher searcher{ lastTerm.begin(), lastTerm.end() };
+		std::string_view paths{ foldedDirectoryPaths };
+		for(auto hitIt{ std::search(paths.begin(), paths.end(), searcher) }; hitIt != paths.end(); 
+			hitIt = std::search(hitIt, paths.end(), searcher))
+		{
+			std::string::size_type hit{ static_cast<std::string::size_type>(hitIt - paths.begin()) };
+			auto entryIt{ std::partition_point(directoryEntries.begin(), directoryEntries.end(), 
+				[hit](const DirectoryEntry& entry) { return entry.foldedStart <= hit; }) - 1 };
+			if(MatchesDirectory(paths.substr(entryIt->foldedStart, entryIt->path.size()), foldedTerms))
+				entriesOut.push_back(&*entryIt);
+			hitIt = paths.begin() + entryIt->foldedStart + entryIt->path.size() + 1;
+		}
+	}
+	void CompactDirectoryFile()
+	{
+		// Once ranks add up past the maximum, all are scaled down so newer visits count for more, 
+		// and directories that fall under one visit are forgotten
+		double scale{ (directoryRankTotal > DIRECTORY_RANK_MAX_TOTAL) ? 0.9 * DIRECTORY_RANK_MAX_TOTAL / directoryRankTotal : 1 };
+		std::vector<DirectoryEntry> entries{ std::move(directoryEntries) };
+		ClearDirectoryRanks();
+		std::vector<std::string> records;
+		records.reserve(entries.size());
+		for(DirectoryEntry& entry : entries)
+		{
+			entry.rank.rank *= scale;
+			if(entry.rank.rank < 1)
+				continue;
+			AddDirectoryRank(entry.path, entry.rank);
+			records.push_back(EncodeDirectoryRecord(entry.path, entry.rank));
+		}
+
+		// Written beside the file, then renamed over it so readers never see it half written. 
+		// Visits other sessions append between our last read and the rename are lost.
+		std::string newPath{ directoryFilePath + ".new" };
+		unlink(newPath.c_str());
+		Lex::Posix::AppendOnlyRecordFile newFile;
+		if(!newFile.Open(newPath) || !newFile.Append(records) || rename(newPath.c_str(), directoryFilePath.c_str()) != 0)
+		{
+			perror((SHELL_NAME + ": " + newPath).c_str());
+			unlink(newPath.c_str());
+			return;
+		}
+		newFile.Close();
+		if(!directoryFile.Open(directoryFilePath))
+			perror((SHELL_NAME + ": " + directoryFilePath).c_str());
+		directoryFileScanOffset = directoryFile.End();
+		directoryFileRecordCount = records.size();
+	}
+	std::string EncodeDirectoryRecord(std::string_view path, const DirectoryRank& rank)
+	{
+		// rank, lastVisit, path
+		std::string record(sizeof(rank.rank) + sizeof(rank.lastVisit), '\0');
+		std::memcpy(record.data(), &rank.rank, sizeof(rank.rank));
+		std::memcpy(record.data() + sizeof(rank.rank), &rank.lastVisit, sizeof(rank.lastVisit));
+		record += path;
+		return record;
+	}
+	bool DecodeDirectoryRecord(std::string_view record, std::string_view& pathOut, DirectoryRank& rankOut)
+	{
+		const std::size_t HEADER_SIZE{ sizeof(rankOut.rank) + sizeof(rankOut.lastVisit) };
+		if(record.size() <= HEADER_SIZE)
+			return false;
+		std::memcpy(&rankOut.rank, record.data(), sizeof(rankOut.rank));
+		std::memcpy(&rankOut.lastVisit, record.data() + sizeof(rankOut.rank), sizeof(rankOut.lastVisit));
+		pathOut = record.substr(HEADER_SIZE);
+		return rankOut.rank > 0;
+	}
+	double GetFrecency(const DirectoryRank& rank, std::int64_t now)
+	{
+		// Visits weighted by how long ago the last one was
+		const std::int64_t HOUR{ 60 * 60 };
+		std::int64_t age{ now - rank.lastVisit };
+		if(age < HOUR)
+			return rank.rank * 4;
+		if(age < 24 * HOUR)
+			return rank.rank * 2;
+		if(age < 7 * 24 * HOUR)
+			return rank.rank / 2;
+		return rank.rank / 4;
+	}
+	bool MatchesDirectory(std::string_view foldedPath, const std::vector<std::string>& foldedTerms)
+	{
+		// Terms appear in order, and the last one is in the directory's own name
+		std::string_view::size_type searchFrom{ 0 };
+		for(std::vector<std::string>::size_type i = 0; i + 1 < foldedTerms.size(); ++i)
+		{
+			std::string_view::size_type found{ foldedPath.find(foldedTerms[i], searchFrom) };
+			if(found == std::string_view::npos)
+				return false;
+			searchFrom = found + foldedTerms[i].size();
+		}
+		if(foldedTerms.empty())
+			return true;
+		const std::string& lastTerm{ foldedTerms.back() };
+		std::string_view::size_type found{ foldedPath.rfind(lastTerm) };
+		return found != std::string_view::npos && found >= searchFrom && 
+			   found + lastTerm.size() > foldedPath.rfind('/') + 1;
+	}
+	std::string FoldCase(std::string_view text)
+	{
+		std::string folded{ text };
+		for(char& c : folded)
+			if(c >= 'A' && c <= 'Z')
+				c = static_cast<char>(c - 'A' + 'a');
+		return folded;
+	}
+
+	//+------------------------\----------------------------------
+	//|		    Print		   |
+	//\------------------------/----------------------------------
+	void PrintPrompt()
+	{
+		if(!promptValid)
+			RenderPrompt();
+
+		// Output still buffered by the shell goes first, then the whole prompt in one write
+		std::cout.flush();
+		Lex::Posix::WriteAll(STDOUT_FILENO, promptText.data(), promptText.size());
+	}
+	void PrintHistory(CommandListIndex numCommands)
+	{
+		// Print history list in reverse so that most recent command is printed last
+		std::vector<std::string_view> entries;
+		GetHistoryEntries(numCommands, entries);
+		if(entries.empty())
+		{
+			std::cout << SHELL_NAME << ": " << DISPLAY_HISTORY_COMMAND << ": empty" << std::endl;
+			return;
+		}
+		for(CommandListIndex i{ entries.size() }; i > 0; --i)
+			std::cout << SHELL_NAME << ": ! " << i << ": " << entries[i - 1] << '\n';
+		std::cout.flush();
+	}
+
+	//+------------------------\----------------------------------
+	//|		    Prompt		   |
+	//\------------------------/----------------------------------
+	void InvalidatePrompt()
+	{
+		// Call after changing the working directory or the environment
+		promptValid = false;
+	}
+	void CompilePromptFormat(const std::string& format)
+	{
+		// Consecutive literal characters share one text segment
+		promptSegments.clear();
+		auto addText = [](char c) {
+			if(promptSegments.empty() || promptSegments.back().type != PromptSegment::Type::Text)
+				promptSegments.emplace_back();
+			promptSegments.back().text += c;
+		};
+		for(std::string::size_type i = 0; i < format.size(); ++i)
+		{
+			if(format[i] != PROMPT_ESCAPE_CHAR || i + 1 == format.size())
+			{
+				addText(format[i]);
+				continue;
+			}
+			switch(format[++i])
+			{
+			case 'u': promptSegments.push_back(PromptSegment{ PromptSegment::Type::User, {} }); break;
+			case 'h': promptSegments.push_back(PromptSegment{ PromptSegment::Type::Host, {} }); break;
+			case 'w': promptSegments.push_back(PromptSegment{ PromptSegment::Type::WorkingDirectory, {} }); break;
+			case 'W': promptSegments.push_back(PromptSegment{ PromptSegment::Type::WorkingDirectoryName, {} }); break;
+			case 's': for(char c : SHELL_NAME) addText(c); break;
+			case '$': addText(geteuid() == 0 ? '#' : '$'); break;
+			case 'e': addText('\033'); break;
+			case 'n': addText('\n'); break;
+			case PROMPT_ESCAPE_CHAR: addText(PROMPT_ESCAPE_CHAR); break;
+			default: addText(PROMPT_ESCAPE_CHAR); addText(format[i]); break;
+			}
+		}
+		promptFormat = format;
+	}
+	void RenderPrompt()
+	{
+		// $LESH_PS1 is compiled again only when it changes
+		const char* formatVariable{ shellVariables.Get(PROMPT_FORMAT_VARIABLE) };
+		const std::string format{ formatVariable ? std::string{ formatVariable } : DEFAULT_PROMPT_FORMAT };
+		if(format != promptFormat || promptSegments.empty())
+			CompilePromptFormat(format);
+
+		promptText.clear();
+		std::string workingDirectory;
+		for(const PromptSegment& segment : promptSegments)
+		{
+			switch(segment.type)
+			{
+			case PromptSegment::Type::Text:
+				promptText += segment.text;
+				break;
+			case PromptSegment::Type::User:
+			{
+				std::string user;
+				if(Lex::Posix::GetUser(shellVariables, user))
+					promptText += user;
+				break;
+			}
+			case PromptSegment::Type::Host:
+			{
+				char host[256]{};
+				if(gethostname(host, sizeof(host) - 1) == 0)
+					promptText += host;
+				break;
+			}
+			case PromptSegment::Type::WorkingDirectory:
+			case PromptSegment::Type::WorkingDirectoryName:
+				if(workingDirectory.empty() && !Lex::Posix::GetWorkingDirectory(workingDirectory))
+					break;
+				if(segment.type == PromptSegment::Type::WorkingDirectory || workingDirectory == "/")
+					promptText += workingDirectory;
+				else
+					promptText += workingDirectory.substr(workingDirectory.find_last_of('/') + 1);
+				break;
+			}
+		}
+		promptValid = true;
+	}
+
+	//+------------------------\----------------------------------
+	//|		    History		   |
+	//\------------------------/----------------------------------
+	void OpenHistoryFile()
+	{
+		// $LESH_HISTORY_FILE, or ~/.lesh_history if unset. Set but empty means history is not saved.
+		std::string path;
+		const char* pathVariable{ shellVariables.Get(HISTORY_FILE_VARIABLE) };
+		if(pathVariable)
+			path = pathVariable;
+		else if(Lex::Posix::GetHomeDirectory(shellVariables, path))
+			path += '/' + HISTORY_FILE_DEFAULT_NAME;
+		else
+			return;
+		if(path.empty())
+			return;
+
+		if(!historyFile.Open(path))
+			perror((SHELL_NAME + ": " + path).c_str());
+		historyFileScanOffset = historyFile.End();
+	}
+	void RecordHistory(const std::string& text)
+	{
+		// Skip repeats of this session's last entry. Older duplicates are skipped when reading.
+		const std::string* lastEntryPtr{ commandHistory.Get(0) };
+		if(lastEntryPtr && *lastEntryPtr == text)
+			return;
+		commandHistory.AddToFront(text);
+		historyLines.Insert(text);
+
+		if(historyFile.IsOpen() && !historyFile.Append(text))
+		{
+			perror((SHELL_NAME + ": history file").c_str());
+			historyFile.Close();
+		}
+	}
+	void GetHistoryEntries(CommandListIndex count, std::vector<std::string_view>& entriesOut)
+	{
+		// Up to count unique entries, newest first
+		entriesOut.clear();
+		if(count > HISTORY_MAX_SIZE)
+			count = HISTORY_MAX_SIZE;
+
+		// Without a history file, only this session's history
+		if(!historyFile.IsOpen())
+		{
+			for(CommandListIndex i{ 0 }; i < count && i < commandHistory.Size(); ++i)
+				entriesOut.push_back(*commandHistory.Get(i));
+			return;
+		}
+		RefreshHistoryFile();
+
+		// Walk back only as far as needed
+		std::string_view record;
+		Lex::Posix::AppendOnlyRecordFile::Offset recordStart;
+		while(historyFileEntries.size() < count && 
+			  historyFile.GetRecordBefore(historyFileScanOffset, record, recordStart))
+		{
+			historyFileScanOffset = recordStart;
+			if(historyFileEntrySet.insert(record).second)
+				historyFileEntries.push_back(record);
+		}
+		if(historyFileEntries.size() < count)
+			historyFileScanOffset = 0;
+		entriesOut.assign(historyFileEntries.begin(), 
+						  historyFileEntries.begin() + std::min(count, historyFileEntries.size()));
+	}
+	void RefreshHistoryFile()
+	{
+		// Records appended by any session: entries found so far view the old mapping, so start over from the new end
+		if(historyFile.Refresh())
+		{
+			historyFileEntries.clear();
+			historyFileEntrySet.clear();
+			historyFileScanOffset = historyFile.End();
+		}
+	}
+	void UpdateHistorySearchIndex()
+	{
+		RefreshHistoryFile();
+		using Offset = Lex::Posix::AppendOnlyRecordFile::Offset;
+		const Offset indexedEnd{ historySearchRecordEnds.empty() ? 0 : historySearchRecordEnds.back() };
+		if(historyFile.End() <= indexedEnd)
+			return;
+
+		// New records are found newest first, and indexed oldest first
+		std::vector<std::pair<Offset, std::string_view>> newRecords;
+		std::string_view record;
+		Offset recordStart;
+		for(Offset end{ historyFile.End() }; end > indexedEnd && historyFile.GetRecordBefore(end, record, recordStart); end = recordStart)
+			newRecords.emplace_back(end, record);
+		for(auto recordIt{ newRecords.rbegin() }; recordIt != newRecords.rend(); ++recordIt)
+		{
+			historySearchIndex.Add(static_cast<Lex::Lists::TrigramIndex::Id>(historySearchRecordEnds.size()), recordIt->second);
+			historySearchRecordEnds.push_back(recordIt->first);
+		}
+	}
+	bool SearchHistory(std::string_view query, std::size_t before, std::size_t& positionOut, std::string& entryOut)
+	{
+		// Without a history file, this session's history is short enough to scan. Positions count back from the newest.
+		if(!historyFile.IsOpen())
+		{
+			for(CommandListIndex i{ before == Lex::Console::LineEditor::NO_POSITION ? 0 : before + 1 }; i < commandHistory.Size(); ++i)
+			{
+				const std::string* entryPtr{ commandHistory.Get(i) };
+				if(entryPtr && entryPtr->find(query) != std::string::npos)
+				{
+					positionOut = i;
+					entryOut = *entryPtr;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Positions are record ids
+		UpdateHistorySearchIndex();
+		using Id = Lex::Lists::TrigramIndex::Id;
+		Id beforeId{ before == Lex::Console::LineEditor::NO_POSITION ? static_cast<Id>(historySearchRecordEnds.size()) : static_cast<Id>(before) };
+		std::string_view record;
+		auto isMatch = [&query, &record](Id id) {
+			Lex::Posix::AppendOnlyRecordFile::Offset recordStart;
+			return historyFile.GetRecordBefore(historySearchRecordEnds[id], record, recordStart) && 
+				   record.find(query) != std::string_view::npos;
+		};
+		Id id;
+		if(!historySearchIndex.FindBefore(query, beforeId, isMatch, id))
+			return false;
+		positionOut = id;
+		entryOut = record;
+		return true;
+	}
+
+	//+------------------------\----------------------------------
+	//|		  Completion	   |
+	//\------------------------/----------------------------------
+	void StartPathCommandsThread()
+	{
+		pathCommandsWakeFd = eventfd(0, EFD_CLOEXEC);
+		if(pathCommandsWakeFd < 0)
+		{
+			perror((SHELL_NAME + ": completion").c_str());
+			return;
+		}
+		const char* searchPath{ shellVariables.Get(PATH_VARIABLE) };
+		pathCommandsSearchPath = searchPath ? searchPath : "";
+		pathCommandsThread = std::thread{ WatchPathCommands };
+	}
+	void StopPathCommandsThread()
+	{
+		if(!pathCommandsThread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+			pathCommandsStop = true;
+		}
+		const std::uint64_t wake{ 1 };
+		Lex::Posix::WriteAll(pathCommandsWakeFd, reinterpret_cast<const char*>(&wake), sizeof(wake));
+		pathCommandsThread.join();
+		close(pathCommandsWakeFd);
+		pathCommandsWakeFd = -1;
+	}
+	void NotifyPathChanged()
+	{
+		// A forked child has no watcher thread, just a copy of its mutex, which may have been locked at the fork, 
+		// and the parent's wake fd
+		if(inForkedChild || !pathCommandsThread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+			const char* searchPath{ shellVariables.Get(PATH_VARIABLE) };
+			pathCommandsSearchPath = searchPath ? searchPath : "";
+		}
+		const std::uint64_t wake{ 1 };
+		Lex::Posix::WriteAll(pathCommandsWakeFd, reinterpret_cast<const char*>(&wake), sizeof(wake));
+	}
+	void WatchPathCommands()
+	{
+		// Runs on its own thread: fills the trie, then keeps it in step with the directories until 
+		// $PATH changes (start over) or the shell stops it
+		while(true)
+		{
+			std::string searchPath;
+			{
+				std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+				if(pathCommandsStop)
+					return;
+				searchPath = pathCommandsSearchPath;
+			}
+
+			// Each directory is watched before it is scanned so nothing added meanwhile is missed. 
+			// The trie is built aside and swapped in, so completion never waits for a scan.
+			// Without inotify it is still filled once.
+			int inotifyFd{ inotify_init1(IN_CLOEXEC | IN_NONBLOCK) };
+			std::unordered_map<int, std::pair<std::string, std::unordered_set<std::string>>> directories;	// watch -> (path, executables)
+			int unwatchedKey{ -1 };
+			Lex::Lists::PrefixTrie trie;
+			std::stringstream pathStream{ searchPath };
+			std::string directory;
+			while(std::getline(pathStream, directory, ':'))
+			{
+				if(directory.empty() || directory[0] != '/')
+					continue;
+				const std::uint32_t WATCH_EVENTS{ IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE | IN_ONLYDIR };
+				int watch{ inotifyFd >= 0 ? inotify_add_watch(inotifyFd, directory.c_str(), WATCH_EVENTS) : unwatchedKey-- };
+				if(watch < 0 && inotifyFd >= 0)
+					continue;
+				auto [entryIt, inserted] = directories.try_emplace(watch);
+				if(!inserted)
+					continue;	// Listed twice in $PATH
+				entryIt->second.first = directory;
+				ScanPathDirectory(directory, entryIt->second.second);
+				for(const std::string& name : entryIt->second.second)
+					trie.Insert(name);
+			}
+			{
+				std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+				pathCommands = std::move(trie);
+			}
+
+			ProcessPathEvents(inotifyFd, directories);
+			if(inotifyFd >= 0)
+				close(inotifyFd);
+		}
+	}
+	void ProcessPathEvents(int inotifyFd, std::unordered_map<int, std::pair<std::string, std::unordered_set<std::string>>>& directories)
+	{
+		// Returns when woken by the shell, or when events were lost and the directories must be scanned again
+		alignas(inotify_event) char events[16 * 1024];
+		while(true)
+		{
+			pollfd pollFds[2]{ { pathCommandsWakeFd, POLLIN, 0 }, { inotifyFd, POLLIN, 0 } };
+			if(poll(pollFds, inotifyFd >= 0 ? 2 : 1, -1) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return;
+			}
+			if(pollFds[0].revents & POLLIN)
+			{
+				std::uint64_t wakeCount;
+				if(read(pathCommandsWakeFd, &wakeCount, sizeof(wakeCount)) < 0)
+					perror((SHELL_NAME + ": completion").c_str());
+				return;
+			}
+			if(!(pollFds[1].revents & POLLIN))
+				continue;
+
+			ssize_t numRead{ read(inotifyFd, events, sizeof(events)) };
+			if(numRead <= 0)
+				continue;
+			for(char* eventPtr = events; eventPtr < events + numRead; )
+			{
+				const inotify_event* event{ reinterpret_cast<const inotify_event*>(eventPtr) };
+				eventPtr += sizeof(inotify_event) + event->len;
+				if(event->mask & IN_Q_OVERFLOW)
+					return;
+				auto directoryIt{ directories.find(event->wd) };
+				if(directoryIt == directories.end())
+					continue;
+				auto& [directoryPath, names] = directoryIt->second;
+
+				// Directory itself went away
+				if(event->mask & IN_IGNORED)
+				{
+					std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+					for(const std::string& name : names)
+						pathCommands.Erase(name);
+					directories.erase(directoryIt);
+					continue;
+				}
+				if(event->len == 0)
+					continue;
+
+				// Added, removed, or made (non-)executable
+				std::string name{ event->name };
+				bool executable{ !(event->mask & (IN_DELETE | IN_MOVED_FROM)) && IsExecutableFile(directoryPath + '/' + name) };
+				bool known{ names.count(name) > 0 };
+				if(executable && !known)
+				{
+					std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+					pathCommands.Insert(name);
+					names.insert(std::move(name));
+				}
+				else if(!executable && known)
+				{
+					std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+					pathCommands.Erase(name);
+					names.erase(name);
+				}
+			}
+		}
+	}
+	void ScanPathDirectory(const std::string& directory, std::unordered_set<std::string>& namesOut)
+	{
+		DIR* directoryPtr{ opendir(directory.c_str()) };
+		if(!directoryPtr)
+			return;
+		int directoryFd{ dirfd(directoryPtr) };
+		while(dirent* entryPtr{ readdir(directoryPtr) })
+		{
+			if(entryPtr->d_name[0] == '.')
+				continue;
+
+			// Symbolic links count if they lead to an executable file
+			struct stat fileStatus;
+			if((entryPtr->d_type == DT_REG || entryPtr->d_type == DT_LNK || entryPtr->d_type == DT_UNKNOWN) &&
+			   fstatat(directoryFd, entryPtr->d_name, &fileStatus, 0) == 0 && S_ISREG(fileStatus.st_mode) &&
+			   faccessat(directoryFd, entryPtr->d_name, X_OK, 0) == 0)
+				namesOut.insert(entryPtr->d_name);
+		}
+		closedir(directoryPtr);
+	}
+	bool IsExecutableFile(const std::string& path)
+	{
+		struct stat fileStatus;
+		return stat(path.c_str(), &fileStatus) == 0 && S_ISREG(fileStatus.st_mode) && access(path.c_str(), X_OK) == 0;
+	}
+	void CompleteWord(std::string_view line, std::size_t cursor, std::size_t& wordStartOut, std::vector<std::string>& completionsOut)
+	{
+		// Find the start of the word before the cursor, and whether a command name goes there: 
+		// first in the line or after ; | &
+		const std::string COMMAND_START_CHARS{ COMMAND_SEPARATOR + PIPING_OPERATOR + BACKGROUND_OPERATOR };
+		const std::string WORD_END_CHARS{ WHITESPACE_CHARS + COMMAND_START_CHARS + REDIRECT_INPUT_OPERATOR + REDIRECT_OUTPUT_OPERATOR };
+		bool commandPosition{ true };
+		std::size_t wordStart{ 0 };
+		char quote{ '\0' };
+		for(std::size_t i = 0; i < cursor; ++i)
+		{
+			char c{ line[i] };
+			if(quote == '\'')
+			{
+				if(c == quote)
+					quote = '\0';
+				continue;
+			}
+			if(c == '\\')
+			{
+				++i;
+				continue;
+			}
+			if(quote == '"')
+			{
+				if(c == quote)
+					quote = '\0';
+				continue;
+			}
+			if(c == '\'' || c == '"')
+			{
+				quote = c;
+				continue;
+			}
+			if(WORD_END_CHARS.find(c) == std::string::npos)
+				continue;
+			if(i > wordStart)
+				commandPosition = false;
+			if(COMMAND_START_CHARS.find(c) != std::string::npos)
+				commandPosition = true;
+			wordStart = i + 1;
+		}
+		std::string_view word{ line.substr(wordStart, cursor - wordStart) };
+		wordStartOut = wordStart;
+		completionsOut.clear();
+
+		// Command names: builtins and $PATH
+		if(commandPosition && word.find_first_of("/\\'\"") == std::string_view::npos)
+		{
+			{
+				std::lock_guard<std::mutex> lock{ pathCommandsMutex };
+				pathCommands.Complete(word, COMPLETION_MAX_COUNT, completionsOut);
+			}
+			for(auto const& builtin : BUILTIN_COMMANDS)
+				if(builtin.first.substr(0, word.size()) == word)
+					completionsOut.emplace_back(builtin.first);
+			std::sort(completionsOut.begin(), completionsOut.end());
+			completionsOut.erase(std::unique(completionsOut.begin(), completionsOut.end()), completionsOut.end());
+		}
+		else
+			CompletePath(word, commandPosition, completionsOut);
+
+		// Nothing matched: whole lines from history that start with what was typed
+		if(completionsOut.empty() && cursor > 0)
+		{
+			wordStartOut = 0;
+			historyLines.Complete(line.substr(0, cursor), COMPLETION_MAX_COUNT, completionsOut);
+		}
+	}
+	void CompletePath(std::string_view word, bool executablesOnly, std::vector<std::string>& completionsOut)
+	{
+		// Directory part is kept as typed; the name part is matched without its quotes and escapes
+		std::string_view::size_type slashPos{ word.rfind('/') };
+		std::string_view typedDirectory{ slashPos == std::string_view::npos ? std::string_view{} : word.substr(0, slashPos + 1) };
+		auto unescape = [](std::string_view text) {
+			std::string unescaped;
+			for(std::string_view::size_type i = 0; i < text.size(); ++i)
+			{
+				if(text[i] == '\\' && i + 1 < text.size())
+					unescaped += text[++i];
+				else if(text[i] != '\'' && text[i] != '"')
+					unescaped += text[i];
+			}
+			return unescaped;
+		};
+		std::string namePrefix{ unescape(word.substr(typedDirectory.size())) };
+		std::string directory{ typedDirectory.empty() ? std::string{ "." } : unescape(typedDirectory) };
+		if(directory[0] == '~')
+		{
+			std::string home;
+			if(Lex::Posix::GetHomeDirectory(shellVariables, home))
+				directory.replace(0, 1, home);
+		}
+
+		DIR* directoryPtr{ opendir(directory.c_str()) };
+		if(!directoryPtr)
+			return;
+		int directoryFd{ dirfd(directoryPtr) };
+		while(dirent* entryPtr{ readdir(directoryPtr) })
+		{
+			// Hidden files only when asked for with a leading dot
+			std::string_view name{ entryPtr->d_name };
+			if(name == "." || name == ".." || name.substr(0, namePrefix.size()) != namePrefix)
+				continue;
+			if(name[0] == '.' && namePrefix.empty())
+				continue;
+			struct stat fileStatus;
+			bool isDirectory{ fstatat(directoryFd, entryPtr->d_name, &fileStatus, 0) == 0 && S_ISDIR(fileStatus.st_mode) };
+			if(executablesOnly && !isDirectory && faccessat(directoryFd, entryPtr->d_name, X_OK, 0) != 0)
+				continue;
+
+			// Characters that would split the word are escaped
+			std::string completion{ typedDirectory };
+			for(char c : name)
+			{
+				if(SPLIT_RULES.NeedsQuoting(std::string_view{ &c, 1 }))
+					completion += '\\';
+				completion += c;
+			}
+			if(isDirectory)
+				completion += '/';
+			completionsOut.push_back(std::move(completion));
+			if(completionsOut.size() >= COMPLETION_MAX_COUNT)
+				break;
+		}
+		closedir(directoryPtr);
+		std::sort(completionsOut.begin(), completionsOut.end());
+	}
+	bool GetHistoryEntry(std::size_t index, std::string& entryOut)
+	{
+		std::vector<std::string_view> entries;
+		GetHistoryEntries(index + 1, entries);
+		if(entries.size() <= index)
+			return false;
+		entryOut = entries[index];
+		return true;
+	}
+
+	//+------------------------\----------------------------------
+	//|		   Placement	   |
+	//\------------------------/----------------------------------
+	int ExecutePin(const Command& command)
+	{
+		// No parameters shows the shell's CPUs and the automatic mode
+		if(command.arguments.empty())
+		{
+			cpu_set_t cpus;
+			if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+				std::cout << "cpus " << Lex::Posix::FormatCpuList(cpus) << '\n';
+			std::vector<int> nodes;
+			if(Lex::Posix::GetOnlineNodes(nodes))
+				std::cout << "nodes " << nodes.front() << '-' << nodes.back() << '\n';
+			std::cout << "auto " << (autoPlacement == AutoPlacement::Cores ? PIN_AUTO_CORES : 
+									 autoPlacement == AutoPlacement::Nodes ? PIN_AUTO_NODES : PIN_AUTO_OFF) << std::endl;
+			return EXIT_SUCCESS;
+		}
+
+		// pin --auto cores|nodes|off
+		if(command.arguments[0] == PIN_AUTO_OPTION)
+		{
+			if(command.arguments.size() != 2 || !SetAutoPlacement(command.arguments[1]))
+			{
+				std::cerr << SHELL_NAME << ": " << PIN_COMMAND << ": usage: " << PIN_COMMAND << ' ' << PIN_AUTO_OPTION << ' ' 
+						  << PIN_AUTO_CORES << '|' << PIN_AUTO_NODES << '|' << PIN_AUTO_OFF << std::endl;
+				return EXIT_FAILURE;
+			}
+			return EXIT_SUCCESS;
+		}
+
+		// A placed command that is not a whole pipeline (ex: a parallel job) is run from here
+		Lex::Posix::Placement placement;
+		Command pinnedCommand;
+		if(!SplitPinPrefix(command, placement, pinnedCommand))
+			return EXIT_FAILURE;
+		Lex::Posix::ScopedPlacement scopedPlacement{ placement };
+		if(!scopedPlacement.IsApplied())
+		{
+			perror(ErrorPrefix(PIN_COMMAND).c_str());
+			return EXIT_FAILURE;
+		}
+		return ExecuteCommand(pinnedCommand);
+	}
+	bool IsPinPrefix(const Command& command)
+	{
+		return command.name == PIN_COMMAND && !command.arguments.empty() && command.arguments[0] != PIN_AUTO_OPTION;
+	}
+	bool SplitPinPrefix(const Command& pinCommand, Lex::Posix::Placement& placementOut, Command& commandOut)
+	{
+		// pin CPUS command args or pin --node N command args. A node also binds the command's memory to it.
+		const Lex::WordLists::WordList& arguments{ pinCommand.arguments };
+		Lex::WordLists::WordList::size_type commandStart{ 1 };
+		if(arguments[0] == PIN_NODE_OPTION)
+		{
+			int node;
+			if(arguments.size() < 2 || !Lex::Strings::ToInt(arguments[1], node) || node < 0 || node >= 64 || 
+			   !Lex::Posix::GetNodeCpus(node, placementOut.cpus))
+			{
+				std::cerr << SHELL_NAME << ": " << PIN_COMMAND << ": invalid node" << std::endl;
+				return false;
+			}
+			placementOut.memoryNodes = std::uint64_t{ 1 } << node;
+			commandStart = 2;
+		}
+		else if(!Lex::Posix::ParseCpuList(arguments[0], placementOut.cpus))
+		{
+			std::cerr << SHELL_NAME << ": " << PIN_COMMAND << ": invalid CPU list: " << arguments[0] << std::endl;
+			return false;
+		}
+		if(commandStart >= arguments.size())
+		{
+			std::cerr << SHELL_NAME << ": " << PIN_COMMAND << ": missing command" << std::endl;
+			return false;
+		}
+
+		// The command keeps pin's redirections
+		commandOut = pinCommand;
+		commandOut.name = arguments[commandStart];
+		commandOut.arguments.assign(arguments.begin() + commandStart + 1, arguments.end());
+		return true;
+	}
+	int ExecutePinnedPipeline(const Pipeline& pipeline)
+	{
+		// The shell's thread takes the placement while the pipeline runs, so every child inherits it
+		Pipeline pinnedPipeline{ pipeline };
+		Lex::Posix::Placement placement;
+		if(!SplitPinPrefix(pipeline.commands[0], placement, pinnedPipeline.commands[0]))
+			return EXIT_FAILURE;
+		Lex::Posix::ScopedPlacement scopedPlacement{ placement };
+		if(!scopedPlacement.IsApplied())
+		{
+			perror(ErrorPrefix(PIN_COMMAND).c_str());
+			return EXIT_FAILURE;
+		}
+		return ExecutePipeline(pinnedPipeline);
+	}
+	bool SetAutoPlacement(std::string_view mode)
+	{
+		// Cores are those the shell may run on now, nodes are the online ones
+		std::vector<Lex::Posix::Placement> placements;
+		if(mode == PIN_AUTO_CORES)
+		{
+			cpu_set_t cpus;
+			if(sched_getaffinity(0, sizeof(cpus), &cpus) != 0)
+				return false;
+			for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+				if(CPU_ISSET(cpu, &cpus))
+					CPU_SET(cpu, &placements.emplace_back().cpus);
+		}
+		else if(mode == PIN_AUTO_NODES)
+		{
+			std::vector<int> nodes;
+			if(!Lex::Posix::GetOnlineNodes(nodes))
+				return false;
+			for(int node : nodes)
+			{
+				Lex::Posix::Placement placement;
+				if(node < 64 && Lex::Posix::GetNodeCpus(node, placement.cpus))
+				{
+					placement.memoryNodes = std::uint64_t{ 1 } << node;
+					placements.push_back(placement);
+				}
+			}
+		}
+		else if(mode != PIN_AUTO_OFF)
+			return false;
+
+		autoPlacement = (mode == PIN_AUTO_CORES) ? AutoPlacement::Cores : (mode == PIN_AUTO_NODES) ? AutoPlacement::Nodes : AutoPlacement::Off;
+		autoPlacements = std::move(placements);
+		nextAutoPlacement = 0;
+		return true;
+	}
+	const Lex::Posix::Placement* NextAutoPlacement()
+	{
+		// Round-robin, or nullptr when automatic placement is off
+		if(autoPlacements.empty())
+			return nullptr;
+		const Lex::Posix::Placement* placementPtr{ &autoPlacements[nextAutoPlacement] };
+		nextAutoPlacement = (nextAutoPlacement + 1) % autoPlacements.size();
+		return placementPtr;
+	}
+	//+------------------------\----------------------------------
+	//|		     Memo		   |
 	//\------------------------/----------------------------------
-	void ChangeDirectory(const std::string& path)
+	int ExecuteMemo(const Command& command)
+	{
+		// No parameters shows the cache and this session's counts, -c empties the cache
+		std::string directory;
+		if(command.arguments.empty() || (command.arguments.size() == 1 && command.arguments[0] == MEMO_CLEAR_OPTION))
+		{
+			if(!GetMemoDirectory(directory))
+			{
+				std::cerr << SHELL_NAME << ": " << MEMO_COMMAND << ": no cache directory (" << MEMO_DIRECTORY_VARIABLE << " is empty)" << std::endl;
+				return EXIT_FAILURE;
+			}
+			if(command.arguments.empty())
+				PrintMemoStats(directory);
+			else
+				EvictMemoEntries(directory, 0);
+			return EXIT_SUCCESS;
+		}
+
+		std::vector<std::string_view> inputFiles;
+		std::vector<std::string_view> variables;
+		Command memoizedCommand;
+		if(!SplitMemoPrefix(command, inputFiles, variables, memoizedCommand))
+			return EXIT_FAILURE;
+
+		// Builtins are cheaper than a lookup, and without a cache directory nothing is kept
+		if(IsBuiltinCommand(memoizedCommand) || IsAssignment(memoizedCommand.name) || !GetMemoDirectory(directory))
+		{
+			++memoStats.uncached;
+			return ExecuteCommand(memoizedCommand);
+		}
+		std::string key;
+		if(!GetMemoKey(memoizedCommand, inputFiles, variables, key))
+		{
+			++memoStats.uncached;
+			return ExecuteExternalCommand(memoizedCommand);
+		}
+
+		// A hit replays the stored output and marks the entry as recently used
+		std::string entryPath{ directory + '/' + MEMO_ENTRIES_DIRECTORY + '/' + key };
+		MemoEntry entry;
+		if(ReadMemoEntry(entryPath, entry) && ReplayMemoEntry(directory, entry))
+		{
+			++memoStats.hits;
+			memoStats.saved += entry.runTime;
+			utimensat(AT_FDCWD, entryPath.c_str(), nullptr, 0);
+			return entry.exitStatus;
+		}
+		++memoStats.misses;
+		return RunAndMemoize(memoizedCommand, directory, entryPath);
+	}
+	bool SplitMemoPrefix(const Command& memoCommand, std::vector<std::string_view>& inputFilesOut, 
+						 std::vector<std::string_view>& variablesOut, Command& commandOut)
 	{
-		// Save current
-		if(!Lex::Posix::GetWorkingDirectory(lastWorkingDirectory))
-			std::cerr << SHELL_NAME << ": Failed to save current working directory" << std::endl;
+		// memo [-i file]... [-e NAME]... command args
+		const Lex::WordLists::WordList& arguments{ memoCommand.arguments };
+		Lex::WordLists::WordList::size_type commandStart{ 0 };
+		while(commandStart < arguments.size() && (arguments[commandStart] == MEMO_INPUT_OPTION || arguments[commandStart] == MEMO_VARIABLE_OPTION))
+		{
+			if(commandStart + 1 >= arguments.size())
+			{
+				std::cerr << SHELL_NAME << ": " << MEMO_COMMAND << ": " << arguments[commandStart] << " needs a value" << std::endl;
+				return false;
+			}
+			(arguments[commandStart] == MEMO_INPUT_OPTION ? inputFilesOut : variablesOut).push_back(arguments[commandStart + 1]);
+			commandStart += 2;
+		}
+		if(commandStart >= arguments.size())
+		{
+			std::cerr << SHELL_NAME << ": " << MEMO_COMMAND << ": missing command" << std::endl;
+			return false;
+		}
 
-		// Change to new
-		if(!Lex::Posix::ChangeWorkingDirectory(path))
-			std::cerr << SHELL_NAME << ": Failed to change current working directory to \'" << path << '\'' << std::endl;
+		// memo's redirections are already in place on the shell's stdin and stdout
+		commandOut = Command{};
+		commandOut.name = arguments[commandStart];
+		commandOut.arguments.assign(arguments.begin() + commandStart + 1, arguments.end());
+		return true;
 	}
-	void ExpandDirectory(std::string& path)
+	bool GetMemoDirectory(std::string& directoryOut)
 	{
-		// If no directory specified, change to root directory
-		if(path.empty())
-			path = "/";
+		// $LESH_MEMO_DIRECTORY, or ~/.cache/lesh/memo if unset. Set but empty turns the cache off.
+		const char* directoryVariable{ shellVariables.Get(MEMO_DIRECTORY_VARIABLE) };
+		if(directoryVariable)
+			directoryOut = directoryVariable;
+		else if(Lex::Posix::GetHomeDirectory(shellVariables, directoryOut))
+			directoryOut += '/' + MEMO_DIRECTORY_DEFAULT_NAME;
+		else
+			return false;
+		if(directoryOut.empty())
+			return false;
 
-		// Expand ~ to home directory
-		if(path[0] == '~')
+		// Create each missing directory on the way down
+		for(std::string::size_type slash = directoryOut.find('/', 1); ; slash = directoryOut.find('/', slash + 1))
 		{
-			std::string home;
-			if(!Lex::Posix::GetHomeDirectory(home))
+			std::string path{ directoryOut.substr(0, slash) };
+			if(mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
 			{
-				std::cerr << SHELL_NAME << ": ~: Failed to find home directory" << std::endl;
-				return;
+				perror(ErrorPrefix(MEMO_COMMAND + ": " + path).c_str());
+				return false;
+			}
+			if(slash == std::string::npos)
+				break;
+		}
+		for(const std::string& subdirectory : { MEMO_ENTRIES_DIRECTORY, MEMO_OBJECTS_DIRECTORY })
+			if(mkdir((directoryOut + '/' + subdirectory).c_str(), 0700) != 0 && errno != EEXIST)
+			{
+				perror(ErrorPrefix(MEMO_COMMAND + ": " + directoryOut).c_str());
+				return false;
+			}
+		return true;
+	}
+	bool GetMemoKey(const Command& command, const std::vector<std::string_view>& inputFiles, 
+					const std::vector<std::string_view>& variables, std::string& keyOut)
+	{
+		// A file is identified by its device, inode, size and modification time
+		Lex::Hashing::Fingerprint fingerprint;
+		auto addFile{ [&fingerprint](const struct stat& fileInfo) {
+			fingerprint.Add(static_cast<std::uint64_t>(fileInfo.st_dev)).Add(static_cast<std::uint64_t>(fileInfo.st_ino))
+					   .Add(static_cast<std::uint64_t>(fileInfo.st_size)).Add(static_cast<std::uint64_t>(fileInfo.st_mtim.tv_sec))
+					   .Add(static_cast<std::uint64_t>(fileInfo.st_mtim.tv_nsec));
+		} };
+
+		// The app itself, so that a rebuilt or upgraded app misses
+		std::string appPath{ command.name };
+		bool wasHit;
+		if(command.name.find('/') == std::string_view::npos)
+		{
+			HashedCommand* hashedCommandPtr{ FindHashedCommand(command.name, wasHit) };
+			if(!hashedCommandPtr)
+				return false;
+			appPath = hashedCommandPtr->path;
+		}
+		struct stat fileInfo;
+		if(stat(appPath.c_str(), &fileInfo) != 0)
+			return false;
+		fingerprint.Add(MEMO_KEY_VERSION).Add(appPath);
+		addFile(fileInfo);
+
+		// Where it runs, and the words it runs with
+		std::string workingDirectory;
+		if(!Lex::Posix::GetWorkingDirectory(workingDirectory))
+			return false;
+		fingerprint.Add(workingDirectory).Add(static_cast<std::uint64_t>(command.arguments.size()));
+		for(std::string_view argument : command.arguments)
+			fingerprint.Add(argument);
+
+		// Declared variables: value, or unset
+		for(std::string_view name : variables)
+		{
+			const char* value{ shellVariables.Get(name) };
+			fingerprint.Add(name).Add(std::uint64_t{ value != nullptr }).Add(value ? std::string_view{ value } : std::string_view{});
+		}
+
+		// Declared input files: identity, or missing
+		for(std::string_view path : inputFiles)
+		{
+			fingerprint.Add(path);
+			if(stat(std::string{ path }.c_str(), &fileInfo) == 0)
+				addFile(fileInfo);
+			else
+				fingerprint.Add(std::uint64_t{ 0 });
+		}
+
+		// stdin redirected from a file counts as an input. A pipe's contents can't be known in advance.
+		if(fstat(STDIN_FILENO, &fileInfo) != 0 || S_ISFIFO(fileInfo.st_mode) || S_ISSOCK(fileInfo.st_mode))
+			return false;
+		if(S_ISREG(fileInfo.st_mode))
+			addFile(fileInfo);
+		keyOut = fingerprint.Hex();
+		return true;
+	}
+	bool ReadMemoEntry(const std::string& path, MemoEntry& entryOut)
+	{
+		// exitStatus runTime stdoutObject stderrObject, with - for empty output
+		std::string text;
+		if(!Lex::Posix::ReadFile(path, text))
+			return false;
+		std::istringstream fields{ text };
+		return static_cast<bool>(fields >> entryOut.exitStatus >> entryOut.runTime >> entryOut.stdoutObject >> entryOut.stderrObject);
+	}
+	bool ReplayMemoEntry(const std::string& directory, const MemoEntry& entry)
+	{
+		// Both objects are opened before anything is written, so a half-evicted entry is a miss and not half a replay
+		int fds[]{ -1, -1 };
+		const std::string* objects[]{ &entry.stdoutObject, &entry.stderrObject };
+		bool opened{ true };
+		for(int i = 0; i < 2; ++i)
+			if(*objects[i] != MEMO_EMPTY_OBJECT)
+			{
+				fds[i] = open((directory + '/' + MEMO_OBJECTS_DIRECTORY + '/' + *objects[i]).c_str(), O_RDONLY | O_CLOEXEC);
+				opened = opened && fds[i] >= 0;
+			}
+		if(opened)
+		{
+			std::cout.flush();
+			if(fds[0] >= 0)
+				Lex::Posix::SendFileAll(fds[0], STDOUT_FILENO);
+			if(fds[1] >= 0)
+				Lex::Posix::SendFileAll(fds[1], STDERR_FILENO);
+		}
+		for(int fd : fds)
+			if(fd >= 0)
+				close(fd);
+		return opened;
+	}
+	int RunAndMemoize(const Command& command, const std::string& directory, const std::string& entryPath)
+	{
+		// The command writes stdout and stderr to memory files, which are stored and then replayed
+		int outputFds[]{ Lex::Posix::CreateMemoryFile("memo-stdout"), Lex::Posix::CreateMemoryFile("memo-stderr") };
+		if(outputFds[0] < 0 || outputFds[1] < 0)
+		{
+			perror(ErrorPrefix(MEMO_COMMAND).c_str());
+			for(int fd : outputFds)
+				if(fd >= 0)
+					close(fd);
+			return ExecuteExternalCommand(command);
+		}
+		Lex::Posix::SpawnFileActionList fileActions{ &lineArena };
+		fileActions.push_back(Lex::Posix::SpawnFileAction::Duplicate(outputFds[0], STDOUT_FILENO));
+		fileActions.push_back(Lex::Posix::SpawnFileAction::Duplicate(outputFds[1], STDERR_FILENO));
+
+		int exitStatus{ EXIT_STATUS_NOT_FOUND };
+		Lex::Stats::Nanoseconds start{ Lex::Stats::Now() };
+		ChildProcess child;
+		int status{ 0 };
+		if(SpawnExternalCommand(command, fileActions, child))
+		{
+			if(!WaitForForegroundChild(child, status, ErrorPrefix(command.name)))
+				exitStatus = EXIT_FAILURE;
+			else
+			{
+				exitStatus = Lex::Posix::WaitStatusToExitStatus(status);
+
+				// Only commands that ran to their own exit are kept: not those interrupted or killed
+				// The cache is only scanned for eviction once new objects take it over the limit
+				MemoEntry entry;
+				entry.exitStatus = exitStatus;
+				entry.runTime = Lex::Stats::Now() - start;
+				std::uint64_t storedBytes{ 0 };
+				if(WIFEXITED(status) && StoreMemoObject(directory, outputFds[0], entry.stdoutObject, storedBytes) && 
+				   StoreMemoObject(directory, outputFds[1], entry.stderrObject, storedBytes))
+				{
+					std::ostringstream text;
+					text << entry.exitStatus << ' ' << entry.runTime << ' ' << entry.stdoutObject << ' ' << entry.stderrObject << '\n';
+					std::uint64_t limit{ GetMemoLimit() };
+					if(WriteMemoFile(entryPath, text.str()) && storedBytes > 0 && AddMemoSize(directory, storedBytes) > limit)
+						EvictMemoEntries(directory, limit);
+				}
+			}
+		}
+
+		// The output is shown after the command finishes
+		std::cout.flush();
+		Lex::Posix::SendFileAll(outputFds[0], STDOUT_FILENO);
+		Lex::Posix::SendFileAll(outputFds[1], STDERR_FILENO);
+		close(outputFds[0]);
+		close(outputFds[1]);
+		if(exitStatus != EXIT_STATUS_NOT_FOUND)
+			ReportSignal(status);
+		return exitStatus;
+	}
+	bool StoreMemoObject(const std::string& directory, int fd, std::string& objectOut, std::uint64_t& storedBytesOut)
+	{
+		// Named by its contents, so identical outputs are stored once. storedBytesOut grows by what was new.
+		std::string contents;
+		char buffer[1 << 16];
+		for(off_t offset = 0; ; )
+		{
+			ssize_t bytesRead{ pread(fd, buffer, sizeof(buffer), offset) };
+			if(bytesRead == 0)
+				break;
+			if(bytesRead < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				return false;
+			}
+			contents.append(buffer, static_cast<std::size_t>(bytesRead));
+			offset += bytesRead;
+		}
+		if(contents.empty())
+		{
+			objectOut = MEMO_EMPTY_OBJECT;
+			return true;
+		}
+		objectOut = Lex::Hashing::Fingerprint{}.Add(contents).Hex();
+		std::string objectPath{ directory + '/' + MEMO_OBJECTS_DIRECTORY + '/' + objectOut };
+		if(access(objectPath.c_str(), F_OK) == 0)
+			return true;
+		if(!WriteMemoFile(objectPath, contents))
+			return false;
+		storedBytesOut += contents.size();
+		return true;
+	}
+	std::uint64_t AddMemoSize(const std::string& directory, std::uint64_t bytes)
+	{
+		// Returns the new total. A missing size file (a new or older cache) starts from a scan.
+		bool created;
+		int fd{ OpenMemoSizeFile(directory, created) };
+		if(fd < 0)
+			return std::numeric_limits<std::uint64_t>::max();
+		std::uint64_t totalSize{ 0 };
+		if(created)
+		{
+			std::vector<MemoCacheEntry> entries;
+			std::unordered_map<std::string, MemoCacheObject> objects;
+			totalSize = ScanMemoCache(directory, entries, objects);
+		}
+		else
+		{
+			char text[32];
+			ssize_t textSize{ pread(fd, text, sizeof(text), 0) };
+			if(textSize > 0)
+				std::from_chars(text, text + textSize, totalSize);
+			totalSize += bytes;
+		}
+		WriteMemoSize(fd, totalSize);
+		return totalSize;
+	}
+	void SetMemoSize(const std::string& directory, std::uint64_t totalSize)
+	{
+		bool created;
+		int fd{ OpenMemoSizeFile(directory, created) };
+		if(fd < 0)
+			return;
+		WriteMemoSize(fd, totalSize);
+	}
+	void WriteMemoSize(int fd, std::uint64_t totalSize)
+	{
+		// Then closes fd, which unlocks it
+		std::string totalText{ std::to_string(totalSize) };
+		if(pwrite(fd, totalText.data(), totalText.size(), 0) < 0 || ftruncate(fd, static_cast<off_t>(totalText.size())) != 0)
+			perror(ErrorPrefix(MEMO_COMMAND + ": " + MEMO_SIZE_FILE).c_str());
+		close(fd);
+	}
+	int OpenMemoSizeFile(const std::string& directory, bool& createdOut)
+	{
+		// Locked until closed, so shells sharing the cache add to the total one at a time
+		std::string path{ directory + '/' + MEMO_SIZE_FILE };
+		createdOut = false;
+		int fd{ open(path.c_str(), O_RDWR | O_CLOEXEC) };
+		if(fd < 0 && errno == ENOENT)
+		{
+			fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+			createdOut = fd >= 0;
+			if(fd < 0 && errno == EEXIST)
+				fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+		}
+		if(fd < 0 || flock(fd, LOCK_EX) != 0)
+		{
+			perror(ErrorPrefix(MEMO_COMMAND + ": " + path).c_str());
+			if(fd >= 0)
+				close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	bool WriteMemoFile(const std::string& path, std::string_view contents)
+	{
+		// Written beside the final name and renamed over it, so other shells never see part of a file
+		std::string temporaryPath{ path + ".XXXXXX" };
+		int fd{ mkstemp(temporaryPath.data()) };
+		if(fd < 0)
+		{
+			perror(ErrorPrefix(MEMO_COMMAND).c_str());
+			return false;
+		}
+		bool written{ Lex::Posix::WriteAll(fd, contents.data(), contents.size()) };
+		written = (close(fd) == 0) && written;
+		if(!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+		{
+			perror(ErrorPrefix(MEMO_COMMAND).c_str());
+			unlink(temporaryPath.c_str());
+			return false;
+		}
+		return true;
+	}
+	std::uint64_t GetMemoLimit()
+	{
+		// $LESH_MEMO_LIMIT in MiB
+		int limitMebibytes{ MEMO_LIMIT_DEFAULT_MEBIBYTES };
+		if(const char* limitVariable{ shellVariables.Get(MEMO_LIMIT_VARIABLE) })
+			if(!Lex::Strings::ToInt(limitVariable, limitMebibytes) || limitMebibytes < 0)
+				limitMebibytes = MEMO_LIMIT_DEFAULT_MEBIBYTES;
+		return static_cast<std::uint64_t>(limitMebibytes) << 20;
+	}
+	std::uint64_t ScanMemoCache(const std::string& directory, std::vector<MemoCacheEntry>& entriesOut, 
+								std::unordered_map<std::string, MemoCacheObject>& objectsOut)
+	{
+		// Every object with its size and how many entries use it. Returns the bytes of all objects. 
+		// Names with a '.' are files still being written.
+		std::uint64_t totalSize{ 0 };
+		std::string objectsDirectory{ directory + '/' + MEMO_OBJECTS_DIRECTORY };
+		if(DIR* dirPtr{ opendir(objectsDirectory.c_str()) })
+		{
+			while(const dirent* direntPtr{ readdir(dirPtr) })
+			{
+				struct stat fileInfo;
+				if(!std::strchr(direntPtr->d_name, '.') && fstatat(dirfd(dirPtr), direntPtr->d_name, &fileInfo, 0) == 0)
+				{
+					objectsOut[direntPtr->d_name].size = static_cast<std::uint64_t>(fileInfo.st_size);
+					totalSize += static_cast<std::uint64_t>(fileInfo.st_size);
+				}
+			}
+			closedir(dirPtr);
+		}
+
+		// Every entry with the time it was last used
+		std::string entriesDirectory{ directory + '/' + MEMO_ENTRIES_DIRECTORY };
+		if(DIR* dirPtr{ opendir(entriesDirectory.c_str()) })
+		{
+			while(const dirent* direntPtr{ readdir(dirPtr) })
+			{
+				MemoCacheEntry cacheEntry;
+				cacheEntry.name = direntPtr->d_name;
+				struct stat fileInfo;
+				if(cacheEntry.name.find('.') != std::string::npos || 
+				   fstatat(dirfd(dirPtr), direntPtr->d_name, &fileInfo, 0) != 0 || 
+				   !ReadMemoEntry(entriesDirectory + '/' + cacheEntry.name, cacheEntry.entry))
+					continue;
+				cacheEntry.lastUsed = fileInfo.st_mtim;
+				for(const std::string* objectPtr : { &cacheEntry.entry.stdoutObject, &cacheEntry.entry.stderrObject })
+				{
+					auto objectIt{ objectsOut.find(*objectPtr) };
+					if(objectIt != objectsOut.end())
+						++objectIt->second.references;
+				}
+				entriesOut.push_back(std::move(cacheEntry));
+			}
+			closedir(dirPtr);
+		}
+		return totalSize;
+	}
+	void EvictMemoEntries(const std::string& directory, std::uint64_t limit)
+	{
+		// Least recently used entries go first, and their objects with them once nothing else uses them
+		std::vector<MemoCacheEntry> entries;
+		std::unordered_map<std::string, MemoCacheObject> objects;
+		std::uint64_t totalSize{ ScanMemoCache(directory, entries, objects) };
+		std::sort(entries.begin(), entries.end(), [](const MemoCacheEntry& a, const MemoCacheEntry& b) {
+			return std::tie(a.lastUsed.tv_sec, a.lastUsed.tv_nsec) < std::tie(b.lastUsed.tv_sec, b.lastUsed.tv_nsec);
+		});
+		std::string entriesDirectory{ directory + '/' + MEMO_ENTRIES_DIRECTORY + '/' };
+		std::string objectsDirectory{ directory + '/' + MEMO_OBJECTS_DIRECTORY + '/' };
+		for(std::vector<MemoCacheEntry>::size_type i = 0; i < entries.size() && (totalSize > limit || limit == 0); ++i)
+		{
+			unlink((entriesDirectory + entries[i].name).c_str());
+			for(const std::string* objectPtr : { &entries[i].entry.stdoutObject, &entries[i].entry.stderrObject })
+			{
+				auto objectIt{ objects.find(*objectPtr) };
+				if(objectIt != objects.end() && --objectIt->second.references == 0)
+				{
+					unlink((objectsDirectory + objectIt->first).c_str());
+					totalSize -= objectIt->second.size;
+					objects.erase(objectIt);
+				}
 			}
-			path.replace(0, 1, home);
 		}
+
+		// Objects no entry uses, ex: left by a shell that was killed between writing an object and its entry
+		for(auto const& [name, object] : objects)
+			if(object.references == 0)
+			{
+				unlink((objectsDirectory + name).c_str());
+				totalSize -= object.size;
+			}
+		SetMemoSize(directory, totalSize);
+	}
+	void PrintMemoStats(const std::string& directory)
+	{
+		std::vector<MemoCacheEntry> entries;
+		std::unordered_map<std::string, MemoCacheObject> objects;
+		std::uint64_t totalSize{ ScanMemoCache(directory, entries, objects) };
+		std::cout << SHELL_NAME << ": " << MEMO_COMMAND << ": " << entries.size() << " entries, " << std::fixed << std::setprecision(1) 
+				  << static_cast<double>(totalSize) / (1 << 20) << " of " << (GetMemoLimit() >> 20) << " MiB in " << directory << '\n'
+				  << SHELL_NAME << ": " << MEMO_COMMAND << ": " << memoStats.hits << " hits, " << memoStats.misses << " misses, " 
+				  << memoStats.uncached << " uncached, " << FormatDuration(memoStats.saved) << " saved" << std::endl;
 	}
 
 	//+------------------------\----------------------------------
-	//|		    Print		   |
+	//|		    Watch		   |
 	//\------------------------/----------------------------------
-	void PrintPrompt()
+	int ExecuteWatchRun(const Command& command)
 	{
-		std::cout << SHELL_STYLE << SHELL_NAME;
+		// watch-run [-x pattern]... paths... -- command args
+		const Lex::WordLists::WordList& arguments{ command.arguments };
+		WatchRunState state;
+		std::vector<std::string_view> paths;
+		Lex::WordLists::WordList::size_type separator{ 0 };
+		for(; separator < arguments.size() && arguments[separator] != WATCH_RUN_SEPARATOR; ++separator)
 		{
-			std::string user;
-			if(Lex::Posix::GetUser(user))
-				std::cout << PUNCUATION_STYLE << '(' << USER_STYLE << user << PUNCUATION_STYLE << ')';
+			if(arguments[separator] == WATCH_RUN_EXCLUDE_OPTION && separator + 1 < arguments.size())
+				state.excludes.push_back(arguments[++separator]);
+			else
+				paths.push_back(arguments[separator]);
+		}
+		if(paths.empty() || separator + 1 >= arguments.size())
+		{
+			std::cerr << SHELL_NAME << ": " << WATCH_RUN_COMMAND << ": usage: " << WATCH_RUN_COMMAND << " [" << WATCH_RUN_EXCLUDE_OPTION 
+					  << " pattern]... paths... " << WATCH_RUN_SEPARATOR << " command args" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		// watch-run's redirections are already in place on the shell's stdin and stdout
+		Command runCommand;
+		runCommand.name = arguments[separator + 1];
+		runCommand.arguments.assign(arguments.begin() + separator + 2, arguments.end());
+
+		state.inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		if(state.inotifyFd < 0)
+		{
+			perror(ErrorPrefix(WATCH_RUN_COMMAND).c_str());
+			return EXIT_FAILURE;
 		}
-		std::cout << PUNCUATION_STYLE << ':';
+		for(std::string_view path : paths)
+			if(!AddWatches(state, std::string{ path }))
+			{
+				perror(ErrorPrefix(WATCH_RUN_COMMAND + ": " + std::string{ path }).c_str());
+				close(state.inotifyFd);
+				return EXIT_FAILURE;
+			}
+
+		// Ctrl-C ends watch-run, and the run in flight with it
+		struct sigaction interruptAction{};
+		struct sigaction savedInterruptAction;
+		interruptAction.sa_handler = OnWatchRunInterrupt;
+		sigemptyset(&interruptAction.sa_mask);
+		sigaction(SIGINT, &interruptAction, &savedInterruptAction);
+		watchRunInterrupted = 0;
+
+		// Runs once, then again each time changes have been quiet for the debounce time. The shell sleeps in poll between.
+		const Lex::Stats::Nanoseconds DEBOUNCE_TIME{ WATCH_RUN_DEBOUNCE_MILLISECONDS * 1'000'000LL };
+		pid_t runPid{ -1 };
+		int runFd{ -1 };
+		bool runPending{ true };
+		Lex::Stats::Nanoseconds lastChange{ 0 };
+		std::string changedPath;
+		while(!watchRunInterrupted)
 		{
-			std::string workingDirectory;
-			if(Lex::Posix::GetWorkingDirectory(workingDirectory))
-				std::cout << DIRECTORY_STYLE << workingDirectory;
-			std::cout << PUNCUATION_STYLE << "$ " << Lex::ConsoleFormatting::DEFAULT;
+			Lex::Stats::Nanoseconds sinceChange{ Lex::Stats::Now() - lastChange };
+			if(runPending && sinceChange >= DEBOUNCE_TIME)
+			{
+				if(!changedPath.empty())
+					std::cerr << SHELL_NAME << ": " << WATCH_RUN_COMMAND << ": " << changedPath << " changed" 
+							  << (runPid >= 0 ? ", restarting" : "") << std::endl;
+				if(runPid >= 0)
+				{
+					StopWatchRun(runPid, runFd, SIGTERM);
+					runPid = -1;
+				}
+				if(!StartWatchRun(runCommand, runPid, runFd))
+					runPid = -1;
+				runPending = false;
+				changedPath.clear();
+				continue;
+			}
+
+			// Without a process descriptor the run is checked on a short timer instead
+			int timeoutMilliseconds{ -1 };
+			if(runPending)
+				timeoutMilliseconds = static_cast<int>((DEBOUNCE_TIME - sinceChange + 999'999) / 1'000'000);
+			else if(runPid >= 0 && runFd < 0)
+				timeoutMilliseconds = WATCH_RUN_REAP_POLL_MILLISECONDS;
+			pollfd pollFds[2]{ { state.inotifyFd, POLLIN, 0 }, { runPid >= 0 ? runFd : -1, POLLIN, 0 } };
+			if(poll(pollFds, 2, timeoutMilliseconds) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				perror(ErrorPrefix(WATCH_RUN_COMMAND).c_str());
+				break;
+			}
+			if((pollFds[0].revents & POLLIN) && ReadWatchEvents(state, changedPath))
+			{
+				runPending = true;
+				lastChange = Lex::Stats::Now();
+			}
+			int status;
+			if(runPid >= 0 && ((pollFds[1].revents & POLLIN) || runFd < 0) && Lex::Posix::TryReapChild(runPid, status))
+			{
+				int exitStatus{ Lex::Posix::WaitStatusToExitStatus(status) };
+				ReportSignal(status);
+				if(exitStatus != EXIT_SUCCESS)
+					std::cerr << SHELL_NAME << ": " << WATCH_RUN_COMMAND << ": " << runCommand.name << " exited with status " << exitStatus << std::endl;
+				if(runFd >= 0)
+					close(runFd);
+				runPid = -1;
+			}
 		}
+
+		if(runPid >= 0)
+			StopWatchRun(runPid, runFd, SIGINT);
+		sigaction(SIGINT, &savedInterruptAction, nullptr);
+		close(state.inotifyFd);
+		return watchRunInterrupted ? 128 + SIGINT : EXIT_FAILURE;
 	}
-	void PrintHistory(CommandListIndex numCommands)
+	void OnWatchRunInterrupt(int)
 	{
-		// Print history list in reverse so that most recent command is printed last
-		if(commandHistory.empty())
+		watchRunInterrupted = 1;
+	}
+	bool AddWatches(WatchRunState& state, const std::string& path)
+	{
+		// A directory is watched with everything under it. A file is watched through its directory, 
+		// because editors often save by writing a new file and renaming it over the old one.
+		struct stat fileInfo;
+		if(stat(path.c_str(), &fileInfo) != 0)
+			return false;
+		if(S_ISDIR(fileInfo.st_mode))
+			return WatchDirectoryTree(state, path);
+
+		std::string::size_type slash{ path.rfind('/') };
+		std::string directory{ slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash)) };
+		if(IsWatchCapReached(state))
+			return true;
+		int watch{ inotify_add_watch(state.inotifyFd, directory.c_str(), WATCH_RUN_EVENTS) };
+		if(watch < 0)
+			return false;
+		WatchedDirectory& watchedDirectory{ state.directories[watch] };
+		watchedDirectory.path = directory;
+		if(!watchedDirectory.recursive)
+			watchedDirectory.names.insert(path.substr(slash + 1));
+		return true;
+	}
+	bool IsWatchCapReached(WatchRunState& state)
+	{
+		// Stops adding watches at the cap, which it reports once, rather than using up the user's inotify watches
+		if(state.directories.size() < WATCH_RUN_MAX_WATCHES)
+			return false;
+		if(!state.capReported)
+			std::cerr << SHELL_NAME << ": " << WATCH_RUN_COMMAND << ": watching only the first " << WATCH_RUN_MAX_WATCHES << " directories" << std::endl;
+		state.capReported = true;
+		return true;
+	}
+	bool WatchDirectoryTree(WatchRunState& state, const std::string& directory)
+	{
+		if(IsWatchCapReached(state))
+			return true;
+		int watch{ inotify_add_watch(state.inotifyFd, directory.c_str(), WATCH_RUN_EVENTS) };
+		if(watch < 0)
+			return false;
+		WatchedDirectory& watchedDirectory{ state.directories[watch] };
+		watchedDirectory.path = directory;
+		watchedDirectory.recursive = true;
+		watchedDirectory.names.clear();
+
+		// Symbolic links are not followed, so a link to a parent can't make a loop
+		DIR* dirPtr{ opendir(directory.c_str()) };
+		if(!dirPtr)
+			return true;
+		std::vector<std::string> subdirectories;
+		while(const dirent* direntPtr{ readdir(dirPtr) })
 		{
-			std::cout << SHELL_NAME << ": " << DISPLAY_HISTORY_COMMAND << ": empty" << std::endl;
-			return;
+			std::string_view name{ direntPtr->d_name };
+			if(name == "." || name == ".." || IsWatchRunExcluded(state, name))
+				continue;
+			struct stat fileInfo;
+			if(direntPtr->d_type == DT_DIR || (direntPtr->d_type == DT_UNKNOWN && 
+			   fstatat(dirfd(dirPtr), direntPtr->d_name, &fileInfo, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(fileInfo.st_mode)))
+				subdirectories.emplace_back(directory + '/' + direntPtr->d_name);
+		}
+		closedir(dirPtr);
+		for(const std::string& subdirectory : subdirectories)
+			WatchDirectoryTree(state, subdirectory);
+		return true;
+	}
+	bool IsWatchRunExcluded(const WatchRunState& state, std::string_view name)
+	{
+		// Hidden names (.git, editor swap files) and names matching a -x pattern
+		return name.empty() || name[0] == '.' || std::any_of(state.excludes.begin(), state.excludes.end(), 
+			[name](std::string_view pattern) { return Lex::Strings::MatchesGlob(pattern, name); });
+	}
+	bool ReadWatchEvents(WatchRunState& state, std::string& changedPathOut)
+	{
+		// Reads every queued event. True if any of them is a change to something watched.
+		alignas(inotify_event) char events[16 * 1024];
+		bool changed{ false };
+		while(true)
+		{
+			ssize_t numRead{ read(state.inotifyFd, events, sizeof(events)) };
+			if(numRead <= 0)
+				break;
+			for(char* eventPtr = events; eventPtr < events + numRead; )
+			{
+				const inotify_event* event{ reinterpret_cast<const inotify_event*>(eventPtr) };
+				eventPtr += sizeof(inotify_event) + event->len;
+
+				// Events were dropped, so assume something changed
+				if(event->mask & IN_Q_OVERFLOW)
+				{
+					changed = true;
+					continue;
+				}
+				auto directoryIt{ state.directories.find(event->wd) };
+				if(directoryIt == state.directories.end())
+					continue;
+				if(event->mask & IN_IGNORED)
+				{
+					state.directories.erase(directoryIt);
+					continue;
+				}
+				std::string_view name{ event->len > 0 ? event->name : "" };
+				const WatchedDirectory& watchedDirectory{ directoryIt->second };
+				if(!name.empty() && (IsWatchRunExcluded(state, name) || (!watchedDirectory.recursive && watchedDirectory.names.count(std::string{ name }) == 0)))
+					continue;
+				std::string path{ name.empty() ? watchedDirectory.path : watchedDirectory.path + '/' + std::string{ name } };
+
+				// New directories are watched too
+				if(watchedDirectory.recursive && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+					WatchDirectoryTree(state, path);
+				changedPathOut = std::move(path);
+				changed = true;
+			}
 		}
-		if(numCommands > HISTORY_MAX_SIZE)
-			numCommands = HISTORY_MAX_SIZE;
-		CommandListIndex i{ commandHistory.size() };
-		for(auto cmdIter = commandHistory.rbegin(); cmdIter != commandHistory.rend(); ++cmdIter, --i)
+		return changed;
+	}
+	bool StartWatchRun(const Command& command, pid_t& runPidOut, int& runFdOut)
+	{
+		// Through ExecuteCommand in a child of its own process group, so a restart can stop all of it. 
+		// Not being in the terminal's foreground group, it must not read the terminal.
+		Lex::Posix::SpawnFileActionList fileActions;
+		if(isatty(STDIN_FILENO))
+			fileActions.push_back(Lex::Posix::SpawnFileAction::Open(STDIN_FILENO, "/dev/null", O_RDONLY, 0));
+		std::cout.flush();
+		if(!Lex::Posix::ForkAndRun([&command]() {
+				setpgid(0, 0);
+				signal(SIGINT, SIG_DFL);
+				return ExecuteCommand(command);
+			}, fileActions, runPidOut, ErrorPrefix(WATCH_RUN_COMMAND)))
+			return false;
+		setpgid(runPidOut, runPidOut);
+		runFdOut = Lex::Posix::OpenProcessFd(runPidOut);
+		return true;
+	}
+	int StopWatchRun(pid_t runPid, int runFd, int signalNumber)
+	{
+		// Signals the whole run, then kills what is left of it after a grace period
+		kill(-runPid, signalNumber);
+		int status;
+		if(!Lex::Posix::TryReapChild(runPid, status))
 		{
-			if(i <= numCommands)
+			pollfd pollFd{ runFd, POLLIN, 0 };
+			poll(&pollFd, 1, WATCH_RUN_STOP_MILLISECONDS);
+			if(!Lex::Posix::TryReapChild(runPid, status))
 			{
-				std::cout << SHELL_NAME << ": ! " << i << ": ";
-				cmdIter->Print(std::cout);
-				std::cout << std::endl;
+				kill(-runPid, SIGKILL);
+				if(!Lex::Posix::WaitForChild(runPid, status, ErrorPrefix(WATCH_RUN_COMMAND)))
+					status = EXIT_FAILURE << 8;
 			}
 		}
+		if(runFd >= 0)
+			close(runFd);
+		return Lex::Posix::WaitStatusToExitStatus(status);
+	}
+
+	//+------------------------\----------------------------------
+	//|		    Profile		   |
+	//\------------------------/----------------------------------
+	bool WaitForForegroundChild(const ChildProcess& child, int& statusOut, const std::string& perrorMessage)
+	{
+		rusage usage;
+		if(!Lex::Posix::WaitForChild(child.pid, statusOut, perrorMessage, &usage))
+			return false;
+		Lex::Stats::Nanoseconds user{ Lex::Stats::ToNanoseconds(usage.ru_utime) };
+		Lex::Stats::Nanoseconds system{ Lex::Stats::ToNanoseconds(usage.ru_stime) };
+		childUsage.user += user;
+		childUsage.system += system;
+		childUsage.maxResidentKilobytes = std::max(childUsage.maxResidentKilobytes, usage.ru_maxrss);
+		if(profileFormat == ProfileFormat::None)
+			return true;
+
+		// Stages of a pipeline are reaped in order, so a stage's exit is seen no earlier than the one before it
+		Lex::Stats::Nanoseconds reaped{ Lex::Stats::Now() };
+		CommandProfile& profile{ commandProfiles.try_emplace(std::string{ child.name }).first->second };
+		profile.wall.Add(reaped - child.spawnStart);
+		profile.spawn.Add(child.spawnEnd - child.spawnStart);
+		profile.user += user;
+		profile.system += system;
+		profile.maxResidentKilobytes = std::max(profile.maxResidentKilobytes, usage.ru_maxrss);
+		spawnTimes.Add(child.spawnEnd - child.spawnStart);
+		runTimes.Add(reaped - child.spawnEnd);
+
+		// Pipeline stages overlap, so the line's command time grows by what was waited for
+		static Lex::Stats::Nanoseconds lastReaped{ 0 };
+		commandTime += reaped - std::max(child.spawnStart, lastReaped);
+		lastReaped = reaped;
+		return true;
+	}
+	int ExecuteTimedPipeline(const Pipeline& pipeline)
+	{
+		// Words after time are the command
+		Pipeline timedPipeline{ pipeline };
+		Command& firstCommand{ timedPipeline.commands[0] };
+		if(firstCommand.arguments.empty())
+			firstCommand.name = {};
+		else
+		{
+			firstCommand.name = firstCommand.arguments[0];
+			firstCommand.arguments.erase(firstCommand.arguments.begin());
+		}
+
+		// The shell's own usage covers builtins, the children's covers everything it waited for
+		rusage selfUsageBefore;
+		getrusage(RUSAGE_SELF, &selfUsageBefore);
+		const ChildUsage childUsageBefore{ childUsage };
+		childUsage.maxResidentKilobytes = 0;
+		Lex::Stats::Nanoseconds start{ Lex::Stats::Now() };
+
+		int exitStatus{ ExecutePipeline(timedPipeline) };
+
+		Lex::Stats::Nanoseconds real{ Lex::Stats::Now() - start };
+		rusage selfUsage;
+		getrusage(RUSAGE_SELF, &selfUsage);
+		Lex::Stats::Nanoseconds user{ childUsage.user - childUsageBefore.user + 
+									  Lex::Stats::ToNanoseconds(selfUsage.ru_utime) - Lex::Stats::ToNanoseconds(selfUsageBefore.ru_utime) };
+		Lex::Stats::Nanoseconds system{ childUsage.system - childUsageBefore.system + 
+										Lex::Stats::ToNanoseconds(selfUsage.ru_stime) - Lex::Stats::ToNanoseconds(selfUsageBefore.ru_stime) };
+		long maxResidentKilobytes{ childUsage.maxResidentKilobytes };
+		childUsage.maxResidentKilobytes = std::max(maxResidentKilobytes, childUsageBefore.maxResidentKilobytes);
+
+		std::cout.flush();
+		std::cerr << "\nreal\t" << FormatDuration(real) << "\nuser\t" << FormatDuration(user) 
+				  << "\nsys\t" << FormatDuration(system) << "\nmaxrss\t" << maxResidentKilobytes << " KiB" << std::endl;
+		return exitStatus;
+	}
+	void RecordBuiltinProfile(std::string_view name, Lex::Stats::Nanoseconds start, Lex::Stats::Nanoseconds commandTimeBefore, const rusage& selfUsageBefore)
+	{
+		Lex::Stats::Nanoseconds wall{ Lex::Stats::Now() - start };
+		rusage selfUsage;
+		getrusage(RUSAGE_SELF, &selfUsage);
+		CommandProfile& profile{ commandProfiles.try_emplace(std::string{ name }).first->second };
+		profile.wall.Add(wall);
+		profile.user += Lex::Stats::ToNanoseconds(selfUsage.ru_utime) - Lex::Stats::ToNanoseconds(selfUsageBefore.ru_utime);
+		profile.system += Lex::Stats::ToNanoseconds(selfUsage.ru_stime) - Lex::Stats::ToNanoseconds(selfUsageBefore.ru_stime);
+
+		// Replaces what children waited for inside the builtin (ex: time, wait) added, so nothing counts twice
+		commandTime = commandTimeBefore + wall;
+	}
+	void PrintProfile(std::ostream& os)
+	{
+		// Columns: name, count, total, mean, 50th/99th percentile, max
+		auto printRow = [&os](std::string_view name, const Lex::Stats::Histogram& histogram) {
+			os << std::left << std::setw(12) << name << std::right << std::setw(8) << histogram.Count();
+			for(Lex::Stats::Nanoseconds value : { histogram.Sum(), histogram.Mean(), histogram.Percentile(0.5), 
+												  histogram.Percentile(0.99), histogram.Max() })
+				os << std::setw(11) << FormatDuration(value);
+		};
+		auto printHeader = [&os](std::string_view title) {
+			os << std::left << std::setw(12) << title << std::right << std::setw(8) << "count";
+			for(const char* column : { "total", "mean", "p50", "p99", "max" })
+				os << std::setw(11) << column;
+		};
+
+		os << SHELL_NAME << " profile\n";
+		printHeader("phase");
+		os << '\n';
+		printRow("parse", parseTimes);
+		os << '\n';
+		printRow("dispatch", dispatchTimes);
+		os << '\n';
+		printRow("spawn", spawnTimes);
+		os << '\n';
+		printRow("run", runTimes);
+		os << "\n\n";
+
+		printHeader("command");
+		os << std::setw(11) << "user" << std::setw(11) << "sys" << std::setw(11) << "spawn p50" << std::setw(12) << "maxrss KiB" << '\n';
+		for(auto const& [name, profile] : commandProfiles)
+		{
+			printRow(name, profile.wall);
+			os << std::setw(11) << FormatDuration(profile.user) << std::setw(11) << FormatDuration(profile.system)
+			   << std::setw(11) << (profile.spawn.Count() ? FormatDuration(profile.spawn.Percentile(0.5)) : "-")
+			   << std::setw(12) << profile.maxResidentKilobytes << '\n';
+		}
+		os.flush();
+	}
+	void PrintProfileJson(std::ostream& os)
+	{
+		// Durations in nanoseconds
+		auto printHistogram = [&os](const Lex::Stats::Histogram& histogram) {
+			os << "{\"count\":" << histogram.Count() << ",\"total_ns\":" << histogram.Sum() 
+			   << ",\"min_ns\":" << histogram.Min() << ",\"mean_ns\":" << histogram.Mean()
+			   << ",\"p50_ns\":" << histogram.Percentile(0.5) << ",\"p90_ns\":" << histogram.Percentile(0.9)
+			   << ",\"p99_ns\":" << histogram.Percentile(0.99) << ",\"max_ns\":" << histogram.Max() << '}';
+		};
+		os << "{\"phases\":{\"parse\":";
+		printHistogram(parseTimes);
+		os << ",\"dispatch\":";
+		printHistogram(dispatchTimes);
+		os << ",\"spawn\":";
+		printHistogram(spawnTimes);
+		os << ",\"run\":";
+		printHistogram(runTimes);
+		os << "},\"commands\":{";
+		bool first{ true };
+		for(auto const& [name, profile] : commandProfiles)
+		{
+			if(!first)
+				os << ',';
+			first = false;
+			Lex::Strings::PrintJsonString(os, name);
+			os << ":{\"wall\":";
+			printHistogram(profile.wall);
+			os << ",\"spawn\":";
+			printHistogram(profile.spawn);
+			os << ",\"user_ns\":" << profile.user << ",\"system_ns\":" << profile.system
+			   << ",\"max_rss_kib\":" << profile.maxResidentKilobytes << '}';
+		}
+		os << "}}" << std::endl;
+	}
+	std::string FormatDuration(Lex::Stats::Nanoseconds duration)
+	{
+		// Three significant-ish digits in the largest unit that keeps the number at least 1
+		char text[32];
+		if(duration < 1000)
+			std::snprintf(text, sizeof(text), "%lldns", static_cast<long long>(duration));
+		else if(duration < 1000000)
+			std::snprintf(text, sizeof(text), "%.1fus", duration / 1e3);
+		else if(duration < 1000000000)
+			std::snprintf(text, sizeof(text), "%.2fms", duration / 1e6);
+		else
+			std::snprintf(text, sizeof(text), "%.3fs", duration / 1e9);
+		return text;
 	}
 }
 
-int main()
+// lesh_bench compiles this file in without main
+#ifndef LESH_NO_MAIN
+int RunWithArguments(int argc, char* argv[])
 {
+	// lesh -c 'commands'
+	if(argc > 1 && argv[1] == Lesh::COMMAND_STRING_OPTION)
+	{
+		if(argc < 3)
+		{
+			std::cerr << Lesh::SHELL_NAME << ": " << Lesh::COMMAND_STRING_OPTION << ": option requires an argument" << std::endl;
+			return Lesh::EXIT_STATUS_SYNTAX_ERROR;
+		}
+		return Lesh::RunScript(argv[2], Lesh::SHELL_NAME);
+	}
+
+	// lesh scriptFile
+	if(argc > 1)
+	{
+		std::string scriptText;
+		if(!Lex::Posix::ReadFile(argv[1], scriptText))
+		{
+			perror((Lesh::SHELL_NAME + ": " + argv[1]).c_str());
+			return Lesh::EXIT_STATUS_NOT_FOUND;
+		}
+		return Lesh::RunScript(scriptText, argv[1]);
+	}
+
+	// Interactive
 	return Lesh::RunLesh();
 }
+int main(int argc, char* argv[])
+{
+	Lesh::spliceMiddleStages = (Lesh::shellVariables.Get(Lesh::SPLICE_PIPES_VARIABLE) != nullptr);
 
+	// lesh --profile[=json] ...: report where the time went on stderr at exit
+	if(argc > 1 && (argv[1] == Lesh::PROFILE_OPTION || argv[1] == Lesh::PROFILE_JSON_OPTION))
+	{
+		Lesh::profileFormat = (argv[1] == Lesh::PROFILE_OPTION) ? Lesh::ProfileFormat::Text : Lesh::ProfileFormat::Json;
+		--argc;
+		++argv;
+	}
 
-
+	int exitStatus{ RunWithArguments(argc, argv) };
+	Lesh::StopPathCommandsThread();
+	if(Lesh::profileFormat == Lesh::ProfileFormat::Text)
+		Lesh::PrintProfile(std::cerr);
+	else if(Lesh::profileFormat == Lesh::ProfileFormat::Json)
+		Lesh::PrintProfileJson(std::cerr);
+	return exitStatus;
+}
+#endif
@@ -12,81 +12,394 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <limits>
+#include <cstdio>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <ctime>
 #include <unistd.h>
+#include <pwd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 #include <sys/wait.h>
+#include <dirent.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <sys/ioctl.h>
+#include <termios.h>
 
 namespace Lex
 {
 	namespace WordLists
 	{
-		void Separate(const std::string& input, const std::vector<char>& whitespaceChars, std::vector<std::string>& wordsOut)
+		SplitRules::SplitRules(std::string_view whitespaceChars, const std::vector<std::string>& operators, char commentChar, char expansionChar)
+			: operators{ operators }
 		{
-			// Go char by char, finding the start and end of each word, and making a list
-			wordsOut.clear();
-			for(std::string::size_type currentChar = 0, currentWordStart = 0; currentChar < input.size(); ++currentChar)
+			std::fill(std::begin(charTypes), std::end(charTypes), CharType::Plain);
+			for(char c : whitespaceChars)
+				charTypes[static_cast<unsigned char>(c)] = CharType::Whitespace;
+			for(const std::string& op : operators)
+				if(!op.empty())
+					charTypes[static_cast<unsigned char>(op[0])] = CharType::OperatorStart;
+			charTypes[static_cast<unsigned char>('\'')] = CharType::SingleQuote;
+			charTypes[static_cast<unsigned char>('"')] = CharType::DoubleQuote;
+			charTypes[static_cast<unsigned char>('\\')] = CharType::Escape;
+			charTypes[static_cast<unsigned char>(commentChar)] = CharType::Comment;
+			if(expansionChar != '\0')
+				charTypes[static_cast<unsigned char>(expansionChar)] = CharType::Expansion;
+			std::stable_sort(this->operators.begin(), this->operators.end(), 
+				[](const std::string& a, const std::string& b) { return a.size() > b.size(); });
+		}
+		std::size_t SplitRules::MatchOperator(std::string_view text) const
+		{
+			for(const std::string& op : operators)
+				if(!op.empty() && text.compare(0, op.size(), op) == 0)
+					return op.size();
+			return 0;
+		}
+		bool SplitRules::NeedsQuoting(std::string_view word) const
+		{
+			if(word.empty() || TypeOf(word[0]) == CharType::Comment)
+				return true;
+			for(char c : word)
+			{
+				CharType type{ TypeOf(c) };
+				if(type != CharType::Plain && type != CharType::Comment)
+					return true;
+			}
+			return false;
+		}
+		namespace
+		{
+			// Index of the ) closing a command substitution whose text starts at start, skipping quoted 
+			// and escaped characters and nested parentheses. npos if there is none.
+			std::size_t FindSubstitutionEnd(std::string_view input, std::size_t start)
+			{
+				int depth{ 1 };
+				for(std::size_t i = start; i < input.size(); ++i)
+				{
+					char c{ input[i] };
+					if(c == '\\')
+						++i;
+					else if(c == '\'')
+					{
+						i = input.find('\'', i + 1);
+						if(i == std::string_view::npos)
+							return i;
+					}
+					else if(c == '"')
+					{
+						for(++i; i < input.size() && input[i] != '"'; ++i)
+							if(input[i] == '\\')
+								++i;
+					}
+					else if(c == '(')
+						++depth;
+					else if(c == ')' && --depth == 0)
+						return i;
+				}
+				return std::string_view::npos;
+			}
+
+			// Copies the expansion character at input[read] to write, as mark if it starts an expansion. 
+			// False on an unterminated command substitution.
+			bool CopyExpansion(std::string_view input, std::size_t& read, char*& write, char mark)
 			{
-				// If current character is whitespace
-				if(std::find(whitespaceChars.begin(), whitespaceChars.end(), input[currentChar]) != whitespaceChars.end())
+				char next{ (read + 1 < input.size()) ? input[read + 1] : '\0' };
+				if(next == '(')
 				{
-					// If current word has any characters, record the word
-					if(currentChar > currentWordStart)
-						wordsOut.push_back(input.substr(currentWordStart, currentChar - currentWordStart));
+					std::size_t end{ FindSubstitutionEnd(input, read + 2) };
+					if(end == std::string_view::npos)
+						return false;
+					*write++ = mark;
+					*write++ = '(';
+					std::memcpy(write, input.data() + read + 2, end - read - 2);
+					write += end - read - 2;
+					*write++ = SUBSTITUTION_END_MARK;
+					read = end + 1;
+					return true;
+				}
+				bool startsExpansion{ next == '{' || next == '?' || next == '$' || next == '_' || std::isalpha(static_cast<unsigned char>(next)) };
+				*write++ = startsExpansion ? mark : input[read];
+				++read;
+				return true;
+			}
+		}
+		bool Split(std::string_view input, char* wordBuffer, const SplitRules& rules, WordVector& wordsOut)
+		{
+			// Each word is written to wordBuffer followed by '\0'. A word takes at most one more char than it 
+			// took in input, and is at least one char long or took two (""), so 2 * input.size() is enough.
+			using CharType = SplitRules::CharType;
+			wordsOut.clear();
+			const char* in{ input.data() };
+			const std::size_t size{ input.size() };
+			std::size_t read{ 0 };
+			char* write{ wordBuffer };
+			while(true)
+			{
+				while(read < size && rules.TypeOf(in[read]) == CharType::Whitespace)
+					++read;
+				if(read == size || rules.TypeOf(in[read]) == CharType::Comment)
+					return true;
 
-					// Next word needs to start on next character, any time a whitespace character is encountered, no matter if a word was recorded or not
-					currentWordStart = currentChar + 1;
+				// Operator
+				if(rules.TypeOf(in[read]) == CharType::OperatorStart)
+				{
+					std::size_t length{ rules.MatchOperator(std::string_view{ in + read, size - read }) };
+					if(length > 0)
+					{
+						std::memcpy(write, in + read, length);
+						wordsOut.push_back(Word{ std::string_view{ write, length }, true, false });
+						write += length;
+						*write++ = '\0';
+						read += length;
+						continue;
+					}
 				}
 
-				// If we are at the last character
-				if(currentChar + 1 == input.size())
+				// Word: runs of plain characters are copied at once, quotes and escapes char by char
+				char* wordStart{ write };
+				bool quoted{ false };
+				while(read < size)
 				{
-					// If current word has any characters, record the word
-					if(currentChar + 1 > currentWordStart)
-						wordsOut.push_back(input.substr(currentWordStart, (currentChar + 1) - currentWordStart));
+					std::size_t runEnd{ read };
+					while(runEnd < size && (rules.TypeOf(in[runEnd]) == CharType::Plain || rules.TypeOf(in[runEnd]) == CharType::Comment))
+						++runEnd;
+					if(runEnd > read)
+					{
+						std::memcpy(write, in + read, runEnd - read);
+						write += runEnd - read;
+						read = runEnd;
+						continue;
+					}
+
+					CharType type{ rules.TypeOf(in[read]) };
+					if(type == CharType::Whitespace)
+						break;
+					if(type == CharType::OperatorStart)
+					{
+						if(rules.MatchOperator(std::string_view{ in + read, size - read }) > 0)
+							break;
+						*write++ = in[read++];
+					}
+					else if(type == CharType::Expansion)
+					{
+						if(!CopyExpansion(input, read, write, EXPANSION_MARK))
+							return false;
+					}
+					else if(type == CharType::Escape)
+					{
+						// A trailing backslash is kept
+						quoted = true;
+						if(read + 1 < size)
+							++read;
+						*write++ = in[read++];
+					}
+					else if(type == CharType::SingleQuote)
+					{
+						quoted = true;
+						const void* closeQuote{ std::memchr(in + read + 1, '\'', size - read - 1) };
+						if(!closeQuote)
+							return false;
+						std::size_t length{ static_cast<std::size_t>(static_cast<const char*>(closeQuote) - (in + read + 1)) };
+						std::memcpy(write, in + read + 1, length);
+						write += length;
+						read += length + 2;
+					}
+					else
+					{
+						quoted = true;
+						for(++read; ; )
+						{
+							if(read == size)
+								return false;
+							if(in[read] == '"')
+								break;
+							if(rules.TypeOf(in[read]) == CharType::Expansion)
+							{
+								if(!CopyExpansion(input, read, write, QUOTED_EXPANSION_MARK))
+									return false;
+								continue;
+							}
+							if(in[read] == '\\' && read + 1 < size && in[read + 1] != '\0' && std::strchr("\\\"$`", in[read + 1]))
+								++read;
+							*write++ = in[read++];
+						}
+						++read;
+					}
 				}
+				wordsOut.push_back(Word{ std::string_view{ wordStart, static_cast<std::size_t>(write - wordStart) }, false, quoted });
+				*write++ = '\0';
 			}
 		}
-		void Print(std::ostream& os, const std::vector<std::string>& wordList)
+		void Print(std::ostream& os, const WordList& wordList, const SplitRules& rules)
 		{
-			for(std::vector<std::string>::size_type i = 0; i < wordList.size(); ++i)
+			for(WordList::size_type i = 0; i < wordList.size(); ++i)
 			{
-				os << wordList[i];
+				PrintWord(os, wordList[i], rules);
 				if(i < wordList.size() - 1)
 					os << ' ';
 			}
 		}
+		void PrintWord(std::ostream& os, std::string_view word, const SplitRules& rules)
+		{
+			const char marks[]{ EXPANSION_MARK, QUOTED_EXPANSION_MARK, '\0' };
+			if(word.find_first_of(marks) != std::string_view::npos)
+			{
+				for(char c : word)
+					os << ((c == EXPANSION_MARK || c == QUOTED_EXPANSION_MARK) ? '$' : (c == SUBSTITUTION_END_MARK) ? ')' : c);
+				return;
+			}
+			if(!rules.NeedsQuoting(word))
+			{
+				os << word;
+				return;
+			}
+			os << '\'';
+			for(char c : word)
+			{
+				if(c == '\'')
+					os << "'\\''";
+				else
+					os << c;
+			}
+			os << '\'';
+		}
 	}
 
 	namespace Posix
 	{
-		bool GetUser(std::string& userOut)
+		bool GetUser(const Environment& environment, std::string& userOut)
 		{
-			char* user{ getenv("USER") };
+			const char* user{ environment.Get("USER") };
 			if(!user)
-				return false;
+			{
+				struct passwd* entry{ getpwuid(geteuid()) };
+				if(!entry)
+					return false;
+				user = entry->pw_name;
+			}
 			userOut = user;
 			return true;
 		}
-		bool GetHomeDirectory(std::string& homeOut)
+		bool GetHomeDirectory(const Environment& environment, std::string& homeOut)
 		{
-			char* home{ getenv("HOME") };
+			const char* home{ environment.Get("HOME") };
 			if(!home)
-				return false;
+			{
+				struct passwd* entry{ getpwuid(geteuid()) };
+				if(!entry)
+					return false;
+				home = entry->pw_dir;
+			}
 			homeOut = home;
 			return true;
 		}
 		bool GetWorkingDirectory(std::string& pathOut)
 		{
-			char cwd[512];
-			char* result;
-			result = getcwd(cwd, sizeof(cwd));
-			if(!result)
-				return false;
-			pathOut = cwd;
+			// Grow the buffer until the path fits
+			std::string cwd(512, '\0');
+			while(!getcwd(cwd.data(), cwd.size()))
+			{
+				if(errno != ERANGE)
+					return false;
+				cwd.resize(cwd.size() * 2);
+			}
+			cwd.resize(std::strlen(cwd.c_str()));
+			pathOut = std::move(cwd);
 			return true;
 		}
 		bool ChangeWorkingDirectory(const std::string& path)
 		{
-			return chdir(path.c_str());
+			return chdir(path.c_str()) == 0;
+		}
+		bool ReadFile(const std::string& path, std::string& contentsOut)
+		{
+			int fd{ open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+			if(fd < 0)
+				return false;
+
+			// Size the string once from fstat, then keep reading in case the file grows
+			contentsOut.clear();
+			struct stat fileInfo;
+			if(fstat(fd, &fileInfo) == 0 && fileInfo.st_size > 0)
+				contentsOut.reserve(static_cast<std::string::size_type>(fileInfo.st_size));
+			char buffer[1 << 16];
+			while(true)
+			{
+				ssize_t bytesRead{ read(fd, buffer, sizeof(buffer)) };
+				if(bytesRead == 0)
+					break;
+				if(bytesRead < 0)
+				{
+					if(errno == EINTR)
+						continue;
+					int savedErrno{ errno };
+					close(fd);
+					errno = savedErrno;
+					return false;
+				}
+				contentsOut.append(buffer, static_cast<std::string::size_type>(bytesRead));
+			}
+			close(fd);
+			return true;
+		}
+		LineReader::LineReader(int fd)
+			: fd{ fd }, 
+			  buffer(1 << 16)
+		{}
+		bool LineReader::ReadLine(std::string_view& lineOut)
+		{
+			while(true)
+			{
+				// Each byte is searched once, however many reads a line takes
+				char* data{ buffer.data() };
+				if(const void* newline{ std::memchr(data + scanned, '\n', dataEnd - scanned) })
+				{
+					std::size_t lineEnd{ static_cast<std::size_t>(static_cast<const char*>(newline) - data) };
+					lineOut = std::string_view{ data + lineStart, lineEnd - lineStart };
+					lineStart = scanned = lineEnd + 1;
+					return true;
+				}
+				scanned = dataEnd;
+				if(endOfInput)
+				{
+					if(lineStart == dataEnd)
+					{
+						errno = 0;
+						return false;
+					}
+					lineOut = std::string_view{ data + lineStart, dataEnd - lineStart };
+					lineStart = scanned;
+					return true;
+				}
+
+				// Make room after the unfinished line: move it to the front, and grow if it fills the buffer
+				if(lineStart > 0)
+				{
+					std::memmove(data, data + lineStart, dataEnd - lineStart);
+					dataEnd -= lineStart;
+					scanned = dataEnd;
+					lineStart = 0;
+				}
+				if(dataEnd == buffer.size())
+					buffer.resize(2 * buffer.size());
+				ssize_t bytesRead{ read(fd, buffer.data() + dataEnd, buffer.size() - dataEnd) };
+				if(bytesRead > 0)
+					dataEnd += static_cast<std::size_t>(bytesRead);
+				else if(bytesRead == 0)
+					endOfInput = true;
+				else if(errno != EINTR)
+					return false;
+			}
 		}
 		/*void ExecuteExternalApp(const Command& command)
 		{
@@ -156,92 +469,1859 @@ namespace Lex
 				}
 			}
 		}*/
-		bool ExecuteExternalAppAndWait(const std::string& pathToApp, 
-								const std::vector<std::string>& arguments, 
-								const std::string& perrorMessage)
+		namespace
 		{
-			if(pathToApp.empty())
-				return false;
-
-			errno = 0;
-			pid_t child_pid;
-			child_pid = fork();
-
-			// Fork failed
-			if(child_pid < 0)
+			// Build null-terminated argv in the parent, pointing into existing strings. argv[0] is the app name without its path.
+			void BuildArgumentVector(std::string_view pathToApp, const WordLists::WordList& arguments, std::pmr::vector<char*>& argvOut)
 			{
-				perror(perrorMessage.c_str());
-				return false;
+				argvOut.clear();
+				argvOut.reserve(arguments.size() + 2);
+				{
+					std::size_t endOfPathIndex{ pathToApp.find_last_of('/') };
+					const char* appName{ pathToApp.data() };
+					if(endOfPathIndex != std::string_view::npos)
+						appName += endOfPathIndex + 1;
+					argvOut.push_back(const_cast<char*>(appName));
+				}
+				for(auto const& arg : arguments)
+					argvOut.push_back(const_cast<char*>(arg.data()));
+				argvOut.push_back(nullptr);
 			}
 
-			// Child of fork
-			if(child_pid == 0)
+			// Apply file actions directly. Only called in a forked child.
+			bool ApplyFileActions(const SpawnFileActionList& fileActions)
 			{
-				// Convert command to c-style string list 
-				std::vector<char*> cStyleStringList;
+				for(auto const& action : fileActions)
 				{
-					// Separate path from app name and only put name in argv[0] while sending the full path to execvp 
+					switch(action.type)
 					{
-						std::string appName;
+					case SpawnFileAction::Type::Open:
+					{
+						int openedFd{ open(action.path.c_str(), action.flags, action.mode) };
+						if(openedFd < 0)
+							return false;
+						if(openedFd != action.fd)
 						{
-							std::size_t endOfPathIndex{ pathToApp.find_last_of('/') };
-							if(endOfPathIndex == std::string::npos)
-								appName = pathToApp;
-							else
-								appName = pathToApp.substr(endOfPathIndex + 1);
+							if(dup2(openedFd, action.fd) < 0)
+								return false;
+							close(openedFd);
 						}
-						cStyleStringList.emplace_back(const_cast<char*>(appName.c_str()));
+						break;
 					}
+					case SpawnFileAction::Type::Duplicate:
+						if(dup2(action.sourceFd, action.fd) < 0)
+							return false;
+						break;
+					case SpawnFileAction::Type::Close:
+						close(action.fd);
+						break;
+					}
+				}
+				return true;
+			}
+		}
+		bool FindExecutableInPath(const std::string& appName, const std::string& searchPath, std::string& pathOut)
+		{
+			if(appName.empty())
+				return false;
 
-					// Add arguments
-					for(auto const& arg : arguments)
-						cStyleStringList.emplace_back(const_cast<char*>(arg.c_str()));
+			std::string candidate;
+			for(std::string::size_type directoryStart = 0; directoryStart <= searchPath.size();)
+			{
+				std::string::size_type directoryEnd{ searchPath.find(':', directoryStart) };
+				if(directoryEnd == std::string::npos)
+					directoryEnd = searchPath.size();
 
-					// exec expects null-terminated array
-					cStyleStringList.push_back(nullptr);
+				// Empty entry means current directory
+				if(directoryEnd == directoryStart)
+					candidate = ".";
+				else
+					candidate.assign(searchPath, directoryStart, directoryEnd - directoryStart);
+				candidate += '/';
+				candidate += appName;
+
+				struct stat fileInfo;
+				if(stat(candidate.c_str(), &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) && access(candidate.c_str(), X_OK) == 0)
+				{
+					pathOut = candidate;
+					return true;
 				}
+				directoryStart = directoryEnd + 1;
+			}
+			return false;
+		}
+		bool SpawnExternalApp(std::string_view pathToApp,
+							  const WordLists::WordList& arguments,
+							  const SpawnFileActionList& fileActions,
+							  char* const* envp,
+							  pid_t& childPidOut)
+		{
+			if(pathToApp.empty())
+			{
+				errno = ENOENT;
+				return false;
+			}
 
-				// execute program
-				errno = 0;
-				int result = execvp(pathToApp.c_str(), cStyleStringList.data());
+			// argv comes from the same memory as the arguments
+			std::pmr::vector<char*> argv{ arguments.get_allocator() };
+			BuildArgumentVector(pathToApp, arguments, argv);
 
-				// If execvp failed, print error and terminate child process
-				if(result < 0)
+			posix_spawn_file_actions_t spawnFileActions;
+			posix_spawn_file_actions_t* spawnFileActionsPtr{ nullptr };
+			if(!fileActions.empty())
+			{
+				posix_spawn_file_actions_init(&spawnFileActions);
+				spawnFileActionsPtr = &spawnFileActions;
+				for(auto const& action : fileActions)
 				{
-					perror(perrorMessage.c_str());
-					exit(EXIT_FAILURE);
+					switch(action.type)
+					{
+					case SpawnFileAction::Type::Open:
+						posix_spawn_file_actions_addopen(spawnFileActionsPtr, action.fd, action.path.c_str(), action.flags, action.mode);
+						break;
+					case SpawnFileAction::Type::Duplicate:
+						posix_spawn_file_actions_adddup2(spawnFileActionsPtr, action.sourceFd, action.fd);
+						break;
+					case SpawnFileAction::Type::Close:
+						posix_spawn_file_actions_addclose(spawnFileActionsPtr, action.fd);
+						break;
+					}
 				}
 			}
-			// Parent of fork
+
+			// posix_spawn reports exec failures (ex: ENOENT) as its return value
+			int result;
+			if(pathToApp.find('/') != std::string_view::npos)
+				result = posix_spawn(&childPidOut, pathToApp.data(), spawnFileActionsPtr, nullptr, argv.data(), envp);
 			else
+				result = posix_spawnp(&childPidOut, pathToApp.data(), spawnFileActionsPtr, nullptr, argv.data(), envp);
+			if(spawnFileActionsPtr)
+				posix_spawn_file_actions_destroy(spawnFileActionsPtr);
+			if(result != 0)
 			{
-				// Wait for child to finish
-				errno = 0;
-				if(waitpid(child_pid, nullptr, WUNTRACED) < 0)
+				errno = result;
+				return false;
+			}
+			return true;
+		}
+		bool ForkAndRun(const std::function<int()>& childMain,
+						const SpawnFileActionList& fileActions,
+						pid_t& childPidOut,
+						const std::string& perrorMessage)
+		{
+			errno = 0;
+			childPidOut = fork();
+
+			// Fork failed
+			if(childPidOut < 0)
+			{
+				perror(perrorMessage.c_str());
+				return false;
+			}
+
+			// Child of fork
+			if(childPidOut == 0)
+			{
+				if(!ApplyFileActions(fileActions))
 				{
 					perror(perrorMessage.c_str());
-					return false;
+					_exit(EXIT_FAILURE);
 				}
+				int exitStatus{ childMain() };
+				std::fflush(nullptr);
+				_exit(exitStatus);
 			}
 			return true;
 		}
-	}
+		bool WaitForChild(pid_t childPid, int& statusOut, const std::string& perrorMessage, rusage* usageOut)
+		{
+			errno = 0;
+			while(wait4(childPid, &statusOut, WUNTRACED, usageOut) < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				perror(perrorMessage.c_str());
+				return false;
+			}
+			return true;
+		}
+		int WaitStatusToExitStatus(int waitStatus)
+		{
+			const int SIGNAL_EXIT_STATUS_BASE{ 128 };
+			if(WIFEXITED(waitStatus))
+				return WEXITSTATUS(waitStatus);
+			if(WIFSIGNALED(waitStatus))
+				return SIGNAL_EXIT_STATUS_BASE + WTERMSIG(waitStatus);
+			if(WIFSTOPPED(waitStatus))
+				return SIGNAL_EXIT_STATUS_BASE + WSTOPSIG(waitStatus);
+			return EXIT_FAILURE;
+		}
+		bool TryReapChild(pid_t childPid, int& statusOut)
+		{
+			pid_t result;
+			do
+				result = waitpid(childPid, &statusOut, WNOHANG);
+			while(result < 0 && errno == EINTR);
 
-	namespace Strings
-	{
-		bool ToInt(const std::string& str, int& out)
+			// Already reaped or not our child counts as gone
+			return result == childPid || (result < 0 && errno == ECHILD);
+		}
+		int OpenProcessFd(pid_t pid)
 		{
-			try {
-				std::string::size_type nextCharPos;
-				out = std::stoi(str, &nextCharPos);
-				if(nextCharPos == str.size())
-					return true;
+#ifdef SYS_pidfd_open
+			return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+			errno = ENOSYS;
+			return -1;
+#endif
+		}
+		bool WaitForProcessFds(const std::vector<int>& processFds, int timeoutMilliseconds)
+		{
+			const int MISSING_FD_POLL_MILLISECONDS{ 100 };
+
+			std::vector<pollfd> pollFds;
+			pollFds.reserve(processFds.size());
+			bool missingFd{ false };
+			for(int fd : processFds)
+			{
+				if(fd >= 0)
+					pollFds.push_back({ fd, POLLIN, 0 });
+				else
+					missingFd = true;
+			}
+			if(pollFds.empty() && !missingFd)
+				return true;
+			if(missingFd && (timeoutMilliseconds < 0 || timeoutMilliseconds > MISSING_FD_POLL_MILLISECONDS))
+				timeoutMilliseconds = MISSING_FD_POLL_MILLISECONDS;
+			return poll(pollFds.data(), pollFds.size(), timeoutMilliseconds) >= 0 || errno == EINTR;
+		}
+		ScopedPlacement::ScopedPlacement(const Placement& placement)
+		{
+			// The memory policy calls have no glibc wrappers without libnuma. Their node mask sizes count one extra bit.
+			CPU_ZERO(&savedCpus);
+			if(CPU_COUNT(&placement.cpus) > 0)
+			{
+				if(sched_getaffinity(0, sizeof(savedCpus), &savedCpus) == 0 && 
+				   sched_setaffinity(0, sizeof(placement.cpus), &placement.cpus) == 0)
+					cpusChanged = true;
+				else
+					applied = false;
+			}
+			if(applied && placement.memoryNodes != 0)
+			{
+				unsigned long memoryNodes{ static_cast<unsigned long>(placement.memoryNodes) };
+				if(syscall(SYS_get_mempolicy, &savedMemoryMode, &savedMemoryNodes, MAX_MEMORY_NODES + 1, nullptr, 0) == 0 && 
+				   syscall(SYS_set_mempolicy, MPOL_BIND, &memoryNodes, MAX_MEMORY_NODES + 1) == 0)
+					memoryChanged = true;
 				else
+					applied = false;
+			}
+		}
+		ScopedPlacement::~ScopedPlacement()
+		{
+			int savedErrno{ errno };
+			if(memoryChanged)
+				syscall(SYS_set_mempolicy, savedMemoryMode, (savedMemoryMode == MPOL_DEFAULT) ? nullptr : &savedMemoryNodes, 
+						MAX_MEMORY_NODES + 1);
+			if(cpusChanged)
+				sched_setaffinity(0, sizeof(savedCpus), &savedCpus);
+			errno = savedErrno;
+		}
+		bool ParseCpuList(std::string_view text, cpu_set_t& cpusOut)
+		{
+			CPU_ZERO(&cpusOut);
+			while(!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+				text.remove_suffix(1);
+			if(text.empty())
+				return false;
+			while(true)
+			{
+				std::string_view::size_type commaPos{ text.find(',') };
+				std::string_view range{ text.substr(0, commaPos) };
+				std::string_view::size_type dashPos{ range.find('-') };
+				int first;
+				int last;
+				if(!Strings::ToInt(range.substr(0, dashPos), first) || 
+				   !Strings::ToInt((dashPos == std::string_view::npos) ? range : range.substr(dashPos + 1), last) || 
+				   first < 0 || last < first || last >= CPU_SETSIZE)
 					return false;
+				for(int cpu = first; cpu <= last; ++cpu)
+					CPU_SET(cpu, &cpusOut);
+				if(commaPos == std::string_view::npos)
+					return true;
+				text.remove_prefix(commaPos + 1);
+			}
+		}
+		std::string FormatCpuList(const cpu_set_t& cpus)
+		{
+			std::string list;
+			for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			{
+				if(!CPU_ISSET(cpu, &cpus))
+					continue;
+				int last{ cpu };
+				while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus))
+					++last;
+				if(!list.empty())
+					list += ',';
+				list += std::to_string(cpu);
+				if(last > cpu)
+					list += '-' + std::to_string(last);
+				cpu = last;
+			}
+			return list;
+		}
+		bool GetOnlineNodes(std::vector<int>& nodesOut)
+		{
+			// Node ids are listed the same way as CPUs
+			nodesOut.clear();
+			std::string text;
+			cpu_set_t nodes;
+			if(!ReadFile("/sys/devices/system/node/online", text))
+			{
+				nodesOut.push_back(0);
+				return true;
 			}
-			catch(const std::logic_error & e) {
+			if(!ParseCpuList(text, nodes))
+				return false;
+			for(int node = 0; node < CPU_SETSIZE; ++node)
+				if(CPU_ISSET(node, &nodes))
+					nodesOut.push_back(node);
+			return true;
+		}
+		bool GetNodeCpus(int node, cpu_set_t& cpusOut)
+		{
+			std::string text;
+			if(ReadFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", text))
+				return ParseCpuList(text, cpusOut);
+			if(node != 0 || access("/sys/devices/system/node", F_OK) == 0)
+				return false;
+			CPU_ZERO(&cpusOut);
+			for(long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; ++cpu)
+				CPU_SET(cpu, &cpusOut);
+			return true;
+		}
+		bool CreatePipe(int& readFdOut, int& writeFdOut)
+		{
+			int fds[2];
+			if(pipe2(fds, O_CLOEXEC) < 0)
 				return false;
+			readFdOut = fds[0];
+			writeFdOut = fds[1];
+			return true;
+		}
+		namespace
+		{
+			const std::size_t SPLICE_CHUNK_SIZE{ 1 << 20 };
+
+			bool CopyAll(int inFd, int outFd)
+			{
+				std::vector<char> buffer(SPLICE_CHUNK_SIZE);
+				while(true)
+				{
+					ssize_t bytesRead{ read(inFd, buffer.data(), buffer.size()) };
+					if(bytesRead == 0)
+						return true;
+					if(bytesRead < 0)
+					{
+						if(errno == EINTR)
+							continue;
+						return false;
+					}
+					if(!WriteAll(outFd, buffer.data(), static_cast<std::size_t>(bytesRead)))
+						return false;
+				}
+			}
+			// Splice exactly numBytes, retrying short transfers
+			bool SpliceExactly(int inFd, int outFd, std::size_t numBytes)
+			{
+				while(numBytes > 0)
+				{
+					ssize_t moved{ splice(inFd, nullptr, outFd, nullptr, numBytes, SPLICE_F_MOVE) };
+					if(moved <= 0)
+					{
+						if(moved < 0 && errno == EINTR)
+							continue;
+						return false;
+					}
+					numBytes -= static_cast<std::size_t>(moved);
+				}
+				return true;
+			}
+		}
+		bool SpliceAll(int inFd, int outFd)
+		{
+			while(true)
+			{
+				ssize_t moved{ splice(inFd, nullptr, outFd, nullptr, SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE) };
+				if(moved == 0)
+					return true;
+				if(moved < 0)
+				{
+					if(errno == EINTR)
+						continue;
+					if(errno == EINVAL)
+						return CopyAll(inFd, outFd);
+					return false;
+				}
+			}
+		}
+		bool TeeAll(int inFd, int outFd, int copyFd)
+		{
+			while(true)
+			{
+				// tee() leaves the data in inFd, so the same bytes can then be spliced into copyFd
+				ssize_t duplicated{ tee(inFd, outFd, SPLICE_CHUNK_SIZE, 0) };
+				if(duplicated == 0)
+					return true;
+				if(duplicated < 0)
+				{
+					if(errno == EINTR)
+						continue;
+					return false;
+				}
+				if(!SpliceExactly(inFd, copyFd, static_cast<std::size_t>(duplicated)))
+					return false;
 			}
 		}
+		bool WriteAll(int fd, const char* data, std::size_t size)
+		{
+			while(size > 0)
+			{
+				ssize_t written{ write(fd, data, size) };
+				if(written < 0)
+				{
+					if(errno == EINTR)
+						continue;
+					return false;
+				}
+				data += written;
+				size -= static_cast<std::size_t>(written);
+			}
+			return true;
+		}
+		int CreateMemoryFile(const std::string& name)
+		{
+			return memfd_create(name.c_str(), MFD_CLOEXEC);
+		}
+		bool SendFileAll(int inFd, int outFd)
+		{
+			off_t offset{ 0 };
+			while(true)
+			{
+				ssize_t sent{ sendfile(outFd, inFd, &offset, SPLICE_CHUNK_SIZE) };
+				if(sent == 0)
+					return true;
+				if(sent < 0)
+				{
+					if(errno == EINTR)
+						continue;
+					if(errno == EINVAL && offset == 0 && lseek(inFd, 0, SEEK_SET) == 0)
+						return CopyAll(inFd, outFd);
+					return false;
+				}
+			}
+		}
+		AppendOnlyRecordFile::~AppendOnlyRecordFile()
+		{
+			Close();
+		}
+		bool AppendOnlyRecordFile::Open(const std::string& path)
+		{
+			Close();
+			fd = open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+			if(fd < 0)
+				return false;
+			Refresh();
+			return true;
+		}
+		void AppendOnlyRecordFile::Close()
+		{
+			if(mapping)
+				munmap(const_cast<char*>(mapping), mappedSize);
+			mapping = nullptr;
+			mappedSize = 0;
+			if(fd >= 0)
+				close(fd);
+			fd = -1;
+		}
+		bool AppendOnlyRecordFile::IsFileAt(const std::string& path) const
+		{
+			struct stat openStatus;
+			struct stat pathStatus;
+			if(fd < 0 || fstat(fd, &openStatus) != 0 || stat(path.c_str(), &pathStatus) != 0)
+				return false;
+			return openStatus.st_dev == pathStatus.st_dev && openStatus.st_ino == pathStatus.st_ino;
+		}
+		bool AppendOnlyRecordFile::Append(std::string_view record)
+		{
+			if(record.size() > UINT32_MAX)
+			{
+				errno = EFBIG;
+				return false;
+			}
+			std::string buffer;
+			AppendFramed(record, buffer);
+			return WriteBuffer(buffer);
+		}
+		bool AppendOnlyRecordFile::Append(const std::vector<std::string>& records)
+		{
+			std::string buffer;
+			for(const std::string& record : records)
+			{
+				if(record.size() > UINT32_MAX)
+				{
+					errno = EFBIG;
+					return false;
+				}
+				AppendFramed(record, buffer);
+			}
+			return buffer.empty() || WriteBuffer(buffer);
+		}
+		void AppendOnlyRecordFile::AppendFramed(std::string_view record, std::string& buffer)
+		{
+			std::uint32_t length{ static_cast<std::uint32_t>(record.size()) };
+			buffer.reserve(buffer.size() + record.size() + 2 * sizeof(length));
+			buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+			buffer.append(record);
+			buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+		}
+		bool AppendOnlyRecordFile::WriteBuffer(const std::string& buffer)
+		{
+			// One write, so another process's record can't land inside this one
+			while(true)
+			{
+				ssize_t written{ write(fd, buffer.data(), buffer.size()) };
+				if(written == static_cast<ssize_t>(buffer.size()))
+					return true;
+				if(written < 0 && errno == EINTR)
+					continue;
+				if(written >= 0)
+					errno = EIO;
+				return false;
+			}
+		}
+		bool AppendOnlyRecordFile::Refresh()
+		{
+			struct stat fileStatus;
+			if(fd < 0 || fstat(fd, &fileStatus) != 0)
+				return false;
+			Offset fileSize{ static_cast<Offset>(fileStatus.st_size) };
+			if(fileSize == mappedSize)
+				return false;
+
+			if(mapping)
+				munmap(const_cast<char*>(mapping), mappedSize);
+			mapping = nullptr;
+			mappedSize = 0;
+			if(fileSize > 0)
+			{
+				void* newMapping{ mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0) };
+				if(newMapping == MAP_FAILED)
+					return true;
+				mapping = static_cast<const char*>(newMapping);
+				mappedSize = fileSize;
+			}
+			return true;
+		}
+		bool AppendOnlyRecordFile::GetRecordBefore(Offset end, std::string_view& recordOut, Offset& startOut) const
+		{
+			std::uint32_t length;
+			if(end > mappedSize || end < 2 * sizeof(length))
+				return false;
+			std::memcpy(&length, mapping + end - sizeof(length), sizeof(length));
+			if(length > end - 2 * sizeof(length))
+				return false;
+
+			// Leading length must match, or the record is damaged (ex: a crash mid-write)
+			Offset start{ end - length - 2 * sizeof(length) };
+			std::uint32_t leadingLength;
+			std::memcpy(&leadingLength, mapping + start, sizeof(leadingLength));
+			if(leadingLength != length)
+				return false;
+
+			recordOut = std::string_view{ mapping + start + sizeof(length), length };
+			startOut = start;
+			return true;
+		}
+		Environment::Environment(char** envp)
+		{
+			for(char** variable = envp; *variable; ++variable)
+			{
+				std::string_view text{ *variable };
+				std::string_view::size_type equalsPos{ text.find('=') };
+				if(equalsPos == std::string_view::npos)
+					continue;
+				Set(text.substr(0, equalsPos), text.substr(equalsPos + 1));
+				Export(text.substr(0, equalsPos));
+			}
+		}
+		const char* Environment::Get(std::string_view name) const
+		{
+			std::size_t index{ Find(name, Hash(name)) };
+			if(index == NONE || !slots[index].isSet)
+				return nullptr;
+			return slots[index].text.get() + name.size() + 1;
+		}
+		bool Environment::IsExported(std::string_view name) const
+		{
+			std::size_t index{ Find(name, Hash(name)) };
+			return index != NONE && slots[index].exported;
+		}
+		void Environment::Set(std::string_view name, std::string_view value)
+		{
+			Slot& slot{ Insert(name) };
+			slot.text = std::make_unique<char[]>(name.size() + value.size() + 2);
+			std::memcpy(slot.text.get(), name.data(), name.size());
+			slot.text[name.size()] = '=';
+			std::memcpy(slot.text.get() + name.size() + 1, value.data(), value.size());
+			slot.text[name.size() + value.size() + 1] = '\0';
+			slot.isSet = true;
+			if(slot.exported)
+				envpValid = false;
+		}
+		void Environment::Export(std::string_view name)
+		{
+			Slot& slot{ Insert(name) };
+			if(!slot.exported && slot.isSet)
+				envpValid = false;
+			slot.exported = true;
+		}
+		void Environment::Unset(std::string_view name)
+		{
+			std::size_t index{ Find(name, Hash(name)) };
+			if(index == NONE)
+				return;
+			Slot& slot{ slots[index] };
+			if(slot.exported && slot.isSet)
+				envpValid = false;
+			slot.text.reset();
+			slot.isSet = false;
+			slot.exported = false;
+			slot.state = Slot::State::Removed;
+		}
+		char* const* Environment::GetEnvp()
+		{
+			if(!envpValid)
+			{
+				envp.clear();
+				for(const Slot& slot : slots)
+					if(slot.state == Slot::State::Used && slot.exported && slot.isSet)
+						envp.push_back(slot.text.get());
+				envp.push_back(nullptr);
+				envpValid = true;
+			}
+			return envp.data();
+		}
+		bool Environment::IsValidName(std::string_view name)
+		{
+			return !name.empty() && !std::isdigit(static_cast<unsigned char>(name[0])) &&
+				   std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+		}
+		std::size_t Environment::Find(std::string_view name, std::size_t hash) const
+		{
+			// Linear probing up to an empty slot. Removed slots keep probe chains unbroken.
+			if(slots.empty())
+				return NONE;
+			std::size_t mask{ slots.size() - 1 };
+			for(std::size_t index{ hash & mask }; ; index = (index + 1) & mask)
+			{
+				const Slot& slot{ slots[index] };
+				if(slot.state == Slot::State::Empty)
+					return NONE;
+				if(slot.state == Slot::State::Used && slot.hash == hash && slot.nameSize == name.size() && 
+				   std::memcmp(slot.text.get(), name.data(), name.size()) == 0)
+					return index;
+			}
+		}
+		Environment::Slot& Environment::Insert(std::string_view name)
+		{
+			std::size_t hash{ Hash(name) };
+			std::size_t index{ Find(name, hash) };
+			if(index != NONE)
+				return slots[index];
+
+			// At most half full, counting removed slots, so probes stay short and always end
+			if(2 * (usedOrRemovedCount + 1) > slots.size())
+				Grow();
+			std::size_t mask{ slots.size() - 1 };
+			index = hash & mask;
+			while(slots[index].state == Slot::State::Used)
+				index = (index + 1) & mask;
+			Slot& slot{ slots[index] };
+			if(slot.state == Slot::State::Empty)
+				++usedOrRemovedCount;
+			slot.state = Slot::State::Used;
+			slot.hash = hash;
+			slot.nameSize = static_cast<std::uint32_t>(name.size());
+			slot.isSet = false;
+			slot.exported = false;
+			slot.text = std::make_unique<char[]>(name.size() + 2);
+			std::memcpy(slot.text.get(), name.data(), name.size());
+			slot.text[name.size()] = '=';
+			slot.text[name.size() + 1] = '\0';
+			return slot;
+		}
+		void Environment::Grow()
+		{
+			std::vector<Slot> oldSlots(std::max<std::size_t>(64, 2 * slots.size()));
+			oldSlots.swap(slots);
+			usedOrRemovedCount = 0;
+			std::size_t mask{ slots.size() - 1 };
+			for(Slot& oldSlot : oldSlots)
+			{
+				if(oldSlot.state != Slot::State::Used)
+					continue;
+				std::size_t index{ oldSlot.hash & mask };
+				while(slots[index].state != Slot::State::Empty)
+					index = (index + 1) & mask;
+				slots[index] = std::move(oldSlot);
+				++usedOrRemovedCount;
+			}
+		}
+		const std::vector<DirectoryCache::Entry>* DirectoryCache::List(int dirFd)
+		{
+			struct stat status;
+			if(fstat(dirFd, &status) != 0)
+				return nullptr;
+			Key key{ status.st_dev, status.st_ino, status.st_mtim.tv_sec, status.st_mtim.tv_nsec };
+			auto [listingIt, isNew]{ listings.try_emplace(key) };
+			Listing& listing{ listingIt->second };
+			if(!isNew)
+				return &listing.entries;
+
+			// Read every record first, since entries view them
+			const std::size_t READ_BUFFER_SIZE{ 1 << 18 };
+			readBuffer.resize(READ_BUFFER_SIZE);
+			while(true)
+			{
+				ssize_t bytesRead{ getdents64(dirFd, readBuffer.data(), readBuffer.size()) };
+				if(bytesRead == 0)
+					break;
+				if(bytesRead < 0)
+				{
+					if(errno == EINTR)
+						continue;
+					listings.erase(listingIt);
+					return nullptr;
+				}
+				listing.records.insert(listing.records.end(), readBuffer.data(), readBuffer.data() + bytesRead);
+			}
+			for(std::size_t offset = 0; offset < listing.records.size(); )
+			{
+				const dirent64* record{ reinterpret_cast<const dirent64*>(listing.records.data() + offset) };
+				offset += record->d_reclen;
+				std::string_view name{ record->d_name };
+				if(name != "." && name != "..")
+					listing.entries.push_back(Entry{ name, record->d_type });
+			}
+			return &listing.entries;
+		}
+		void DirectoryCache::Clear()
+		{
+			listings.clear();
+		}
+		namespace
+		{
+			struct GlobWalk
+			{
+				DirectoryCache& cache;
+				std::vector<std::string_view> components;
+				bool directoriesOnly;
+				std::vector<std::string>& pathsOut;
+				std::string path;	// Of the directory being walked: empty, or ending with /
+
+				void Walk(int dirFd, std::size_t componentIndex)
+				{
+					std::string_view component{ components[componentIndex] };
+					bool isLast{ componentIndex + 1 == components.size() };
+
+					// Literal: no need to list the directory
+					if(!Strings::HasGlobChars(component))
+					{
+						std::string name{ component };
+						if(!isLast)
+							Descend(dirFd, name.c_str(), componentIndex + 1, true);
+						else
+						{
+							struct stat status;
+							if(fstatat(dirFd, name.c_str(), &status, directoriesOnly ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && 
+							   (!directoriesOnly || S_ISDIR(status.st_mode)))
+								Add(name);
+						}
+						return;
+					}
+
+					const std::vector<DirectoryCache::Entry>* entries{ cache.List(dirFd) };
+					if(!entries)
+						return;
+					if(component == "**")
+					{
+						// Zero directories, then each subdirectory in turn
+						if(!isLast)
+							Walk(dirFd, componentIndex + 1);
+						for(const DirectoryCache::Entry& entry : *entries)
+						{
+							if(entry.name[0] == '.')
+								continue;
+							bool isDirectory{ IsDirectory(dirFd, entry, false) };
+							if(isLast && (isDirectory || !directoriesOnly))
+								Add(entry.name);
+							if(isDirectory)
+								Descend(dirFd, entry.name.data(), componentIndex, false);
+						}
+						return;
+					}
+					for(const DirectoryCache::Entry& entry : *entries)
+					{
+						if((entry.name[0] == '.' && component[0] != '.') || !Strings::MatchesGlob(component, entry.name))
+							continue;
+						if(!isLast)
+						{
+							if(IsDirectory(dirFd, entry, true))
+								Descend(dirFd, entry.name.data(), componentIndex + 1, true);
+						}
+						else if(!directoriesOnly || IsDirectory(dirFd, entry, true))
+							Add(entry.name);
+					}
+				}
+				void Descend(int dirFd, const char* name, std::size_t componentIndex, bool followLinks)
+				{
+					int subdirFd{ openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (followLinks ? 0 : O_NOFOLLOW)) };
+					if(subdirFd < 0)
+						return;
+					std::string::size_type pathSize{ path.size() };
+					path += name;
+					path += '/';
+					Walk(subdirFd, componentIndex);
+					path.resize(pathSize);
+					close(subdirFd);
+				}
+				void Add(std::string_view name)
+				{
+					pathsOut.emplace_back(path).append(name);
+					if(directoriesOnly)
+						pathsOut.back() += '/';
+				}
+				static bool IsDirectory(int dirFd, const DirectoryCache::Entry& entry, bool followLinks)
+				{
+					if(entry.type == DT_DIR)
+						return true;
+					if(entry.type != DT_UNKNOWN && (entry.type != DT_LNK || !followLinks))
+						return false;
+					struct stat status;
+					return fstatat(dirFd, entry.name.data(), &status, followLinks ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && 
+						   S_ISDIR(status.st_mode);
+				}
+			};
+		}
+		bool Glob(std::string_view pattern, DirectoryCache& cache, std::vector<std::string>& pathsOut)
+		{
+			pathsOut.clear();
+			GlobWalk walk{ cache, {}, !pattern.empty() && pattern.back() == '/', pathsOut, {} };
+			bool isAbsolute{ !pattern.empty() && pattern[0] == '/' };
+			if(isAbsolute)
+				walk.path = "/";
+			for(std::string_view::size_type start = 0; start < pattern.size(); )
+			{
+				std::string_view::size_type end{ std::min(pattern.find('/', start), pattern.size()) };
+				if(end > start)
+					walk.components.push_back(pattern.substr(start, end - start));
+				start = end + 1;
+			}
+			if(walk.components.empty())
+				return false;
+
+			int dirFd{ open(isAbsolute ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) };
+			if(dirFd < 0)
+				return false;
+			walk.Walk(dirFd, 0);
+			close(dirFd);
+			std::sort(pathsOut.begin(), pathsOut.end());
+			return !pathsOut.empty();
+		}
+		int ExecuteExternalAppAndWait(const std::string& pathToApp, 
+								const WordLists::WordList& arguments, 
+								const std::string& perrorMessage)
+		{
+			const int EXIT_STATUS_NOT_STARTED{ 127 };
+
+			pid_t childPid;
+			if(!SpawnExternalApp(pathToApp, arguments, {}, environ, childPid))
+			{
+				perror(perrorMessage.c_str());
+				return EXIT_STATUS_NOT_STARTED;
+			}
+
+			int status;
+			if(!WaitForChild(childPid, status, perrorMessage))
+				return EXIT_FAILURE;
+			return WaitStatusToExitStatus(status);
+		}
+	}
+
+	namespace Lists
+	{
+		UniqueStringRing::UniqueStringRing(size_type capacity)
+			: capacity{ capacity > 0 ? capacity : 1 }
+		{
+			slots.resize(this->capacity + std::max<size_type>(1, this->capacity / 8));
+			index.reserve(this->capacity);
+		}
+		void UniqueStringRing::AddToFront(const std::string& str)
+		{
+			// Existing string: already at front, or leave its slot empty and add it again
+			auto foundIter{ index.find(str) };
+			if(foundIter != index.end())
+			{
+				if(foundIter->second + 1 == nextSequence)
+					return;
+				Slot& oldSlot{ SlotAt(foundIter->second) };
+				index.erase(foundIter);
+				oldSlot.live = false;
+				oldSlot.str.clear();
+				--numLive;
+				++numEmpty;
+			}
+
+			// Make room: drop the oldest string when full, compact when out of slots
+			if(numLive == capacity)
+				RemoveOldest();
+			if(NumUsed() == slots.size())
+				Compact();
+
+			Slot& slot{ SlotAt(nextSequence) };
+			slot.str = str;
+			slot.live = true;
+			index.emplace(slot.str, nextSequence);
+			++nextSequence;
+			++numLive;
+		}
+		void UniqueStringRing::Clear()
+		{
+			for(Slot& slot : slots)
+			{
+				slot.str.clear();
+				slot.live = false;
+			}
+			index.clear();
+			nextSequence = 0;
+			numLive = 0;
+			numEmpty = 0;
+		}
+		const std::string* UniqueStringRing::Get(size_type index) const
+		{
+			if(index >= numLive)
+				return nullptr;
+
+			// No empty slots: direct
+			if(numEmpty == 0)
+				return &SlotAt(nextSequence - 1 - index).str;
+
+			// Count live slots back from the newest
+			for(Sequence sequence = nextSequence; sequence > nextSequence - NumUsed(); --sequence)
+			{
+				const Slot& slot{ SlotAt(sequence - 1) };
+				if(slot.live && index-- == 0)
+					return &slot.str;
+			}
+			return nullptr;
+		}
+		void UniqueStringRing::GetMostRecent(size_type count, std::vector<const std::string*>& stringsOut) const
+		{
+			stringsOut.clear();
+			if(count > numLive)
+				count = numLive;
+			stringsOut.reserve(count);
+			for(Sequence sequence = nextSequence; stringsOut.size() < count && sequence > nextSequence - NumUsed(); --sequence)
+			{
+				const Slot& slot{ SlotAt(sequence - 1) };
+				if(slot.live)
+					stringsOut.push_back(&slot.str);
+			}
+			std::reverse(stringsOut.begin(), stringsOut.end());
+		}
+		void UniqueStringRing::RemoveOldest()
+		{
+			// Empty slots at the old end are dropped along the way
+			while(numLive > 0)
+			{
+				Slot& slot{ SlotAt(nextSequence - NumUsed()) };
+				if(slot.live)
+				{
+					index.erase(slot.str);
+					slot.live = false;
+					slot.str.clear();
+					--numLive;
+					return;
+				}
+				--numEmpty;
+			}
+		}
+		void UniqueStringRing::Compact()
+		{
+			// Slide live strings toward the newest end, oldest last, keeping their order. 
+			// Moving strings invalidates the views in the index, so it is rebuilt.
+			index.clear();
+			Sequence oldestSequence{ nextSequence - NumUsed() };
+			Sequence destination{ nextSequence };
+			for(Sequence source = nextSequence; source > oldestSequence; --source)
+			{
+				Slot& sourceSlot{ SlotAt(source - 1) };
+				if(!sourceSlot.live)
+					continue;
+				--destination;
+				if(destination != source - 1)
+				{
+					Slot& destinationSlot{ SlotAt(destination) };
+					destinationSlot.str = std::move(sourceSlot.str);
+					destinationSlot.live = true;
+					sourceSlot.str.clear();
+					sourceSlot.live = false;
+				}
+			}
+			for(Sequence sequence = destination; sequence < nextSequence; ++sequence)
+				index.emplace(SlotAt(sequence).str, sequence);
+			numEmpty = 0;
+		}
+
+		PrefixTrie::PrefixTrie()
+		{
+			Clear();
+		}
+		void PrefixTrie::Insert(std::string_view str)
+		{
+			NodeIndex node{ ROOT };
+			++nodes[ROOT].numUnder;
+			for(char c : str)
+			{
+				// Keep children in character order so completions come out sorted
+				NodeIndex previous{ NONE };
+				NodeIndex child{ nodes[node].firstChild };
+				while(child != NONE && nodes[child].c < c)
+				{
+					previous = child;
+					child = nodes[child].nextSibling;
+				}
+				if(child == NONE || nodes[child].c != c)
+				{
+					Node newNode;
+					newNode.c = c;
+					newNode.nextSibling = child;
+					NodeIndex newIndex{ static_cast<NodeIndex>(nodes.size()) };
+					nodes.push_back(newNode);
+					if(previous == NONE)
+						nodes[node].firstChild = newIndex;
+					else
+						nodes[previous].nextSibling = newIndex;
+					child = newIndex;
+				}
+				node = child;
+				++nodes[node].numUnder;
+			}
+			++nodes[node].numEnding;
+		}
+		void PrefixTrie::Erase(std::string_view str)
+		{
+			// Nodes stay allocated; their counts drop to zero
+			NodeIndex node{ ROOT };
+			for(char c : str)
+			{
+				node = FindChild(node, c);
+				if(node == NONE)
+					return;
+			}
+			if(nodes[node].numEnding == 0)
+				return;
+			--nodes[node].numEnding;
+			node = ROOT;
+			--nodes[ROOT].numUnder;
+			for(char c : str)
+			{
+				node = FindChild(node, c);
+				--nodes[node].numUnder;
+			}
+		}
+		void PrefixTrie::Clear()
+		{
+			nodes.clear();
+			nodes.emplace_back();
+		}
+		PrefixTrie::size_type PrefixTrie::Complete(std::string_view prefix, size_type maxCount, std::vector<std::string>& completionsOut) const
+		{
+			completionsOut.clear();
+			NodeIndex node{ ROOT };
+			for(char c : prefix)
+			{
+				node = FindChild(node, c);
+				if(node == NONE)
+					return 0;
+			}
+			std::string path{ prefix };
+			Collect(node, path, maxCount, completionsOut);
+			return nodes[node].numUnder;
+		}
+		PrefixTrie::NodeIndex PrefixTrie::FindChild(NodeIndex parent, char c) const
+		{
+			for(NodeIndex child{ nodes[parent].firstChild }; child != NONE && nodes[child].c <= c; child = nodes[child].nextSibling)
+				if(nodes[child].c == c)
+					return child;
+			return NONE;
+		}
+		void PrefixTrie::Collect(NodeIndex node, std::string& path, size_type maxCount, std::vector<std::string>& completionsOut) const
+		{
+			if(completionsOut.size() >= maxCount || nodes[node].numUnder == 0)
+				return;
+			if(nodes[node].numEnding > 0)
+				completionsOut.push_back(path);
+			for(NodeIndex child{ nodes[node].firstChild }; child != NONE; child = nodes[child].nextSibling)
+			{
+				path.push_back(nodes[child].c);
+				Collect(child, path, maxCount, completionsOut);
+				path.pop_back();
+			}
+		}
+
+		TrigramIndex::TrigramIndex()
+			: postings(std::size_t{ 1 } << (3 * CLASS_BITS))
+		{}
+		void TrigramIndex::Add(Id id, std::string_view text)
+		{
+			// A trigram seen twice in one text is already at the back of its list
+			for(std::string_view::size_type i = 0; i + 3 <= text.size(); ++i)
+			{
+				std::vector<Id>& ids{ postings[TrigramAt(text.data() + i)] };
+				if(ids.empty() || ids.back() != id)
+					ids.push_back(id);
+			}
+			endId = std::max(endId, id + 1);
+		}
+		void TrigramIndex::Clear()
+		{
+			for(std::vector<Id>& ids : postings)
+				ids.clear();
+			endId = 0;
+		}
+		bool TrigramIndex::FindBefore(std::string_view query, Id beforeId, const std::function<bool(Id)>& isMatch, Id& idOut) const
+		{
+			beforeId = std::min(beforeId, endId);
+			if(query.size() < 3)
+			{
+				for(Id id{ beforeId }; id > 0; --id)
+					if(isMatch(id - 1))
+					{
+						idOut = id - 1;
+						return true;
+					}
+				return false;
+			}
+
+			// Walk the shortest list back from beforeId, keeping ids found in all the other lists too
+			std::vector<const std::vector<Id>*> lists;
+			for(std::string_view::size_type i = 0; i + 3 <= query.size(); ++i)
+			{
+				const std::vector<Id>& ids{ postings[TrigramAt(query.data() + i)] };
+				if(ids.empty())
+					return false;
+				lists.push_back(&ids);
+			}
+			std::sort(lists.begin(), lists.end());
+			lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+			std::sort(lists.begin(), lists.end(), [](const std::vector<Id>* a, const std::vector<Id>* b) { return a->size() < b->size(); });
+			const std::vector<Id>& shortest{ *lists[0] };
+			for(auto idIt{ std::lower_bound(shortest.begin(), shortest.end(), beforeId) }; idIt != shortest.begin(); )
+			{
+				Id id{ *--idIt };
+				bool inAll{ std::all_of(lists.begin() + 1, lists.end(), [id](const std::vector<Id>* list) {
+					return std::binary_search(list->begin(), list->end(), id);
+				}) };
+				if(inAll && isMatch(id))
+				{
+					idOut = id;
+					return true;
+				}
+			}
+			return false;
+		}
+		TrigramIndex::Trigram TrigramIndex::CharClass(char c)
+		{
+			// a-z, A-Z, 0-9, space, everything else
+			if(c >= 'a' && c <= 'z')
+				return static_cast<Trigram>(c - 'a');
+			if(c >= 'A' && c <= 'Z')
+				return static_cast<Trigram>(26 + c - 'A');
+			if(c >= '0' && c <= '9')
+				return static_cast<Trigram>(52 + c - '0');
+			return (c == ' ') ? 62 : 63;
+		}
+	}
+
+	namespace Console
+	{
+		RawMode::RawMode(int fd)
+			: fd{ fd }
+		{
+			if(tcgetattr(fd, &original) != 0)
+				return;
+			termios raw{ original };
+			raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+			raw.c_oflag &= ~OPOST;
+			raw.c_cflag |= CS8;
+			raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+			raw.c_cc[VMIN] = 1;
+			raw.c_cc[VTIME] = 0;
+			on = (tcsetattr(fd, TCSAFLUSH, &raw) == 0);
+		}
+		RawMode::~RawMode()
+		{
+			if(on)
+				tcsetattr(fd, TCSAFLUSH, &original);
+		}
+
+		LineEditor::LineEditor(int inFd, int outFd, Completer completer, HistorySource historySource, HistorySearch historySearch)
+			: inFd{ inFd }, outFd{ outFd }, completer{ std::move(completer) }, historySource{ std::move(historySource) }, 
+			  historySearch{ std::move(historySearch) }
+		{}
+		bool LineEditor::ReadLine(std::string_view promptIn, std::string& lineOut)
+		{
+			// Only the prompt's last line is redrawn
+			prompt = promptIn;
+			std::string_view::size_type lastNewline{ prompt.rfind('\n') };
+			promptLastLine = (lastNewline == std::string_view::npos) ? prompt : prompt.substr(lastNewline + 1);
+			promptWidth = DisplayWidth(promptLastLine);
+			line.clear();
+			cursor = 0;
+			historyIndex = 0;
+
+			RawMode rawMode{ inFd };
+			if(!rawMode.IsOn())
+				return false;
+			Write(prompt);
+			int previousKey{ KEY_NONE };
+			while(true)
+			{
+				int key{ ReadKey() };
+
+				// Search ends on a key that is then handled as usual
+				if(key == 18)	// Ctrl-R
+					key = Search();
+				switch(key)
+				{
+				case KEY_END_OF_INPUT:
+					Write("\r\n");
+					return false;
+				case '\r':
+				case '\n':
+					Write("\r\n");
+					lineOut = line;
+					return true;
+				case 3:		// Ctrl-C
+					Write("^C\r\n");
+					lineOut.clear();
+					return true;
+				case 4:		// Ctrl-D
+					if(line.empty())
+					{
+						Write("\r\n");
+						return false;
+					}
+					[[fallthrough]];
+				case KEY_DELETE:
+					if(cursor < line.size())
+						line.erase(cursor, NextCharStart(cursor) - cursor);
+					break;
+				case 127:	// Backspace
+				case 8:		// Ctrl-H
+					if(cursor > 0)
+					{
+						std::size_t start{ PreviousCharStart(cursor) };
+						line.erase(start, cursor - start);
+						cursor = start;
+					}
+					break;
+				case '\t':
+					Complete(previousKey == '\t');
+					break;
+				case KEY_LEFT:
+				case 2:		// Ctrl-B
+					cursor = PreviousCharStart(cursor);
+					break;
+				case KEY_RIGHT:
+				case 6:		// Ctrl-F
+					cursor = NextCharStart(cursor);
+					break;
+				case KEY_HOME:
+				case 1:		// Ctrl-A
+					cursor = 0;
+					break;
+				case KEY_END:
+				case 5:		// Ctrl-E
+					cursor = line.size();
+					break;
+				case KEY_UP:
+				case 16:	// Ctrl-P
+					ShowHistoryEntry(historyIndex + 1);
+					break;
+				case KEY_DOWN:
+				case 14:	// Ctrl-N
+					if(historyIndex > 0)
+						ShowHistoryEntry(historyIndex - 1);
+					break;
+				case 11:	// Ctrl-K
+					line.erase(cursor);
+					break;
+				case 21:	// Ctrl-U
+					line.erase(0, cursor);
+					cursor = 0;
+					break;
+				case 23:	// Ctrl-W: back to the start of the previous word
+				{
+					std::size_t start{ cursor };
+					while(start > 0 && line[start - 1] == ' ')
+						--start;
+					while(start > 0 && line[start - 1] != ' ')
+						--start;
+					line.erase(start, cursor - start);
+					cursor = start;
+					break;
+				}
+				case 12:	// Ctrl-L
+					Write("\033[H\033[2J");
+					Write(prompt);
+					break;
+				default:
+					// Printable, including UTF-8 bytes
+					if(key >= 32 && key < 256)
+					{
+						line.insert(cursor, 1, static_cast<char>(key));
+						++cursor;
+					}
+					break;
+				}
+				previousKey = key;
+				Refresh();
+			}
+		}
+		int LineEditor::ReadKey()
+		{
+			char c;
+			if(!ReadByteWithin(-1, c))
+				return KEY_END_OF_INPUT;
+			if(c != '\033')
+				return static_cast<unsigned char>(c);
+
+			// Escape sequences: ESC [ A, ESC [ 3 ~, ESC O H, ... A lone ESC is ignored.
+			const int ESCAPE_TIMEOUT_MILLISECONDS{ 50 };
+			char sequence[3];
+			if(!ReadByteWithin(ESCAPE_TIMEOUT_MILLISECONDS, sequence[0]) || !ReadByteWithin(ESCAPE_TIMEOUT_MILLISECONDS, sequence[1]))
+				return KEY_NONE;
+			if(sequence[0] == '[' && sequence[1] >= '0' && sequence[1] <= '9')
+			{
+				if(!ReadByteWithin(ESCAPE_TIMEOUT_MILLISECONDS, sequence[2]) || sequence[2] != '~')
+					return KEY_NONE;
+				switch(sequence[1])
+				{
+				case '1': case '7': return KEY_HOME;
+				case '4': case '8': return KEY_END;
+				case '3': return KEY_DELETE;
+				default: return KEY_NONE;
+				}
+			}
+			if(sequence[0] == '[' || sequence[0] == 'O')
+			{
+				switch(sequence[1])
+				{
+				case 'A': return KEY_UP;
+				case 'B': return KEY_DOWN;
+				case 'C': return KEY_RIGHT;
+				case 'D': return KEY_LEFT;
+				case 'H': return KEY_HOME;
+				case 'F': return KEY_END;
+				}
+			}
+			return KEY_NONE;
+		}
+		int LineEditor::Search()
+		{
+			// Shows "(reverse-i-search)`query': match" with the cursor on the match. Each key refines the query 
+			// and searches again from the newest entry, Ctrl-R finds the next older match, Ctrl-G or Ctrl-C 
+			// gives the original line back. Any other key keeps the match and ends the search.
+			if(!historySearch)
+				return KEY_NONE;
+			const std::string originalLine{ line };
+			const std::size_t originalCursor{ cursor };
+			const std::string_view originalPromptLastLine{ promptLastLine };
+			const std::size_t originalPromptWidth{ promptWidth };
+			std::string query;
+			std::string searchPrompt;
+			std::size_t matchPosition{ NO_POSITION };
+			bool found{ true };
+			int key{ KEY_NONE };
+			while(true)
+			{
+				searchPrompt = found ? "(reverse-i-search)`" : "(failed reverse-i-search)`";
+				searchPrompt += query;
+				searchPrompt += "': ";
+				promptLastLine = searchPrompt;
+				promptWidth = DisplayWidth(searchPrompt);
+				Refresh();
+
+				key = ReadKey();
+				if(key == 18)
+				{
+					// Next older match, skipping entries the same as the one shown
+					if(!query.empty() && found)
+						found = SearchOlder(query, matchPosition, matchPosition, line);
+				}
+				else if(key == 127 || key == 8)
+				{
+					if(!query.empty())
+						query.erase(PreviousCharStartIn(query, query.size()));
+					matchPosition = NO_POSITION;
+					found = query.empty() || historySearch(query, NO_POSITION, matchPosition, line);
+				}
+				else if(key >= 32 && key < 256)
+				{
+					query += static_cast<char>(key);
+					std::size_t position;
+					std::string match;
+					found = historySearch(query, NO_POSITION, position, match);
+					if(found)
+					{
+						matchPosition = position;
+						line = std::move(match);
+					}
+				}
+				else
+					break;
+				std::size_t queryPos{ query.empty() ? std::string::npos : line.find(query) };
+				cursor = (queryPos == std::string::npos) ? line.size() : queryPos;
+			}
+
+			promptLastLine = originalPromptLastLine;
+			promptWidth = originalPromptWidth;
+			if(key == 7 || key == 3)	// Ctrl-G, Ctrl-C
+			{
+				line = originalLine;
+				cursor = originalCursor;
+				return KEY_NONE;
+			}
+			return key;
+		}
+		bool LineEditor::SearchOlder(std::string_view query, std::size_t before, std::size_t& positionOut, std::string& matchOut)
+		{
+			std::string match;
+			std::size_t position{ before };
+			do
+			{
+				if(!historySearch(query, position, position, match))
+					return false;
+			}
+			while(match == matchOut);
+			positionOut = position;
+			matchOut = std::move(match);
+			return true;
+		}
+		bool LineEditor::ReadByteWithin(int timeoutMilliseconds, char& byteOut)
+		{
+			if(timeoutMilliseconds >= 0)
+			{
+				pollfd pollFd{ inFd, POLLIN, 0 };
+				int ready;
+				do
+					ready = poll(&pollFd, 1, timeoutMilliseconds);
+				while(ready < 0 && errno == EINTR);
+				if(ready <= 0)
+					return false;
+			}
+			ssize_t numRead;
+			do
+				numRead = read(inFd, &byteOut, 1);
+			while(numRead < 0 && errno == EINTR);
+			return numRead == 1;
+		}
+		void LineEditor::Refresh()
+		{
+			// Show the part of the line around the cursor that fits after the prompt
+			std::size_t available{ static_cast<std::size_t>(TerminalWidth()) };
+			available = (available > promptWidth + 1) ? available - promptWidth - 1 : 1;
+			std::size_t start{ 0 };
+			while(DisplayWidth(std::string_view{ line }.substr(start, cursor - start)) >= available)
+				start = NextCharStart(start);
+			std::size_t end{ cursor };
+			while(end < line.size() && DisplayWidth(std::string_view{ line }.substr(start, NextCharStart(end) - start)) < available)
+				end = NextCharStart(end);
+
+			// Redraw in one write: prompt, visible text, clear the rest, put the cursor back
+			output.assign("\r");
+			output += promptLastLine;
+			output.append(line, start, end - start);
+			output += "\033[0K\r";
+			std::size_t cursorColumn{ promptWidth + DisplayWidth(std::string_view{ line }.substr(start, cursor - start)) };
+			if(cursorColumn > 0)
+			{
+				output += "\033[";
+				output += std::to_string(cursorColumn);
+				output += 'C';
+			}
+			Write(output);
+		}
+		void LineEditor::Complete(bool listIfUnchanged)
+		{
+			if(!completer)
+				return;
+			std::size_t wordStart{ cursor };
+			std::vector<std::string> completions;
+			completer(line, cursor, wordStart, completions);
+			if(completions.empty())
+			{
+				Write("\a");
+				return;
+			}
+
+			// Replace the word with what all completions have in common, plus a space if there is only one
+			std::string common{ completions[0] };
+			for(const std::string& completion : completions)
+			{
+				std::size_t length{ 0 };
+				while(length < common.size() && length < completion.size() && common[length] == completion[length])
+					++length;
+				common.resize(length);
+			}
+			if(completions.size() == 1 && !common.empty() && common.back() != '/')
+				common += ' ';
+			std::string_view word{ std::string_view{ line }.substr(wordStart, cursor - wordStart) };
+			if(common.size() > word.size() || (completions.size() == 1 && common != word))
+			{
+				line.replace(wordStart, cursor - wordStart, common);
+				cursor = wordStart + common.size();
+			}
+			else if(listIfUnchanged)
+				ListCompletions(completions);
+			else
+				Write("\a");
+		}
+		void LineEditor::ListCompletions(const std::vector<std::string>& completions)
+		{
+			// Columns below the line, then the prompt again
+			std::size_t columnWidth{ 0 };
+			for(const std::string& completion : completions)
+				columnWidth = std::max(columnWidth, DisplayWidth(completion) + 2);
+			std::size_t numColumns{ std::max<std::size_t>(1, static_cast<std::size_t>(TerminalWidth()) / columnWidth) };
+			output.assign("\r\n");
+			for(std::size_t i = 0; i < completions.size(); ++i)
+			{
+				output += completions[i];
+				if((i + 1) % numColumns == 0 || i + 1 == completions.size())
+					output += "\r\n";
+				else
+					output.append(columnWidth - DisplayWidth(completions[i]), ' ');
+			}
+			output += prompt;
+			Write(output);
+		}
+		void LineEditor::ShowHistoryEntry(std::size_t index)
+		{
+			// Leaving the line being typed keeps it for coming back down
+			std::string entry;
+			if(index > 0 && !(historySource && historySource(index - 1, entry)))
+				return;
+			if(historyIndex == 0)
+				lineBeforeHistory = line;
+			line = (index == 0) ? lineBeforeHistory : entry;
+			cursor = line.size();
+			historyIndex = index;
+		}
+		void LineEditor::Write(std::string_view text)
+		{
+			Posix::WriteAll(outFd, text.data(), text.size());
+		}
+		std::size_t LineEditor::PreviousCharStart(std::size_t pos) const
+		{
+			return PreviousCharStartIn(line, pos);
+		}
+		std::size_t LineEditor::PreviousCharStartIn(std::string_view text, std::size_t pos)
+		{
+			// Step over UTF-8 continuation bytes
+			if(pos == 0)
+				return 0;
+			--pos;
+			while(pos > 0 && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80)
+				--pos;
+			return pos;
+		}
+		std::size_t LineEditor::NextCharStart(std::size_t pos) const
+		{
+			if(pos >= line.size())
+				return line.size();
+			++pos;
+			while(pos < line.size() && (static_cast<unsigned char>(line[pos]) & 0xC0) == 0x80)
+				++pos;
+			return pos;
+		}
+		int LineEditor::TerminalWidth() const
+		{
+			const int DEFAULT_WIDTH{ 80 };
+			winsize size;
+			if(ioctl(outFd, TIOCGWINSZ, &size) != 0 || size.ws_col == 0)
+				return DEFAULT_WIDTH;
+			return size.ws_col;
+		}
+
+		std::size_t DisplayWidth(std::string_view text)
+		{
+			std::size_t width{ 0 };
+			for(std::string_view::size_type i = 0; i < text.size(); ++i)
+			{
+				// ESC [ parameters final-letter
+				if(text[i] == '\033' && i + 1 < text.size() && text[i + 1] == '[')
+				{
+					i += 2;
+					while(i < text.size() && !std::isalpha(static_cast<unsigned char>(text[i])))
+						++i;
+					continue;
+				}
+				if((static_cast<unsigned char>(text[i]) & 0xC0) != 0x80)
+					++width;
+			}
+			return width;
+		}
+	}
+
+	namespace Strings
+	{
+		bool ToInt(std::string_view str, int& out)
+		{
+			const char* end{ str.data() + str.size() };
+			auto [nextCharPtr, error] = std::from_chars(str.data(), end, out);
+			return error == std::errc{} && nextCharPtr == end;
+		}
+		void PrintJsonString(std::ostream& os, std::string_view str)
+		{
+			os << '"';
+			for(char c : str)
+			{
+				if(c == '"' || c == '\\')
+					os << '\\' << c;
+				else if(static_cast<unsigned char>(c) < 0x20)
+				{
+					char escape[8];
+					std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned char>(c));
+					os << escape;
+				}
+				else
+					os << c;
+			}
+			os << '"';
+		}
+		namespace
+		{
+			// Whether c is in the set starting at pattern[start] == '['. endOut is just past its ], or npos if there is none.
+			bool MatchesGlobSet(std::string_view pattern, std::string_view::size_type start, char c, std::string_view::size_type& endOut)
+			{
+				std::string_view::size_type i{ start + 1 };
+				bool negate{ i < pattern.size() && (pattern[i] == '!' || pattern[i] == '^') };
+				if(negate)
+					++i;
+				bool matched{ false };
+				unsigned char uc{ static_cast<unsigned char>(c) };
+				for(bool isFirst = true; i < pattern.size() && (pattern[i] != ']' || isFirst); isFirst = false)
+				{
+					// A ] first in the set is itself
+					unsigned char low{ static_cast<unsigned char>(pattern[i]) };
+					unsigned char high{ low };
+					if(i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+					{
+						high = static_cast<unsigned char>(pattern[i + 2]);
+						i += 3;
+					}
+					else
+						++i;
+					if(uc >= low && uc <= high)
+						matched = true;
+				}
+				endOut = (i < pattern.size()) ? i + 1 : std::string_view::npos;
+				return matched != negate;
+			}
+		}
+		bool HasGlobChars(std::string_view text)
+		{
+			std::string_view::size_type i{ text.find_first_of("*?[") };
+			while(i != std::string_view::npos)
+			{
+				if(text[i] != '[')
+					return true;
+				std::string_view::size_type setEnd;
+				MatchesGlobSet(text, i, '\0', setEnd);
+				if(setEnd != std::string_view::npos)
+					return true;
+				i = text.find_first_of("*?[", i + 1);
+			}
+			return false;
+		}
+		bool MatchesGlob(std::string_view pattern, std::string_view name)
+		{
+			// On a mismatch, go back to the last * and have it match one more char. 
+			// Backing up further can't help: the last * can match anything an earlier one could.
+			std::string_view::size_type p{ 0 };
+			std::string_view::size_type n{ 0 };
+			std::string_view::size_type starP{ std::string_view::npos };
+			std::string_view::size_type starN{ 0 };
+			while(n < name.size())
+			{
+				if(p < pattern.size())
+				{
+					char c{ pattern[p] };
+					if(c == '*')
+					{
+						starP = ++p;
+						starN = n;
+						continue;
+					}
+					if(c == '[')
+					{
+						std::string_view::size_type setEnd;
+						bool matched{ MatchesGlobSet(pattern, p, name[n], setEnd) };
+						if(setEnd == std::string_view::npos ? name[n] == '[' : matched)
+						{
+							p = (setEnd == std::string_view::npos) ? p + 1 : setEnd;
+							++n;
+							continue;
+						}
+					}
+					else if(c == '?' || c == name[n])
+					{
+						++p;
+						++n;
+						continue;
+					}
+				}
+				if(starP == std::string_view::npos)
+					return false;
+				p = starP;
+				n = ++starN;
+			}
+			while(p < pattern.size() && pattern[p] == '*')
+				++p;
+			return p == pattern.size();
+		}
+	}
+
+	namespace Hashing
+	{
+		namespace
+		{
+			// Final avalanche of splitmix64
+			std::uint64_t Finish(std::uint64_t value)
+			{
+				value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+				value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+				return value ^ (value >> 31);
+			}
+		}
+		Fingerprint& Fingerprint::Add(std::string_view bytes)
+		{
+			// Eight bytes at a time, then the tail zero-padded
+			Add(static_cast<std::uint64_t>(bytes.size()));
+			std::size_t i{ 0 };
+			for(; i + sizeof(std::uint64_t) <= bytes.size(); i += sizeof(std::uint64_t))
+			{
+				std::uint64_t word;
+				std::memcpy(&word, bytes.data() + i, sizeof(word));
+				Mix(word);
+			}
+			if(i < bytes.size())
+			{
+				std::uint64_t word{ 0 };
+				std::memcpy(&word, bytes.data() + i, bytes.size() - i);
+				Mix(word);
+			}
+			return *this;
+		}
+		Fingerprint& Fingerprint::Add(std::uint64_t value)
+		{
+			Mix(value);
+			return *this;
+		}
+		void Fingerprint::Mix(std::uint64_t word)
+		{
+			// Two lanes with different multipliers and rotations
+			low = ((low ^ word) * 0x87c37b91114253d5);
+			low = (low << 31) | (low >> 33);
+			high = ((high + word) * 0x4cf5ad432745937f) ^ low;
+			high = (high << 27) | (high >> 37);
+		}
+		std::string Fingerprint::Hex() const
+		{
+			const char DIGITS[]{ "0123456789abcdef" };
+			std::uint64_t halves[]{ Finish(low ^ (high >> 1)), Finish(high + low) };
+			std::string hex;
+			hex.reserve(32);
+			for(std::uint64_t half : halves)
+				for(int shift = 60; shift >= 0; shift -= 4)
+					hex += DIGITS[(half >> shift) & 0xf];
+			return hex;
+		}
+	}
+
+	namespace Stats
+	{
+		Nanoseconds Now()
+		{
+			timespec time;
+			clock_gettime(CLOCK_MONOTONIC, &time);
+			return static_cast<Nanoseconds>(time.tv_sec) * 1000000000 + time.tv_nsec;
+		}
+		Nanoseconds ToNanoseconds(const timeval& time)
+		{
+			return static_cast<Nanoseconds>(time.tv_sec) * 1000000000 + static_cast<Nanoseconds>(time.tv_usec) * 1000;
+		}
+		void Histogram::Add(Nanoseconds value)
+		{
+			if(value < 0)
+				value = 0;
+			++buckets[BucketOf(value)];
+			min = (count == 0) ? value : std::min(min, value);
+			max = std::max(max, value);
+			sum += value;
+			++count;
+		}
+		Nanoseconds Histogram::Percentile(double fraction) const
+		{
+			if(count == 0)
+				return 0;
+			std::uint64_t rank{ static_cast<std::uint64_t>(fraction * static_cast<double>(count) + 0.5) };
+			rank = std::clamp<std::uint64_t>(rank, 1, count);
+			std::uint64_t seen{ 0 };
+			for(int bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+			{
+				seen += buckets[bucket];
+				if(seen >= rank)
+					return std::clamp(BucketUpperBound(bucket), min, max);
+			}
+			return max;
+		}
+		int Histogram::BucketOf(Nanoseconds value)
+		{
+			// Values below 8 get a bucket each. Above that, the top bit picks the power of two 
+			// and the next three bits pick one of its eight buckets.
+			const std::uint64_t SUB_BUCKETS{ 1u << SUB_BUCKET_BITS };
+			std::uint64_t v{ static_cast<std::uint64_t>(value) };
+			if(v < SUB_BUCKETS)
+				return static_cast<int>(v);
+			int topBit{ 63 - __builtin_clzll(v) };
+			int subBucket{ static_cast<int>((v >> (topBit - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1)) };
+			return ((topBit - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + subBucket;
+		}
+		Nanoseconds Histogram::BucketUpperBound(int bucket)
+		{
+			const int SUB_BUCKETS{ 1 << SUB_BUCKET_BITS };
+			if(bucket < SUB_BUCKETS)
+				return bucket;
+			int topBit{ (bucket >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1 };
+			std::uint64_t lower{ static_cast<std::uint64_t>(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << (topBit - SUB_BUCKET_BITS) };
+			std::uint64_t upper{ lower + (std::uint64_t{ 1 } << (topBit - SUB_BUCKET_BITS)) - 1 };
+			return static_cast<Nanoseconds>(std::min<std::uint64_t>(upper, std::numeric_limits<Nanoseconds>::max()));
+		}
 	}
 }
\ No newline at end of file
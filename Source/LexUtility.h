@@ -11,61 +11,645 @@
 #include <string>
 #include <vector>
 #include <ostream>
-#include <list>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <memory_resource>
+#include <memory>
+#include <cstdint>
+#include <sys/types.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <termios.h>
 namespace Lex
 {
 	namespace WordLists
 	{
-		void Separate(const std::string& input, const std::vector<char>& whitespaceChars, std::vector<std::string>& wordsOut);
-		void Print(std::ostream& os, const std::vector<std::string>& wordList);
+		// Views of '\0'-terminated words, in memory chosen by the caller (ex: an arena)
+		using WordList = std::pmr::vector<std::string_view>;
+
+		// Word found by Split, viewing the word buffer
+		struct Word
+		{
+			std::string_view text;
+			bool isOperator{ false };
+			bool quoted{ false };		// Had quotes or escapes, now removed
+		};
+
+		// Split writes an unquoted expansion character that starts an expansion ($name, ${name}, $?, $$, $(command)) 
+		// as one of these marks, so later stages can tell it from a quoted or escaped one. A command substitution's 
+		// text is kept as typed, and its closing ) is written as SUBSTITUTION_END_MARK.
+		const char EXPANSION_MARK{ '\x01' };
+		const char QUOTED_EXPANSION_MARK{ '\x02' };	// Was in "double quotes"
+		const char SUBSTITUTION_END_MARK{ '\x03' };
+
+		// How Split treats each character: one table lookup per character
+		class SplitRules
+		{
+		public:
+			// expansionChar '\0' means no expansions
+			SplitRules(std::string_view whitespaceChars, const std::vector<std::string>& operators, char commentChar, char expansionChar);
+
+			// Length of the longest operator at the start of text, or 0
+			std::size_t MatchOperator(std::string_view text) const;
+
+			// Whether word must be quoted to split back into itself
+			bool NeedsQuoting(std::string_view word) const;
+
+		private:
+			friend bool Split(std::string_view input, char* wordBuffer, const SplitRules& rules, std::pmr::vector<Word>& wordsOut);
+			enum class CharType : unsigned char { Plain, Whitespace, OperatorStart, SingleQuote, DoubleQuote, Escape, Comment, Expansion };
+			CharType TypeOf(char c) const { return charTypes[static_cast<unsigned char>(c)]; }
+
+			CharType charTypes[256];
+			std::vector<std::string> operators;	// Longest first
+		};
+
+		// Splits buffer into words at unquoted whitespace and around unquoted operators, stopping at an 
+		// unquoted comment character that starts a word. 'Single quotes' keep everything; in "double quotes" 
+		// a backslash only escapes \\ \" \$ \`; outside of quotes a backslash escapes any character. 
+		// Words are written without their quotes and escapes to wordBuffer, which must hold 2 * input.size() chars, 
+		// each followed by '\0'. Returns false on an unterminated quote or command substitution.
+		using WordVector = std::pmr::vector<Word>;
+		bool Split(std::string_view input, char* wordBuffer, const SplitRules& rules, WordVector& wordsOut);
+
+		// Prints words separated by spaces, quoting those that would not split back into themselves. 
+		// Words with expansion marks are printed with their expansions as typed.
+		void Print(std::ostream& os, const WordList& wordList, const SplitRules& rules);
+		void PrintWord(std::ostream& os, std::string_view word, const SplitRules& rules);
 	}
 
 	namespace Posix
 	{
-		bool GetUser(std::string& userOut);
-		bool GetHomeDirectory(std::string& homeOut);
+		class Environment;
+
+		// From $USER and $HOME, or the password database entry of the effective user
+		bool GetUser(const Environment& environment, std::string& userOut);
+		bool GetHomeDirectory(const Environment& environment, std::string& homeOut);
 		bool GetWorkingDirectory(std::string& pathOut);
 		bool ChangeWorkingDirectory(const std::string& path);
-		bool ExecuteExternalAppAndWait(const std::string& pathToApp,
-								const std::vector<std::string>& arguments, 
+		bool ReadFile(const std::string& path, std::string& contentsOut);
+
+		// Lines from a descriptor (ex: a pipe), read with large reads into one buffer and found with memchr. 
+		// A line longer than the buffer grows it, so lines can be any length.
+		class LineReader
+		{
+		public:
+			explicit LineReader(int fd);
+
+			// Next line without its '\n', viewing the buffer until the next call. The last line may lack a '\n'. 
+			// False at end of input with errno 0, or after a read error with errno set.
+			bool ReadLine(std::string_view& lineOut);
+
+		private:
+			int fd;
+			std::vector<char> buffer;
+			std::size_t lineStart{ 0 };		// First byte not returned yet
+			std::size_t scanned{ 0 };		// Bytes before this have no '\n' left
+			std::size_t dataEnd{ 0 };
+			bool endOfInput{ false };
+		};
+
+		// File descriptor operation applied in the child after spawn and before exec (ex: redirections)
+		struct SpawnFileAction
+		{
+			enum class Type { Open, Duplicate, Close };
+			Type type{ Type::Close };
+			int fd{ -1 };
+			int sourceFd{ -1 };		// Duplicate: dup2(sourceFd, fd)
+			std::string path;		// Open: open(path, flags, mode) as fd
+			int flags{ 0 };
+			mode_t mode{ 0 };
+
+			static SpawnFileAction Open(int fd, const std::string& path, int flags, mode_t mode)
+			{
+				return { Type::Open, fd, -1, path, flags, mode };
+			}
+			static SpawnFileAction Duplicate(int sourceFd, int fd)
+			{
+				return { Type::Duplicate, fd, sourceFd, {}, 0, 0 };
+			}
+			static SpawnFileAction Close(int fd)
+			{
+				return { Type::Close, fd, -1, {}, 0, 0 };
+			}
+		};
+		using SpawnFileActionList = std::pmr::vector<SpawnFileAction>;
+
+		// Search each directory in searchPath (colon-separated, like $PATH) for an executable regular file named appName
+		bool FindExecutableInPath(const std::string& appName, const std::string& searchPath, std::string& pathOut);
+
+		// Launch app without copying the shell's address space (posix_spawn uses CLONE_VM|CLONE_VFORK on Linux).
+		// argv is built in the parent, in the arguments' memory. A pathToApp containing '/' is exec'd directly, 
+		// otherwise the process's $PATH is searched. pathToApp must view a '\0'-terminated string.
+		// Returns false with errno set if the app could not be started.
+		bool SpawnExternalApp(std::string_view pathToApp,
+							  const WordLists::WordList& arguments,
+							  const SpawnFileActionList& fileActions,
+							  char* const* envp,
+							  pid_t& childPidOut);
+
+		// Fallback for children that must run shell code instead of exec'ing an app. Forks, applies fileActions, 
+		// and exits with the return value of childMain.
+		bool ForkAndRun(const std::function<int()>& childMain,
+						const SpawnFileActionList& fileActions,
+						pid_t& childPidOut,
+						const std::string& perrorMessage);
+
+		// usageOut, if given, receives the child's resource usage (wait4)
+		bool WaitForChild(pid_t childPid, int& statusOut, const std::string& perrorMessage, rusage* usageOut = nullptr);
+
+		// Shell-style exit status from a waitpid status: exit code, or 128 + signal number
+		int WaitStatusToExitStatus(int waitStatus);
+
+		// Reap childPid if it has already exited, without blocking
+		bool TryReapChild(pid_t childPid, int& statusOut);
+
+		// Descriptor that becomes readable when the process exits (pidfd_open), or -1 if the kernel doesn't support it
+		int OpenProcessFd(pid_t pid);
+
+		// Block until one of processFds is readable (its process exited) or timeoutMilliseconds passes (-1 = no limit).
+		// Entries of -1 stand for processes without a descriptor and shorten the wait so the caller can check them.
+		bool WaitForProcessFds(const std::vector<int>& processFds, int timeoutMilliseconds);
+
+		// CPUs and NUMA memory nodes to run a process on. Children inherit both from the thread that 
+		// spawns them, so posix_spawn needs no hook in the child: the spawning thread takes the placement 
+		// for the spawn (ScopedPlacement).
+		struct Placement
+		{
+			cpu_set_t cpus;					// None set = unchanged
+			std::uint64_t memoryNodes{ 0 };	// Bit per node that memory is bound to, 0 = unchanged
+
+			Placement() { CPU_ZERO(&cpus); }
+		};
+
+		// Applies a placement to the calling thread while it lives, then puts back the thread's own
+		class ScopedPlacement
+		{
+		public:
+			explicit ScopedPlacement(const Placement& placement);
+			~ScopedPlacement();
+			ScopedPlacement(const ScopedPlacement&) = delete;
+			ScopedPlacement& operator=(const ScopedPlacement&) = delete;
+
+			// False with errno set if some of the placement could not be applied
+			bool IsApplied() const { return applied; }
+
+		private:
+			static constexpr unsigned long MAX_MEMORY_NODES{ 64 };
+			bool applied{ true };
+			bool cpusChanged{ false };
+			bool memoryChanged{ false };
+			cpu_set_t savedCpus;
+			int savedMemoryMode{ 0 };
+			unsigned long savedMemoryNodes{ 0 };
+		};
+
+		// CPU lists as in /sys and taskset: "0-7,16,18-19"
+		bool ParseCpuList(std::string_view text, cpu_set_t& cpusOut);
+		std::string FormatCpuList(const cpu_set_t& cpus);
+
+		// Online NUMA nodes and their CPUs. Without NUMA support there is only node 0, with every CPU.
+		bool GetOnlineNodes(std::vector<int>& nodesOut);
+		bool GetNodeCpus(int node, cpu_set_t& cpusOut);
+
+		// Pipe with both ends close-on-exec. Spawn file actions dup2 them onto stdin/stdout, which clears the flag.
+		bool CreatePipe(int& readFdOut, int& writeFdOut);
+
+		// Move everything from inFd to outFd until end of input without copying through user space (splice). 
+		// One of them must be a pipe. Falls back to read/write if the kernel refuses.
+		bool SpliceAll(int inFd, int outFd);
+
+		// Duplicate everything from pipe inFd into pipe outFd (tee) while moving a copy into copyFd (splice)
+		bool TeeAll(int inFd, int outFd, int copyFd);
+
+		// Write all of data, retrying short writes
+		bool WriteAll(int fd, const char* data, std::size_t size);
+
+		// Anonymous in-memory file (memfd), or -1
+		int CreateMemoryFile(const std::string& name);
+
+		// Send the whole file inFd, from its start, to outFd inside the kernel (sendfile)
+		bool SendFileAll(int inFd, int outFd);
+
+		// File of length-framed records ([length][bytes][length], native 32-bit lengths) that any number of 
+		// processes append to at once. Each record goes out in one O_APPEND write so appends never interleave 
+		// and need no lock. Reading is done straight from a read-only shared mapping, walking back from the end, 
+		// so opening costs the same however many records the file holds.
+		class AppendOnlyRecordFile
+		{
+		public:
+			using Offset = std::size_t;
+
+			AppendOnlyRecordFile() = default;
+			~AppendOnlyRecordFile();
+			AppendOnlyRecordFile(const AppendOnlyRecordFile&) = delete;
+			AppendOnlyRecordFile& operator=(const AppendOnlyRecordFile&) = delete;
+
+			// Creates the file if needed. On failure errno is left set.
+			bool Open(const std::string& path);
+			void Close();
+			bool IsOpen() const { return fd >= 0; }
+
+			// False if path now names a different file, ex: another process replaced it by renaming over it
+			bool IsFileAt(const std::string& path) const;
+
+			// On failure errno is left set
+			bool Append(std::string_view record);
+			bool Append(const std::vector<std::string>& records);	// In one write
+
+			// Maps records appended since the last refresh, by this or any other process.
+			// Returns true if the mapping changed, invalidating offsets and records gotten before.
+			bool Refresh();
+
+			// Offset just past the newest mapped record
+			Offset End() const { return mappedSize; }
+
+			// Record that ends at end. False at the start of the file, or at a damaged record.
+			bool GetRecordBefore(Offset end, std::string_view& recordOut, Offset& startOut) const;
+
+		private:
+			static void AppendFramed(std::string_view record, std::string& buffer);
+			bool WriteBuffer(const std::string& buffer);
+
+			int fd{ -1 };
+			const char* mapping{ nullptr };
+			Offset mappedSize{ 0 };
+		};
+
+		// Shell variables, in an open-addressing hash table of "NAME=value" strings. Some are exported: the envp 
+		// array children get is built on first use and reused by every spawn until an exported variable changes. 
+		// Setting unexported variables never touches it.
+		class Environment
+		{
+		public:
+			// Every variable in envp, exported
+			explicit Environment(char** envp);
+
+			// Value as a '\0'-terminated string, or nullptr if name is not set. Valid until name is set or unset.
+			const char* Get(std::string_view name) const;
+			bool IsExported(std::string_view name) const;
+
+			// Set keeps whether name is exported. Export of a name not set yet exports it once it is set.
+			void Set(std::string_view name, std::string_view value);
+			void Export(std::string_view name);
+			void Unset(std::string_view name);
+
+			char* const* GetEnvp();
+
+			// Whether name could be set: letters, digits and _, not starting with a digit
+			static bool IsValidName(std::string_view name);
+
+		private:
+			struct Slot
+			{
+				enum class State : unsigned char { Empty, Used, Removed };
+				std::unique_ptr<char[]> text;	// "NAME=value"
+				std::size_t hash{ 0 };
+				std::uint32_t nameSize{ 0 };
+				bool isSet{ false };			// False if only exported so far
+				bool exported{ false };
+				State state{ State::Empty };
+			};
+			std::size_t Find(std::string_view name, std::size_t hash) const;	// Slot index or NONE
+			Slot& Insert(std::string_view name);
+			void Grow();
+			static std::size_t Hash(std::string_view name) { return std::hash<std::string_view>{}(name); }
+			static constexpr std::size_t NONE{ static_cast<std::size_t>(-1) };
+
+			std::vector<Slot> slots;					// Size is a power of two
+			std::size_t usedOrRemovedCount{ 0 };
+			std::vector<char*> envp;					// Views into exported slots' text, then nullptr
+			bool envpValid{ false };
+		};
+
+		// Directory listings read with getdents64 in large batches, kept by device, inode and modification time 
+		// so a directory reached by several patterns or paths is read once. Kept until Clear.
+		class DirectoryCache
+		{
+		public:
+			struct Entry
+			{
+				std::string_view name;	// '\0'-terminated
+				unsigned char type;		// DT_DIR, DT_REG, DT_LNK, ..., or DT_UNKNOWN
+			};
+
+			// Entries of the directory open as dirFd, without . and .., or nullptr if it can't be read
+			const std::vector<Entry>* List(int dirFd);
+			void Clear();
+
+		private:
+			struct Key
+			{
+				dev_t device;
+				ino_t inode;
+				std::int64_t modifiedSeconds;
+				long modifiedNanoseconds;
+				bool operator==(const Key& other) const
+				{
+					return device == other.device && inode == other.inode && 
+						   modifiedSeconds == other.modifiedSeconds && modifiedNanoseconds == other.modifiedNanoseconds;
+				}
+			};
+			struct KeyHash
+			{
+				std::size_t operator()(const Key& key) const
+				{
+					return std::hash<ino_t>{}(key.inode) ^ (std::hash<dev_t>{}(key.device) << 1);
+				}
+			};
+			struct Listing
+			{
+				std::vector<char> records;	// As read: struct dirent64s
+				std::vector<Entry> entries;	// Viewing records
+			};
+			std::unordered_map<Key, Listing, KeyHash> listings;
+			std::vector<char> readBuffer;
+		};
+
+		// Paths matching pattern, sorted. Each component is matched by Strings::MatchesGlob, except ** which matches 
+		// any number of directories, not following symbolic links. Names starting with . are only matched by 
+		// a component starting with . and . and .. never are. A trailing / matches directories only. 
+		// False if nothing matched.
+		bool Glob(std::string_view pattern, DirectoryCache& cache, std::vector<std::string>& pathsOut);
+
+		// Returns the app's exit status, or 127 if it could not be started
+		int ExecuteExternalAppAndWait(const std::string& pathToApp,
+								const WordLists::WordList& arguments, 
 								const std::string& perrorMessage);
 	}
 
 	namespace Lists
 	{
-		template <class ElementType, class IndexType>
-		const ElementType* GetElementPtr(const std::list<ElementType>& sourceList, IndexType index)
-		{
-			if(sourceList.empty() || index < 0 || index >= sourceList.size())
-				return nullptr;
-			else if(index == sourceList.size() - 1)
-				return &sourceList.back();
-			else if(index == 0)
-				return &sourceList.front();
-			else
+		// Fixed-capacity list of unique strings, most recent first, stored in one contiguous ring of slots.
+		// Adding a string that is already present moves it to the front: the old slot is left empty, and 
+		// the ring has an eighth more slots than its capacity so empty slots are compacted away only after 
+		// that many moves, keeping adds amortized O(1). A hash index from string to slot finds duplicates in O(1).
+		class UniqueStringRing
+		{
+		public:
+			using size_type = std::size_t;
+
+			explicit UniqueStringRing(size_type capacity);
+			void AddToFront(const std::string& str);
+			void Clear();
+
+			// index 0 = most recent. O(1) unless moved duplicates left empty slots among the newest index entries.
+			const std::string* Get(size_type index) const;
+
+			// Up to count most recent strings, oldest first, gathered in one pass
+			void GetMostRecent(size_type count, std::vector<const std::string*>& stringsOut) const;
+
+			size_type Size() const { return numLive; }
+			size_type Capacity() const { return capacity; }
+			bool Empty() const { return numLive == 0; }
+
+		private:
+			struct Slot
 			{
-				auto it{ sourceList.begin() };
-				std::advance(it, index);
-				return &*it;
-			}
-		}
+				std::string str;
+				bool live{ false };
+			};
+			using Sequence = unsigned long long;	// Position in order of addition, never reused
+
+			Slot& SlotAt(Sequence sequence) { return slots[sequence % slots.size()]; }
+			const Slot& SlotAt(Sequence sequence) const { return slots[sequence % slots.size()]; }
+			size_type NumUsed() const { return numLive + numEmpty; }
+			void RemoveOldest();
+			void Compact();
+
+			size_type capacity;
+			std::vector<Slot> slots;
+			std::unordered_map<std::string_view, Sequence> index;	// Views into live slots
+			Sequence nextSequence{ 0 };
+			size_type numLive{ 0 };
+			size_type numEmpty{ 0 };
+		};
+
+		// Set of strings that share storage for common prefixes, for completion. A string inserted 
+		// several times (ex: the same app in two directories) stays until it is erased as many times.
+		// Nodes are small and live in one vector, children linked in character order, and each node knows 
+		// how many strings are under it so empty branches left by erasing are skipped.
+		class PrefixTrie
+		{
+		public:
+			using size_type = std::size_t;
+
+			PrefixTrie();
+			void Insert(std::string_view str);
+			void Erase(std::string_view str);
+			void Clear();
+			size_type Size() const { return nodes[ROOT].numUnder; }
+
+			// Up to maxCount strings starting with prefix, in order. Returns how many there are in all.
+			size_type Complete(std::string_view prefix, size_type maxCount, std::vector<std::string>& completionsOut) const;
+
+		private:
+			using NodeIndex = std::uint32_t;
+			static constexpr NodeIndex ROOT{ 0 };
+			static constexpr NodeIndex NONE{ 0 };	// The root is never a child
+			struct Node
+			{
+				NodeIndex firstChild{ NONE };
+				NodeIndex nextSibling{ NONE };
+				std::uint32_t numUnder{ 0 };		// Strings ending at or under this node
+				std::uint32_t numEnding{ 0 };		// Times the string ending here was inserted
+				char c{ '\0' };
+			};
+
+			// Child of parent for c, or NONE
+			NodeIndex FindChild(NodeIndex parent, char c) const;
+			void Collect(NodeIndex node, std::string& path, size_type maxCount, std::vector<std::string>& completionsOut) const;
 
-		template <class ElementType>
-		void AddUniqueElementToFront(const ElementType& sourceElement, std::list<ElementType>& destinationList)
+			std::vector<Node> nodes;
+		};
+
+		// Index from each three-character substring (trigram) to the ids of the texts containing it, for 
+		// substring search without scanning every text. A text containing a query contains all of the 
+		// query's trigrams, so only ids in every one of their lists are candidates; the caller checks those.
+		// Characters are folded to 64 classes (letters, digits, space, anything else) so the lists can be 
+		// found by direct indexing instead of hashing.
+		class TrigramIndex
 		{
-			auto foundExistingElementIter{ std::find(destinationList.begin(), destinationList.end(), sourceElement) };
-			if(foundExistingElementIter != destinationList.end())
+		public:
+			using Id = std::uint32_t;
+
+			TrigramIndex();
+
+			// Ids must be added in increasing order
+			void Add(Id id, std::string_view text);
+			void Clear();
+
+			// Newest (highest) id below beforeId whose text isMatch accepts, trying only candidates for query. 
+			// Queries under three bytes have no trigrams, so every id is a candidate.
+			bool FindBefore(std::string_view query, Id beforeId, const std::function<bool(Id)>& isMatch, Id& idOut) const;
+
+		private:
+			using Trigram = std::uint32_t;
+			static constexpr int CLASS_BITS{ 6 };
+			static Trigram TrigramAt(const char* text)
 			{
-				if(foundExistingElementIter != destinationList.begin())
-					destinationList.splice(destinationList.begin(), destinationList, foundExistingElementIter);
+				return (CharClass(text[0]) << (2 * CLASS_BITS)) | (CharClass(text[1]) << CLASS_BITS) | CharClass(text[2]);
 			}
-			else
-				destinationList.push_front(sourceElement);
-		}
+			static Trigram CharClass(char c);
+
+			std::vector<std::vector<Id>> postings;	// By trigram, ids in increasing order
+			Id endId{ 0 };							// One past the highest id added
+		};
+	}
+
+	namespace Console
+	{
+		// Terminal fd in raw mode (keys read one at a time, no echo, no signals from Ctrl-C) while this lives
+		class RawMode
+		{
+		public:
+			explicit RawMode(int fd);
+			~RawMode();
+			RawMode(const RawMode&) = delete;
+			RawMode& operator=(const RawMode&) = delete;
+			bool IsOn() const { return on; }
+
+		private:
+			int fd;
+			termios original{};
+			bool on{ false };
+		};
+
+		// Single-line editor for a terminal: cursor keys, Home/End, Backspace/Delete, Ctrl-A/E/K/U/W/L, 
+		// Up/Down through history, Ctrl-R incremental history search and Tab completion. Long lines scroll sideways.
+		class LineEditor
+		{
+		public:
+			// Replacements for the word before the cursor, and where that word starts
+			using Completer = std::function<void(std::string_view line, std::size_t cursor, 
+												 std::size_t& wordStartOut, std::vector<std::string>& completionsOut)>;
+
+			// History entry, 0 = newest. False past the oldest.
+			using HistorySource = std::function<bool(std::size_t index, std::string& entryOut)>;
+
+			// Newest history entry containing query that is older than position before (NO_POSITION = newest), 
+			// and its position
+			static constexpr std::size_t NO_POSITION{ static_cast<std::size_t>(-1) };
+			using HistorySearch = std::function<bool(std::string_view query, std::size_t before, 
+													 std::size_t& positionOut, std::string& entryOut)>;
+
+			LineEditor(int inFd, int outFd, Completer completer, HistorySource historySource, HistorySearch historySearch);
+
+			// Shows prompt and edits until Enter. Ctrl-C gives an empty line. 
+			// False at Ctrl-D on an empty line, end of input, or a read error.
+			bool ReadLine(std::string_view prompt, std::string& lineOut);
+
+		private:
+			enum Key : int
+			{
+				KEY_NONE = -1, KEY_END_OF_INPUT = -2, 
+				KEY_LEFT = 1000, KEY_RIGHT, KEY_UP, KEY_DOWN, KEY_HOME, KEY_END, KEY_DELETE
+			};
+			int ReadKey();
+			int Search();
+			bool SearchOlder(std::string_view query, std::size_t before, std::size_t& positionOut, std::string& matchOut);
+			bool ReadByteWithin(int timeoutMilliseconds, char& byteOut);
+			void Refresh();
+			void Complete(bool listIfUnchanged);
+			void ListCompletions(const std::vector<std::string>& completions);
+			void ShowHistoryEntry(std::size_t index);
+			void Write(std::string_view text);
+			std::size_t PreviousCharStart(std::size_t pos) const;
+			static std::size_t PreviousCharStartIn(std::string_view text, std::size_t pos);
+			std::size_t NextCharStart(std::size_t pos) const;
+			int TerminalWidth() const;
+
+			int inFd;
+			int outFd;
+			Completer completer;
+			HistorySource historySource;
+			HistorySearch historySearch;
+			std::string_view prompt;
+			std::string_view promptLastLine;
+			std::size_t promptWidth{ 0 };
+			std::string line;
+			std::size_t cursor{ 0 };
+			std::string lineBeforeHistory;		// The line being typed, while Up/Down show history
+			std::size_t historyIndex{ 0 };		// 0 = the line being typed, n = history entry n - 1
+			std::string output;					// Reused for each refresh
+		};
+
+		// Columns a string takes on a terminal: UTF-8 code points, minus escape sequences
+		std::size_t DisplayWidth(std::string_view text);
 	}
 
 	namespace Strings
 	{
-		bool ToInt(const std::string& str, int& out);
+		bool ToInt(std::string_view str, int& out);
+
+		// Writes str as a quoted JSON string
+		void PrintJsonString(std::ostream& os, std::string_view str);
+
+		// Whether text has a *, a ? or a [ closed by ]
+		bool HasGlobChars(std::string_view text);
+
+		// Whether name matches pattern: * matches any run of chars, ? any one char, [abc] [a-z] one char of a set,
+		// [!abc] or [^abc] one char not in a set. Anything else matches itself.
+		bool MatchesGlob(std::string_view pattern, std::string_view name);
+	}
+
+	namespace Hashing
+	{
+		// 128-bit fingerprint of a sequence of byte strings and numbers, for cache keys and content addresses. 
+		// Guards against accidental collisions, not deliberate ones: it is not a cryptographic hash.
+		class Fingerprint
+		{
+		public:
+			// Each piece is added with its length, so "ab" then "c" differs from "a" then "bc"
+			Fingerprint& Add(std::string_view bytes);
+			Fingerprint& Add(std::uint64_t value);
+
+			// 32 lowercase hex digits
+			std::string Hex() const;
+
+		private:
+			void Mix(std::uint64_t word);
+
+			std::uint64_t low{ 0x9e3779b97f4a7c15 };
+			std::uint64_t high{ 0xc2b2ae3d27d4eb4f };
+		};
+	}
+
+	namespace Stats
+	{
+		// Monotonic clock
+		using Nanoseconds = std::int64_t;
+		Nanoseconds Now();
+		Nanoseconds ToNanoseconds(const timeval& time);
+
+		// Counts of values (ex: durations) in logarithmic buckets, eight per power of two, so percentiles 
+		// are within an eighth of the true value. Fixed size: adding never allocates.
+		class Histogram
+		{
+		public:
+			void Add(Nanoseconds value);
+			std::uint64_t Count() const { return count; }
+			Nanoseconds Sum() const { return sum; }
+			Nanoseconds Min() const { return count ? min : 0; }
+			Nanoseconds Max() const { return max; }
+			Nanoseconds Mean() const { return count ? sum / static_cast<Nanoseconds>(count) : 0; }
+
+			// Smallest bucket bound that fraction (0 to 1) of the values are at or below
+			Nanoseconds Percentile(double fraction) const;
+
+		private:
+			static constexpr int SUB_BUCKET_BITS{ 3 };
+			static constexpr int NUM_BUCKETS{ (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS };
+			static int BucketOf(Nanoseconds value);
+			static Nanoseconds BucketUpperBound(int bucket);
+
+			std::uint64_t buckets[NUM_BUCKETS]{};
+			std::uint64_t count{ 0 };
+			Nanoseconds sum{ 0 };
+			Nanoseconds min{ 0 };
+			Nanoseconds max{ 0 };
+		};
 	}
 }